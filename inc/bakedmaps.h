@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "generatorpasses.h"
+
+/** BakedRoom::NameId of a room without a name */
+constexpr std::uint8_t NoBakedName = 0xFF;
+
+/** One cell of a BakedMap, a RoomArrayEntry without the heap allocated name so it can be the result of a constant expression */
+struct BakedRoom
+{
+	std::uint8_t GridType = 0;
+	std::uint8_t RoomType = 0;
+	std::uint8_t RoomZone = 0;
+
+	/** GetRoomNameId of the room's name, NoBakedName if it has none */
+	std::uint8_t NameId = NoBakedName;
+
+	/** RoomRotation, which is always a whole number of degrees */
+	std::uint16_t Rotation = 0;
+};
+
+/** A map generated at compile time */
+struct BakedMap
+{
+	int Seed = 0;
+	GeneratorRuleSet RuleSet = GeneratorRuleSet::Default;
+	std::array<std::array<BakedRoom, MapHeight + 1>, MapWidth + 1> Rooms{};
+	GenerationReport Report;
+
+	/** FNV-1a over every cell, what the golden results are checked against */
+	constexpr std::uint64_t GetHash() const
+	{
+		std::uint64_t Hash = 14695981039346656037ull;
+		for (const auto& Column : Rooms)
+		{
+			for (const BakedRoom& Room : Column)
+			{
+				for (unsigned Value : { unsigned(Room.GridType), unsigned(Room.RoomType), unsigned(Room.RoomZone), unsigned(Room.NameId), unsigned(Room.Rotation) })
+				{
+					Hash = (Hash ^ Value) * 1099511628211ull;
+				}
+			}
+		}
+		return Hash;
+	}
+
+	/** The same map Generator::CopyMap gives after GenerateMap(Seed) with RuleSet, names and all */
+	void CopyTo(GeneratedMap& OutMap) const;
+};
+
+/**
+* Runs every pass of GenerateMap(Seed) as a constant expression. Meant for constexpr variables, at run time it's just a slower GenerateMap.
+* Compilers cap how much work a constant expression can do. A map takes a few million steps, within GCC's default but past Clang's and MSVC's,
+* so CMakeLists.txt raises theirs.
+*/
+constexpr BakedMap BakeMap(int Seed, GeneratorRuleSet RuleSet = GeneratorRuleSet::Default)
+{
+	Generator Gen(false, RuleSet);
+	Gen.ResetMap(Seed);
+	WithRuleSet(RuleSet, [&Gen](auto Rules)
+	{
+		for (int Stage = 0; Stage < int(GenerationStage::Done); Stage++)
+		{
+			Gen.RunStage<decltype(Rules)>(GenerationStage(Stage));
+		}
+	});
+
+	BakedMap Map;
+	Map.Seed = Seed;
+	Map.RuleSet = RuleSet;
+	Map.Report = Gen.Report;
+	for (int X = 0; X <= MapWidth; X++)
+	{
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			const RoomArrayEntry& Entry = Gen.MapArray[X][Y];
+			BakedRoom& Room = Map.Rooms[X][Y];
+			Room.GridType = std::uint8_t(Entry.GridType);
+			Room.RoomType = std::uint8_t(Entry.RoomType);
+			Room.RoomZone = std::uint8_t(Entry.RoomZone);
+			Room.NameId = Entry.RoomName.empty() ? NoBakedName : std::uint8_t(GetRoomNameId(Entry.RoomName));
+			Room.Rotation = std::uint16_t(Entry.RoomRotation);
+		}
+	}
+	return Map;
+}
+
+/** The map for Seed baked into the binary, nullptr if it wasn't. See bakedmaps.cpp for which seeds are */
+const BakedMap* FindBakedMap(int Seed, GeneratorRuleSet RuleSet = GeneratorRuleSet::Default);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "generator.h"
+
+/** How many seeds are generated in lockstep, one per SIMD lane */
+#if defined(__AVX512F__)
+constexpr int BatchLaneCount = 16;
+#else
+constexpr int BatchLaneCount = 8;
+#endif
+
+/**
+* Runs the layout and classification passes of many seeds at once, one seed per SIMD lane.
+* Every lane has its own RNG and grid, lanes that take a different branch are masked off rather than split up.
+* Results are bit-identical to Generator::GenerateLayoutStage, finish them with Generator::GenerateMapFromLayout.
+*/
+class BatchGenerator
+{
+public:
+	void GenerateLayouts(const int* Seeds, int Count, LayoutStageResult* OutResults);
+
+	/** "AVX-512", "AVX2" or "Portable", depending on what this was compiled with */
+	static const char* GetInstructionSetName();
+
+	using LaneInt = std::array<std::int32_t, BatchLaneCount>;
+	using LaneBits = std::array<std::uint32_t, BatchLaneCount>;
+
+private:
+	void GenerateLanes(const int* Seeds, int Count, LayoutStageResult* OutResults);
+	void GenerateLayout();
+	void ClassifyRooms(int Count, LayoutStageResult* OutResults);
+
+	/** Advances the RNG of every lane in Mask and writes BlitzRand(From, To) for those lanes to Out */
+	void Rand(const LaneInt& Mask, const LaneInt& From, const LaneInt& To, LaneInt& Out);
+
+	alignas(64) LaneInt RndState{};
+
+	/** Per lane grids, one bit per X. Indexed [Y][Lane] so a row of every lane is one vector */
+	alignas(64) std::array<LaneBits, MapHeight + 1> Occupied{};
+	alignas(64) std::array<LaneBits, MapHeight + 1> Checkpoints{};
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <type_traits>
+#include <utility>
+
+#include "exactmath.h"
+
+/**
+* Blitz3D's Rnd/SeedRnd. This is a Lehmer generator (Park-Miller, A = 48271) evaluated with Schrage's method,
+* so every state only depends on the previous one.
+*/
+static constexpr int RND_A = 48271;
+static constexpr int RND_M = 2147483647;
+static constexpr int RND_Q = 44488;
+static constexpr int RND_R = 3399;
+
+/** Equivalent to SeedRnd, returns the first state */
+constexpr int BlitzRandSeedState(int Seed)
+{
+	Seed &= 0x7fffffff;
+	return Seed ? Seed : 1;
+}
+
+constexpr int BlitzRandNextState(int State)
+{
+	State = RND_A * (State % RND_Q) - RND_R * (State / RND_Q);
+	if (State < 0)
+		State += RND_M;
+	return State;
+}
+
+/** Maps a state to the float Rnd() returns */
+constexpr float BlitzRandToFloat(int State)
+{
+	return (State & 65535) / 65536.0f + (.5f / 65536.0f);
+}
+
+/**
+* Rnd/Rand/SeedRnd with the state owned by the caller instead of a global.
+* The next BlockSize states are computed ahead of time in one go (State * A^k mod M for every k, which vectorises as there's no chain between them),
+* Rnd just pops them. The sequence is exactly the same as stepping BlitzRandNextState one at a time.
+*/
+class BlitzRandom
+{
+public:
+	static constexpr int BlockSize = 64;
+
+	constexpr void Seed(int Seed)
+	{
+		SetState(BlitzRandSeedState(Seed));
+	}
+
+	/** The state of the last draw, i.e. what the Blitz global would hold */
+	constexpr int GetState() const { return State; }
+	constexpr void SetState(int NewState)
+	{
+		State = NewState;
+		BlockIndex = BlockSize;
+	}
+
+	constexpr float Rnd()
+	{
+		return BlitzRandToFloat(NextState());
+	}
+
+	/** Random number between From and To (inclusive), the bounds can be in either order */
+	constexpr int Rand(int From, int To = 1)
+	{
+		if (To < From) std::swap(From, To);
+
+		// Same as int(Rnd() * Range) without the float. Ranges past 2^24 aren't exact as a float, those keep the float math
+		const int Range = To - From + 1;
+		if (Range >= (1 << 24))
+		{
+			return int(Rnd() * Range) + From;
+		}
+		return ExactMath::ScaleRandState(NextState(), Range) + From;
+	}
+
+private:
+	void RefillBlock();
+
+	constexpr int NextState()
+	{
+		// The block is filled with intrinsics, at compile time the states are stepped one by one instead
+		if (std::is_constant_evaluated())
+		{
+			State = BlitzRandNextState(State);
+			return State;
+		}
+
+		if (BlockIndex == BlockSize)
+		{
+			RefillBlock();
+		}
+
+		State = Block[BlockIndex++];
+		return State;
+	}
+
+	int State = 1;
+	int BlockIndex = BlockSize;
+	alignas(64) std::array<int, BlockSize> Block{};
+};
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "generator.h"
+
+/** One step of GenerateMapAsync: a hallway row, a grid row or a zone of a pass. Layout's step 0 is the starting hallway */
+struct TraceStep
+{
+	GenerationStage Stage = GenerationStage::Layout;
+
+	/** Which step of its stage this is, counting from 0 */
+	int Iteration = 0;
+
+	/** Rnd calls from the start of the map to the end of this step */
+	std::uint32_t Draws = 0;
+
+	/** GetTraceGridHash of the grid after this step */
+	std::uint64_t GridHash = 0;
+
+	/** Bit Y set for every row this step changed a cell in */
+	std::uint32_t ChangedRows = 0;
+};
+
+/** What a cell holds that a trace tracks, in the order GetTraceGridHash hashes them */
+enum TraceField
+{
+	TraceGridType,
+	TraceRoomType,
+	TraceRoomZone,
+	TraceRoomName,
+
+	TraceFieldCount
+};
+
+/** A seed's generation as a list of steps, compact enough to keep thousands of them around */
+struct GenerationTrace
+{
+	int Seed = 0;
+	GeneratorRuleSet RuleSet = GeneratorRuleSet::Default;
+	std::vector<TraceStep> Steps;
+
+	/** The step that last changed each field of each cell, -1 if none did. Only recorded traces have these, loaded ones don't */
+	std::vector<std::int16_t> LastChanges;
+
+	std::int16_t GetLastChange(int X, int Y, TraceField Field) const
+	{
+		return LastChanges.empty() ? -1 : LastChanges[((X * (MapHeight + 1)) + Y) * TraceFieldCount + Field];
+	}
+};
+
+/**
+* FNV-1a over every cell, X then Y: the GridType, RoomType and RoomZone as one byte each, then the name and a 0.
+* Rotations are left out as the dumps don't have them, the draws they take still show up in the draw count.
+* Written out so an instrumented CB can produce the same hash.
+*/
+std::uint64_t GetTraceGridHash(const RoomGrid& Rooms);
+
+/** Where a map first stops matching its reference */
+struct Divergence
+{
+	enum EKind
+	{
+		/** The map matches */
+		None,
+		/** One trace has steps the other doesn't, or the stages of a step differ */
+		StepMismatch,
+		Draws,
+		GridHash,
+		/** A cell of the finished map differs from the dump, Field says which part */
+		Cell,
+	};
+
+	int Seed = 0;
+	EKind Kind = None;
+
+	/** The first step that's wrong, an index into the recorded trace */
+	int Step = -1;
+	GenerationStage Stage = GenerationStage::Layout;
+	int Iteration = 0;
+
+	/** For Cell */
+	int X = -1;
+	int Y = -1;
+	TraceField Field = TraceGridType;
+
+	/** What we have and what the reference has, as text */
+	std::string Ours;
+	std::string Reference;
+
+	/** One line, e.g. "Seed 1411 diverges at AssignRooms step 3: RoomName at (4, 14) is room2sl, reference has room2scps" */
+	std::string Describe() const;
+};
+
+/** A finished map dumped by CB, like testdata/mapdump_*.json. Only GridType, RoomType, RoomZone and RoomName are compared */
+struct MapDump
+{
+	int Seed = 0;
+	RoomGrid Rooms{};
+
+	/** Reads a dump written by CB's map dumper. False if the file can't be read or isn't a full grid */
+	bool Load(const std::string& Path);
+};
+
+struct DivergenceBisectorOptions
+{
+	/** 0 uses every hardware thread */
+	int ThreadCount = 0;
+
+	GeneratorRuleSet RuleSet = GeneratorRuleSet::Default;
+};
+
+/**
+* Finds the first step where our generator stops agreeing with a reference, instead of stepping through GenerateMap by hand.
+* A reference trace (from an instrumented CB, or another build of ours) pins it down to the exact step.
+* A dump only has the finished map, so the best it can do is the earliest step that left a wrong value behind:
+* the step that last changed a cell that ends up different, or for a field we never wrote, the first step of the stage that writes it.
+*/
+class DivergenceBisector
+{
+public:
+	explicit DivergenceBisector(DivergenceBisectorOptions InOptions = {});
+
+	/** Generates Seed a step at a time with Gen, tracing every step. The map is left in Gen */
+	static void Record(Generator& Gen, int Seed, GenerationTrace& OutTrace);
+
+	static Divergence Compare(const GenerationTrace& Trace, const GenerationTrace& Reference);
+	static Divergence CompareWithDump(const GenerationTrace& Trace, const RoomGrid& Rooms, const RoomGrid& Dump);
+
+	/** Records every reference's seed and compares, OutDivergences[i] being for References[i]. Runs across threads */
+	void CheckTraces(const std::vector<GenerationTrace>& References, std::vector<Divergence>& OutDivergences) const;
+	void CheckDumps(const std::vector<MapDump>& Dumps, std::vector<Divergence>& OutDivergences) const;
+
+	/**
+	* Traces as text, any number per file so a whole batch can be one reference:
+	*   trace <seed> <rule set>
+	*   <stage name> <iteration> <draws> <grid hash as 16 hex digits>   (one line per step)
+	*   end
+	*/
+	static bool SaveTraces(const std::string& Path, const std::vector<GenerationTrace>& Traces);
+	static bool LoadTraces(const std::string& Path, std::vector<GenerationTrace>& OutTraces);
+
+private:
+	/** Calls Check(Gen, i) for every i below Count, spread over the threads */
+	template<typename Function>
+	void ForEach(size_t Count, Function&& Check) const;
+
+	DivergenceBisectorOptions Options;
+};
+
+/**
+* Command line front end, argv[0] being "trace" or "bisect":
+*   trace --out <file> [--from <seed>] [--to <seed>] [--rules <n>]
+*   bisect (--trace <file> | --dump <file> --seed <text> | --dumps <dir>) [--threads <n>] [--rules <n>]
+* --dumps takes every mapdump_<seed text>.json in the directory. Returns the process exit code, 1 if anything diverged.
+*/
+int RunBisectCommand(int argc, char** argv);
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+
+/**
+* Integer versions of the float and double expressions CB's generator makes its layout decisions with.
+* Each one gives exactly what the IEEE expression gives (rounding of the product included) over the domain in its comment,
+* so the generator doesn't depend on how the compiler treats floating point (-ffast-math, FMA contraction, x87, vectorising).
+*/
+namespace ExactMath
+{
+	/** Division rounding towards negative infinity, Denominator has to be positive */
+	constexpr int FloorDiv(int Numerator, int Denominator)
+	{
+		const int Quotient = Numerator / Denominator;
+		return Quotient - (Numerator % Denominator < 0);
+	}
+
+	/**
+	* floor(P / 2^Scale) after rounding P = High * 2^Scale + Low to Significand bits, ties to even, which is what a float or double
+	* multiply does before the result is floored or truncated. Low has to be below 2^Scale and the bits dropped by the rounding can't be more than Scale.
+	*/
+	constexpr std::uint64_t FloorRounded(std::uint64_t High, std::uint64_t Low, int Scale, int Significand)
+	{
+		const int Width = High ? Scale + int(std::bit_width(High)) : int(std::bit_width(Low));
+		const int Dropped = Width - Significand;
+		if (Dropped <= 0)
+		{
+			return High;
+		}
+
+		// The only way rounding changes the floor is by carrying P up to the next multiple of 2^Scale
+		const std::uint64_t Gap = (std::uint64_t(1) << Scale) - Low;
+		const std::uint64_t Half = std::uint64_t(1) << (Dropped - 1);
+		const bool bUpperEven = Dropped < Scale || (High & 1) == 1;
+		return High + (Gap < Half || (Gap == Half && bUpperEven));
+	}
+
+	/** floor(Percent / 100.0 * double(Value)), for 0 <= Value < 2^24 */
+	template<int Percent>
+	constexpr int FloorPercent(int Value)
+	{
+		static_assert(Percent >= 7 && Percent < 100, "Fractions below 1/16 don't fit the 56 bit fixed point");
+
+		// The double is exact at 56 fractional bits, Value is split so each partial product stays in 64 bits
+		constexpr std::uint64_t Fraction = std::uint64_t(double(Percent) / 100.0 * 0x1p56);
+		constexpr std::uint64_t FractionHigh = Fraction >> 32;
+		constexpr std::uint64_t FractionLow = Fraction & 0xFFFFFFFFu;
+
+		const std::uint64_t HighProduct = FractionHigh * std::uint64_t(Value);
+		std::uint64_t High = HighProduct >> 24;
+		std::uint64_t Low = ((HighProduct & 0xFFFFFFu) << 32) + FractionLow * std::uint64_t(Value);
+		High += Low >> 56;
+		Low &= (std::uint64_t(1) << 56) - 1;
+
+		return int(FloorRounded(High, Low, 56, 53));
+	}
+
+	/** int(BlitzRandToFloat(State) * Range), for 1 <= Range < 2^24 */
+	constexpr int ScaleRandState(int State, int Range)
+	{
+		// The float is (2 * (State & 65535) + 1) / 2^17 exactly
+		const std::uint64_t Product = (std::uint64_t(State & 65535) * 2 + 1) * std::uint64_t(Range);
+		return int(FloorRounded(Product >> 17, Product & 0x1FFFFu, 17, 24));
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <stop_token>
+
+#include "generator.h"
+
+/**
+* A map being generated a step at a time, returned by Generator::GenerateMapAsync.
+* A step is one hallway row, grid row or zone of a pass, so each one only takes a fraction of a microsecond to a few microseconds.
+* Nothing runs until Advance or RunToCompletion is called. A finished task leaves exactly the map GenerateMap would have.
+*/
+class GenerationTask
+{
+public:
+	struct promise_type
+	{
+		promise_type() = default;
+
+		/** Picks the stop token out of GenerateMapAsync's arguments */
+		promise_type(Generator&, int, std::stop_token Token)
+			: StopToken(std::move(Token))
+		{
+		}
+
+		GenerationTask get_return_object() { return GenerationTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		void return_void() { Stage = GenerationStage::Done; }
+		void unhandled_exception() { Exception = std::current_exception(); }
+
+		std::suspend_always yield_value(GenerationStage NextStage) noexcept
+		{
+			Stage = NextStage;
+			return {};
+		}
+
+		GenerationStage Stage = GenerationStage::Layout;
+		std::stop_token StopToken;
+		std::exception_ptr Exception;
+	};
+
+	GenerationTask() = default;
+	GenerationTask(GenerationTask&& Other) noexcept;
+	GenerationTask& operator=(GenerationTask&& Other) noexcept;
+	GenerationTask(const GenerationTask&) = delete;
+	GenerationTask& operator=(const GenerationTask&) = delete;
+	~GenerationTask();
+
+	/**
+	* Runs steps until the map is finished or Budget has passed, at least one step runs per call.
+	* Returns IsFinished(), so this can be called once a frame until it returns true.
+	*/
+	bool Advance(std::chrono::microseconds Budget);
+	void RunToCompletion();
+
+	/** Stops generating and frees the task, the map is left half-built. Requesting a stop on the token passed to GenerateMapAsync does the same */
+	void Cancel();
+
+	/** True once the map is done or the task was cancelled */
+	bool IsFinished() const;
+	bool IsCancelled() const { return bCancelled; }
+
+	/** The stage the next step belongs to, Done once finished */
+	GenerationStage GetStage() const;
+
+private:
+	explicit GenerationTask(std::coroutine_handle<promise_type> InHandle)
+		: Handle(InHandle)
+	{
+	}
+
+	/** Runs one step, returns false if there was nothing left to run */
+	bool Step();
+
+	std::coroutine_handle<promise_type> Handle;
+	bool bCancelled = false;
+};
@@ -1,9 +1,17 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <algorithm>
 #include <array>
 #include <vector>
 #include <map>
+#include <memory>
+#include <cstdint>
+#include <stop_token>
+
+#include "blitzrand.h"
+#include "roomindex.h"
 
 enum RoomType
 {
@@ -43,6 +51,172 @@ struct RoomArrayEntry
 	float RoomRotation = 0.f;
 };
 
+/**
+* Snapshot of a map after the layout and classification passes, before any rooms are forced or assigned.
+* Nothing in these passes depends on anything but the seed, so this can be produced by the scalar generator or the BatchGenerator.
+*/
+struct LayoutStageResult
+{
+	int Seed = 0;
+
+	/** RNG state at the stage boundary */
+	int RndState = 0;
+
+	std::array<std::array<std::uint8_t, MapHeight + 1>, MapWidth + 1> GridType{};
+	std::array<std::array<std::uint8_t, MapHeight + 1>, MapWidth + 1> RoomTypes{};
+
+	/** Indexed by GetMapZone, so 0 is LCZ */
+	int Room1Amount[ZoneAmount]{};
+	int Room2Amount[ZoneAmount]{};
+	int Room2CAmount[ZoneAmount]{};
+	int Room3Amount[ZoneAmount]{};
+	int Room4Amount[ZoneAmount]{};
+};
+
+/** Passes of GenerateMap, in the order they run */
+enum class GenerationStage
+{
+	Layout,
+	Classification,
+	ForceRoom1s,
+	ForceRoom4sAndRoom2Cs,
+	PredefinedRooms,
+	AssignRooms,
+	Done
+};
+
+/** What happened while generating a map, beyond the map itself. Indexed by GetMapZone */
+struct GenerationReport
+{
+	/** Dead ends added because the zone had less than 5 ROOM1s */
+	int Room1sForced[ZoneAmount]{};
+
+	bool bRoom4Forced[ZoneAmount]{};
+	bool bRoom4ForceFailed[ZoneAmount]{};
+	bool bRoom2CForced[ZoneAmount]{};
+	bool bRoom2CForceFailed[ZoneAmount]{};
+
+	/** SetRoom calls that couldn't find a slot for their room */
+	int SetRoomFailures = 0;
+
+	/** Grid writes that were dropped because they were outside the grid */
+	int OutOfBoundsWrites = 0;
+};
+
+/** What a well-formed map satisfies, checked by MapValidator. Flags, so a validation run can pick which ones it checks */
+enum MapInvariant : unsigned
+{
+	/** Nothing tried to write outside the grid */
+	InvariantInBounds = 1 << 0,
+	/** Every occupied cell can be reached from every other one */
+	InvariantConnected = 1 << 1,
+	/** Hallways only cross a zone boundary through a checkpoint, every boundary has one and there are no checkpoints anywhere else */
+	InvariantZoneCheckpoints = 1 << 2,
+	/** The GridType of every room besides checkpoints is its neighbour count */
+	InvariantNeighbourCount = 1 << 3,
+	/** The RoomType of every room besides checkpoints matches its neighbours, e.g. ROOM2 for a straight hallway */
+	InvariantRoomShape = 1 << 4,
+	/** Every zone has a ROOM4, unless forcing one in failed */
+	InvariantRoom4PerZone = 1 << 5,
+	/** Every zone has a ROOM2C, unless forcing one in failed */
+	InvariantRoom2CPerZone = 1 << 6,
+
+	InvariantAll = (1 << 7) - 1
+};
+
+constexpr int MapInvariantCount = 7;
+
+/** An invariant a map broke, and where */
+struct MapViolation
+{
+	int Seed = 0;
+
+	/** The stage that had just finished when the invariant was first found broken */
+	GenerationStage Stage = GenerationStage::Layout;
+	MapInvariant Invariant = InvariantInBounds;
+
+	/** First offending cell, -1 for invariants that aren't about a single cell */
+	int X = -1;
+	int Y = -1;
+
+	/** Zone the violation is in as returned by GetMapZone, -1 if it isn't in any particular one */
+	int Zone = -1;
+};
+
+/** Built in rule variants, see generatorrules.h. Default is what CB does and what the test data is dumped from */
+enum class GeneratorRuleSet
+{
+	Default,
+	Intro,
+	Room3Gateway,
+};
+
+/** A finished map copied out of a Generator, so it can outlive it or be handed to another thread */
+struct GeneratedMap
+{
+	int Seed = 0;
+	GeneratorRuleSet RuleSet = GeneratorRuleSet::Default;
+	std::array<std::array<RoomArrayEntry, MapHeight + 1>, MapWidth + 1> Rooms{};
+	GenerationReport Report;
+};
+
+using RoomGrid = std::array<std::array<RoomArrayEntry, MapHeight + 1>, MapWidth + 1>;
+
+/** One cell of a Generator::SetCells batch */
+struct CellEdit
+{
+	int X = 0;
+	int Y = 0;
+	bool bOccupied = false;
+};
+
+/** A grid as one 19 bit mask per row, bit X set for cell X, for every grid and room type */
+struct MapBitboards
+{
+	using Rows = std::array<std::uint32_t, MapHeight + 1>;
+
+	Rows Occupied{};
+	Rows Checkpoints{};
+
+	/** Occupied cells by GridType, 1 to 4. The last plane has checkpoints and anything that isn't a valid grid type */
+	Rows GridTypes[6]{};
+
+	/** Occupied cells by RoomType, with an extra plane for invalid ones */
+	Rows RoomTypes[RoomType::Room4 + 2]{};
+
+	void Build(const RoomGrid& Rooms);
+
+	/** Moves one cell from the planes for its old contents to the ones for its new contents, so the boards can follow a grid as it's written */
+	constexpr void MoveCell(int X, int Y, int OldGridType, RoomType OldType, int GridType, RoomType Type)
+	{
+		// Only the planes the cell was in need clearing, an empty cell isn't in any
+		const std::uint32_t Bit = 1u << X;
+		if (OldGridType != 0)
+		{
+			Occupied[Y] &= ~Bit;
+			Checkpoints[Y] &= ~Bit;
+			GridTypes[GetGridTypePlane(OldGridType)][Y] &= ~Bit;
+			RoomTypes[GetRoomTypePlane(OldType)][Y] &= ~Bit;
+		}
+
+		if (GridType != 0)
+		{
+			Occupied[Y] |= Bit;
+			Checkpoints[Y] |= std::uint32_t(GridType == 255) << X;
+			GridTypes[GetGridTypePlane(GridType)][Y] |= Bit;
+			RoomTypes[GetRoomTypePlane(Type)][Y] |= Bit;
+		}
+	}
+
+	static constexpr unsigned GetGridTypePlane(int GridType) { return GridType >= 1 && GridType <= 4 ? unsigned(GridType) : 5u; }
+	static constexpr unsigned GetRoomTypePlane(RoomType Type) { return Type >= RoomType::Room0 && Type <= RoomType::Room4 ? unsigned(Type) : RoomType::Room4 + 1u; }
+};
+
+class GenerationTask;
+class GenerationProfiler;
+class MapPublisher;
+struct BakedMap;
+
 struct RoomData
 {
 	std::string RoomName = "";
@@ -53,38 +227,241 @@ struct RoomData
 class Generator
 {
 public:
-	Generator(bool _DebugPrint = false);
-	~Generator();
+	constexpr Generator(bool _DebugPrint = false, GeneratorRuleSet InRuleSet = GeneratorRuleSet::Default)
+		: DebugPrint(_DebugPrint)
+		, RuleSet(InRuleSet)
+	{
+	}
+
+	/** Picks which rule set the next map is generated with */
+	void SetRuleSet(GeneratorRuleSet InRuleSet) { RuleSet = InRuleSet; }
+	GeneratorRuleSet GetRuleSet() const { return RuleSet; }
+
+	static constexpr int GenerateSeed(std::string_view SeedStr)
+	{
+		int SeedNum = 0;
+		int Shift = 0;
+
+		for (const char Char : SeedStr)
+		{
+			SeedNum ^= Char << Shift;
+			Shift = (Shift + 1) % 24;
+		}
+
+		return SeedNum;
+	}
 
-	int GenerateSeed(const std::string& SeedStr);
 	void GenerateMap(const std::string& SeedStr);
+	void GenerateMap(int Seed);
+
+	/** Runs only the layout and classification passes for Seed and copies the result out */
+	void GenerateLayoutStage(int Seed, LayoutStageResult& OutResult);
+
+	/**
+	* Finishes a map from a layout produced by GenerateLayoutStage or the BatchGenerator. Produces the same map as GenerateMap(Layout.Seed).
+	* Like GenerateMapUntil, only the passes before Stage are run.
+	* The BatchGenerator only knows the default checkpoint room type, so its layouts only suit rule sets that keep it.
+	*/
+	void GenerateMapFromLayout(const LayoutStageResult& Layout, GenerationStage Stage = GenerationStage::Done);
+
+	/**
+	* Same map as GenerateMap(Seed), but as a task that can be advanced a bit at a time and cancelled, see GenerationTask.
+	* The generator has to outlive the task and can't be used for anything else until it's done.
+	*/
+	GenerationTask GenerateMapAsync(int Seed, std::stop_token StopToken = {});
+
+	/** Starts a map but only runs the passes before Stage, ContinueMapUntil picks up from there */
+	void GenerateMapUntil(int Seed, GenerationStage Stage);
+	void ContinueMapUntil(GenerationStage Stage);
+
+	/** Per-zone amounts as they are after the passes run so far, Zone as returned by GetMapZone */
+	int GetRoomAmount(RoomType Type, int Zone) const;
+	const GenerationReport& GetReport() const { return Report; }
 
 	RoomArrayEntry& GetDataAtCoordinate(int X, int Y);
+	const RoomGrid& GetMap() const { return MapArray; }
+
+	/** The RNG state, i.e. what Blitz's global would hold at this point of the map */
+	int GetRndState() const { return Random.GetState(); }
+
+	/** Copies out the map generated last */
+	void CopyMap(GeneratedMap& OutMap) const;
+
+	/** Where each named room of the map generated last is, by name id. Filled in by the AssignRooms pass */
+	const RoomIndex& GetRoomIndex() const { return Rooms; }
+
+	/** Where the first room named NameId ends up on the current map, NoCoordinate if it doesn't. Finishes the map first if it isn't done */
+	PackedCoordinate LocateRoom(int NameId);
+
+	/**
+	* Adds or removes a room cell and reclassifies only the cells next to it: their grid type, room type, rotation and the per-zone amounts.
+	* On a map Reclassify has been run on, the result is exactly what Reclassify would make of the edited grid.
+	* A cell left without neighbours isn't a room, like in ClassifyRooms, so a lone cell has to come in the same batch as its neighbour.
+	* Cells that stay rooms keep their names, cells that stop being rooms lose them. Edits never draw from the RNG:
+	* a Room2 keeps its rotation while it runs the same way, and takes the first of its two otherwise.
+	* False if X, Y is outside the cells ClassifyRooms covers.
+	*/
+	bool SetCell(int X, int Y, bool bOccupied);
+
+	/** Applies every edit, then reclassifies each cell next to one of them once. False if any edit was outside, the others are still applied */
+	bool SetCells(const std::vector<CellEdit>& Edits);
+
+	/**
+	* Reclassifies every cell the way SetCell does and recounts the per-zone amounts.
+	* Undoes what the forcing passes did that plain classification wouldn't, so run it once before editing a generated map.
+	*/
+	void Reclassify();
+
+	/**
+	* MapInvariant flags to check after every stage, 0 (the default) turns validation off.
+	* Each invariant is checked from the first stage it should hold after, and reported once at the stage it first broke.
+	*/
+	void SetValidation(unsigned Invariants) { Validation = Invariants; }
+	unsigned GetValidation() const { return Validation; }
+
+	/** Violations found in the map generated last */
+	const std::vector<MapViolation>& GetViolations() const { return Violations; }
+
+	/**
+	* Records hardware counters around every stage into InProfiler, nullptr (the default) turns profiling off.
+	* The profiler reads the counters of the thread generating, and only GenerateMap, GenerateMapUntil and ContinueMapUntil are profiled,
+	* GenerateMapAsync's steps are interleaved with whatever its caller does.
+	*/
+	void SetProfiler(GenerationProfiler* InProfiler) { Profiler = InProfiler; }
+
+	/**
+	* Publishes a copy of every map into InPublisher as it's finished, nullptr (the default) doesn't publish.
+	* MapArray is the back buffer while a map is generated, threads reading maps as they're generated go through the publisher's snapshots
+	* and not GetDataAtCoordinate, which would race with the next map.
+	*/
+	void SetPublisher(MapPublisher* InPublisher) { Publisher = InPublisher; }
+
+	/** 0 is LCZ, 2 is EZ. Doesn't depend on the map, so other generators can share it */
+	static constexpr int GetMapZone(int Y)
+	{
+		// floor(float(MapWidth - Y) / MapWidth * ZoneAmount), capped to the last zone
+		return std::min(ExactMath::FloorDiv((MapWidth - Y) * ZoneAmount, MapWidth), ZoneAmount - 1);
+	}
+
+	/** Changes whenever what GenerateLayoutStage produces for RuleSet could, so stored layouts can tell whether they're still good */
+	static std::uint64_t GetLayoutStageHash(GeneratorRuleSet RuleSet);
 private:
-	int GetMapZone(int Y);
+	/** Runs every pass at compile time, see bakedmaps.h */
+	friend constexpr BakedMap BakeMap(int Seed, GeneratorRuleSet RuleSet);
+
 	void OutputMap();
 
+	/** Calls Function with a default constructed rules struct for the selected rule set */
+	template<typename Function>
+	decltype(auto) WithRules(Function&& Call);
+
+	template<typename Rules>
+	void ContinueMapUntilWith(GenerationStage Stage);
+	template<typename Rules>
+	GenerationTask GenerateMapAsyncWith(int Seed, std::stop_token StopToken);
+
+	/**
+	* Generation passes, in the order GenerateMap runs them. The ones templated on Rules are where rule sets differ.
+	* These and the getters and setters they use are defined in generatorpasses.h
+	*/
+	constexpr void ResetMap(int Seed);
+	template<typename Rules>
+	constexpr void RunStage(GenerationStage Stage);
+	constexpr void GenerateLayout();
+	template<typename Rules>
+	constexpr void ClassifyRooms();
+	constexpr void ForceRoom1s();
+	constexpr void ForceRoom4sAndRoom2Cs();
+	template<typename Rules>
+	constexpr void AssignRooms();
+
+	/** The steps each pass is made of, GenerateMapAsync can stop between any two of them */
+	constexpr void BeginLayout();
+	constexpr void GenerateHallwayRow();
+	template<typename Rules>
+	constexpr void ClassifyRow(int Y);
+	constexpr void ForceRoom1sInZone(int i);
+	constexpr void ForceRoom4AndRoom2CInZone(int i);
+	template<typename Rules>
+	constexpr void PlacePredefinedRooms();
+	constexpr void AssignRoomsInRow(int Y);
+	template<typename Rules>
+	constexpr void AssignSpecialRooms();
+
+	/** Where the layout pass is between hallway rows */
+	struct LayoutCursor
+	{
+		int X = 0;
+		int Y = 0;
+		int Temp = 0;
+	};
+	LayoutCursor Cursor;
+
+	int CurrentSeed = 0;
+	GenerationStage NextStage = GenerationStage::Layout;
+	GenerationReport Report;
+
+	void ValidateStage(GenerationStage Stage);
+	unsigned Validation = 0;
+	unsigned ViolatedInvariants = 0;
+	std::vector<MapViolation> Violations;
+
+	GenerationProfiler* Profiler = nullptr;
+	MapPublisher* Publisher = nullptr;
+
+	/** Time spent in the stages of the current map so far, for Metrics */
+	std::uint64_t MapNanoseconds = 0;
+	void RecordMapMetrics();
+
+	/** MapArray as bitboards, kept up to date by the setters while validating so checking a stage doesn't have to walk the grid */
+	MapBitboards Bitboards;
+	bool bTrackBitboards = false;
+
+	void StoreLayout(LayoutStageResult& OutResult);
+	void RestoreLayout(const LayoutStageResult& Layout);
+
 	/** Equivalent to MapTemp, but using a struct for everything */
-	std::array<std::array<RoomArrayEntry, MapWidth + 1>, MapWidth + 1> MapArray{};
+	RoomGrid MapArray{};
 
 	/** Array safe getters */
-	void SetGridType(int X, int Y, int Value = 0);
-	int GetGridType(int X, int Y);
+	constexpr void SetGridType(int X, int Y, int Value = 0);
+	constexpr int GetGridType(int X, int Y);
 
-	void SetRoomType(int X, int Y, RoomType Value = RoomType::Room1);
-	RoomType GetRoomType(int X, int Y);
+	constexpr void SetRoomType(int X, int Y, RoomType Value = RoomType::Room1);
+	constexpr RoomType GetRoomType(int X, int Y);
 
-	void SetZone(int X, int Y, int Value);
-	int GetZone(int X, int Y);
+	constexpr void SetZone(int X, int Y, int Value);
+	constexpr int GetZone(int X, int Y);
 
 	/** Copy of CreateRoom but doesn't spawn the room, but assigns it to the grid */
-	bool AssignRoomToCoordinate(ERoomZone RoomZone, RoomType RoomType, int X, int Y, const std::string& Name = "");
+	constexpr bool AssignRoomToCoordinate(ERoomZone RoomZone, RoomType RoomType, int X, int Y, std::string_view Name = {});
+
+	constexpr float GetDesiredRoomAngle(RoomType RoomType, int X, int Y);
+
+	/** Map editing, see SetCell */
+	bool SetCells(const CellEdit* Edits, size_t Count);
+	void ReclassifyCell(int X, int Y, RoomType CheckpointRoomType);
+	RoomType GetCheckpointRoomType();
 
-	float GetDesiredRoomAngle(RoomType RoomType, int X, int Y);
+	/** Adds Delta to the per-zone amount of the cell's room type, the way ClassifyRow counts it */
+	void CountRoom(int X, int Y, int Delta);
 
 	bool DebugPrint = false;
+	GeneratorRuleSet RuleSet = GeneratorRuleSet::Default;
+
+	/** Blitz keeps this global, we keep one per generator so generators can run side by side */
+	BlitzRandom Random;
+
+	/** @UE_PORT_TODO Use a map instead*/
+	int Room1Amount[ZoneAmount]{};
+	int Room2Amount[ZoneAmount]{};
+	int Room2CAmount[ZoneAmount]{};
+	int Room3Amount[ZoneAmount]{};
+	int Room4Amount[ZoneAmount]{};
 
 	/** @todo Maybe make this a map? The first index is the roomtype*/
 	std::vector<std::vector<std::string>> PredefinedRooms;
-	bool SetRoom(std::string RoomName, RoomType RoomType, int Pos, int MinPos, int MaxPos);
+
+	RoomIndex Rooms;
+	constexpr bool SetRoom(std::string RoomName, RoomType RoomType, int Pos, int MinPos, int MaxPos);
 };
\ No newline at end of file
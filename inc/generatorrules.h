@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+
+#include "generator.h"
+
+/**
+* Decisions that differ between the CB-derived generators we run. Every rule set gets its own instantiation of the
+* passes that use them, so the choices are made at compile time and nothing is checked while a map is generated.
+* New rule sets derive from DefaultRules, override what they change and get added to GeneratorRuleSet and Generator::WithRules.
+*/
+struct DefaultRules
+{
+	/** Shape checkpoints are classified as. Their grid type stays CHECKPOINT whatever this is */
+	static constexpr RoomType CheckpointRoomType = RoomType::Room2;
+
+	/** Place 173's intro room next to the bottom of the map, like CB does with the intro enabled */
+	static constexpr bool bIntroRoom = false;
+
+	/** Put room3gw on the first EZ ROOM3 */
+	static constexpr bool bRoom3Gateway = false;
+};
+
+/** CB with the intro enabled */
+struct IntroRules : DefaultRules
+{
+	static constexpr bool bIntroRoom = true;
+};
+
+/** Default rules plus the EZ room3gw */
+struct Room3GatewayRules : DefaultRules
+{
+	static constexpr bool bRoom3Gateway = true;
+};
+
+/** Calls Call with a default constructed rules struct for RuleSet */
+template<typename Function>
+constexpr decltype(auto) WithRuleSet(GeneratorRuleSet RuleSet, Function&& Call)
+{
+	switch (RuleSet)
+	{
+	case GeneratorRuleSet::Intro:
+		return Call(IntroRules{});
+	case GeneratorRuleSet::Room3Gateway:
+		return Call(Room3GatewayRules{});
+	case GeneratorRuleSet::Default:
+	default:
+		return Call(DefaultRules{});
+	}
+}
+
+/** Bump whenever the layout or classification passes (or BlitzRandom) change what they produce, so layouts cached by older builds get regenerated */
+constexpr std::uint32_t LayoutStageVersion = 1;
+
+/** Identifies everything the layout and classification passes depend on. Rule sets that only differ in later passes share it */
+template<typename Rules>
+constexpr std::uint64_t GetLayoutStageHash()
+{
+	std::uint64_t Hash = 14695981039346656037ull;
+	for (std::uint32_t Value : { LayoutStageVersion, std::uint32_t(Rules::CheckpointRoomType) })
+	{
+		for (int Byte = 0; Byte < 4; Byte++)
+		{
+			Hash = (Hash ^ ((Value >> (Byte * 8)) & 0xff)) * 1099511628211ull;
+		}
+	}
+	return Hash;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "generator.h"
+#include "metrics.h"
+
+/** Where a load test's sessions get their maps from */
+enum LoadTestTarget
+{
+	/** Every session generates on its own thread with its own Generator, like a server generating where the request lands */
+	LoadTargetInProcess,
+	/** Sessions queue requests to a pool of worker threads and wait for the map, a stand-in for a local generation service */
+	LoadTargetService,
+};
+
+struct LoadTestOptions
+{
+	/** Sessions playing at once, each on a thread of its own */
+	int Sessions = 8;
+
+	/**
+	* Map requests per second over every session, arriving at random (Poisson). Latency is counted from when a request was due,
+	* so sessions falling behind show up in the tail instead of quietly lowering the rate.
+	* 0 runs closed loop instead: each session asks for its next map ThinkMilliseconds after it got the last one.
+	*/
+	double ArrivalRate = 0.0;
+
+	/** Mean pause between a session's maps in closed loop, exponentially distributed */
+	double ThinkMilliseconds = 0.0;
+
+	double Seconds = 10.0;
+
+	/** How often a LoadTestInterval is taken */
+	double IntervalSeconds = 1.0;
+
+	/** Seeds played, the Nth most popular being played 1 / N^ZipfExponent as often as the most popular one */
+	int SeedCount = 100000;
+	double ZipfExponent = 1.0;
+
+	/** Chance a session replays the seed it played last instead of picking one */
+	double RepeatRate = 0.1;
+
+	LoadTestTarget Target = LoadTargetInProcess;
+
+	/** Worker threads of the stand-in service, 0 uses every hardware thread */
+	int ServiceThreads = 0;
+
+	GeneratorRuleSet RuleSet = GeneratorRuleSet::Default;
+
+	/** Seeds the sessions' random choices, so runs can be repeated */
+	std::uint32_t RandomSeed = 1;
+};
+
+/** What happened over one interval of a load test */
+struct LoadTestInterval
+{
+	/** Seconds from the start of the test to the end of the interval */
+	double Time = 0.0;
+
+	std::uint64_t Completed = 0;
+
+	/** Maps per second */
+	double Throughput = 0.0;
+
+	/** Nanoseconds, see LatencyHistogram::GetPercentile */
+	std::uint64_t P50 = 0;
+	std::uint64_t P99 = 0;
+	std::uint64_t P999 = 0;
+	std::uint64_t Max = 0;
+
+	/** CPU time the process used over the wall time of every hardware thread, 0 to 1. 0 where it can't be read */
+	double CpuUtilisation = 0.0;
+};
+
+struct LoadTestReport
+{
+	std::vector<LoadTestInterval> Intervals;
+
+	/** Every request of the test */
+	LatencyHistogram Latencies;
+	std::uint64_t Completed = 0;
+	std::uint64_t Repeats = 0;
+
+	double Seconds = 0.0;
+	double Throughput = 0.0;
+	double CpuUtilisation = 0.0;
+};
+
+/**
+* Plays sessions against the generator the way game servers do, to see how it holds up under real traffic rather than in a tight loop:
+* maps per second, tail latency and CPU use over time. Running it at a few session counts shows whether throughput keeps scaling,
+* which is where lock contention or allocator thrash show up first.
+*/
+class LoadTest
+{
+public:
+	explicit LoadTest(LoadTestOptions InOptions = {});
+
+	/** Runs the test on the calling thread, which takes the intervals while the sessions run */
+	LoadTestReport Run();
+
+	/** Called with every interval as it's taken */
+	std::function<void(const LoadTestInterval& Interval)> OnInterval;
+
+	/** A seed picked by popularity */
+	int PickSeed(std::mt19937& Random) const;
+
+private:
+	LoadTestOptions Options;
+
+	/** Zipf CDF, SeedPopularity[i] being the chance of picking one of the i + 1 most popular seeds */
+	std::vector<double> SeedPopularity;
+};
+
+/**
+* Command line front end, argv[0] being "loadtest":
+*   loadtest [--sessions <n>[,<n>...]] [--rate <maps/s>] [--think <ms>] [--seconds <s>] [--interval <s>] [--seeds <n>] [--zipf <s>]
+*            [--repeat <0-1>] [--service <threads>] [--rules <n>] [--random-seed <n>]
+* --service sends requests through the stand-in service instead of generating in-process.
+* Several session counts run one after another and end with a table of how throughput scaled. Returns the process exit code.
+*/
+int RunLoadTestCommand(int argc, char** argv);
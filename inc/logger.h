@@ -0,0 +1,252 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+
+enum class LogLevel : std::uint8_t
+{
+	Debug,
+	Warning,
+	Error,
+	None,
+};
+
+/**
+* Anything below this is compiled out, arguments and all. 0 = Debug, 1 = Warning, 2 = Error, 3 = nothing.
+* Set through the SCPROOMGEN_LOG_LEVEL cache variable in CMake.
+*/
+#ifndef SCPROOMGEN_LOG_LEVEL
+#define SCPROOMGEN_LOG_LEVEL 0
+#endif
+
+inline constexpr LogLevel CompiledLogLevel = LogLevel(SCPROOMGEN_LOG_LEVEL);
+
+/** "[DEBUG]", "[WARNING]" or "[ERROR]" */
+const char* GetLogLevelPrefix(LogLevel Level);
+
+/**
+* One log call, as written by the thread that made it. The arguments are copied in as raw bytes and only turned
+* into text by Format once the logger thread reads the record. Strings are copied too (cut to fit), nothing else
+* in here may point at memory the caller owns, apart from the format string which has to be a literal.
+*/
+struct LogRecord
+{
+	static constexpr int PayloadSize = 104;
+
+	using FormatFunction = void (*)(const LogRecord& Record, std::string& OutText);
+
+	FormatFunction Format = nullptr;
+	const char* FormatString = nullptr;
+	LogLevel Level = LogLevel::Debug;
+	std::array<std::uint8_t, PayloadSize> Payload;
+};
+
+/** How a single argument type is packed into a LogRecord and read back out */
+template<typename T, typename Enable = void>
+struct LogArgument
+{
+	static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T> || std::is_pointer_v<T>, "Log arguments have to be numbers, enums or strings");
+
+	static constexpr int FixedSize = sizeof(T);
+
+	static void Write(std::uint8_t*& Cursor, const std::uint8_t*, T Value)
+	{
+		std::memcpy(Cursor, &Value, sizeof(T));
+		Cursor += sizeof(T);
+	}
+
+	static T Read(const std::uint8_t*& Cursor)
+	{
+		T Value;
+		std::memcpy(&Value, Cursor, sizeof(T));
+		Cursor += sizeof(T);
+		return Value;
+	}
+};
+
+/** Strings are stored inline and NUL terminated, so reading them back just points into the record */
+template<typename T>
+struct LogArgument<T, std::enable_if_t<std::is_convertible_v<const T&, std::string_view> && !std::is_same_v<T, std::nullptr_t>>>
+{
+	static constexpr int FixedSize = 1;
+
+	/** End leaves room for the arguments after this one, there's always space for at least the NUL */
+	static void Write(std::uint8_t*& Cursor, const std::uint8_t* End, const T& Value)
+	{
+		std::string_view Text(Value);
+		size_t Length = std::min<size_t>(Text.size(), size_t(End - Cursor) - 1);
+		std::memcpy(Cursor, Text.data(), Length);
+		Cursor[Length] = 0;
+		Cursor += Length + 1;
+	}
+
+	static const char* Read(const std::uint8_t*& Cursor)
+	{
+		const char* Text = reinterpret_cast<const char*>(Cursor);
+		Cursor += std::strlen(Text) + 1;
+		return Text;
+	}
+};
+
+template<typename... Args>
+void FormatLogRecord(const LogRecord& Record, std::string& OutText)
+{
+	const std::uint8_t* Cursor = Record.Payload.data();
+
+	// Braced initialisers run left to right, so this reads the arguments back in the order they were written
+	std::tuple<decltype(LogArgument<Args>::Read(Cursor))...> Values{ LogArgument<Args>::Read(Cursor)... };
+
+	OutText += GetLogLevelPrefix(Record.Level);
+	std::apply([&](auto... Value)
+	{
+		char Stack[256];
+		int Length = std::snprintf(Stack, sizeof(Stack), Record.FormatString, Value...);
+		if (Length < int(sizeof(Stack)))
+		{
+			OutText.append(Stack, std::max(Length, 0));
+			return;
+		}
+
+		size_t Start = OutText.size();
+		OutText.resize(Start + Length + 1);
+		std::snprintf(&OutText[Start], Length + 1, Record.FormatString, Value...);
+		OutText.resize(Start + Length);
+	}, Values);
+}
+
+/**
+* Single producer, single consumer ring of records. Every thread that logs gets one of its own, so writing a record
+* never takes a lock or touches stdout. If the logger thread falls behind the record is dropped and counted.
+*/
+class LogRing
+{
+public:
+	static constexpr std::uint32_t Capacity = 512;
+
+	LogRecord* BeginWrite();
+	void EndWrite();
+	void CountDropped() { Dropped.fetch_add(1, std::memory_order_relaxed); }
+
+	/** Consumer side, only the logger thread calls these */
+	const LogRecord* Peek();
+	void Pop();
+	std::uint32_t TakeDropped() { return Dropped.exchange(0, std::memory_order_relaxed); }
+
+	/** Set while a thread owns the ring. Rings of finished threads get handed to new ones */
+	std::atomic<bool> bInUse = false;
+
+private:
+	alignas(64) std::atomic<std::uint32_t> Head = 0;
+	alignas(64) std::atomic<std::uint32_t> Tail = 0;
+	alignas(64) std::atomic<std::uint32_t> Dropped = 0;
+	std::array<LogRecord, Capacity> Records;
+};
+
+/**
+* Owns the per-thread rings and the one background thread that drains them, formats the records and hands the text to
+* the sink in batches. Messages from one thread keep their order, messages from different threads may not.
+*/
+class Logger
+{
+public:
+	using SinkFunction = std::function<void(std::string_view Text)>;
+
+	static Logger& Get();
+
+	~Logger();
+
+	template<typename... Args>
+	void Write(LogLevel Level, const char* FormatString, const Args&... Arguments)
+	{
+		constexpr int FixedSize = (LogArgument<std::decay_t<Args>>::FixedSize + ... + 0);
+		static_assert(FixedSize <= LogRecord::PayloadSize, "Too many log arguments");
+
+		LogRing* Ring = GetThreadRing();
+		LogRecord* Record = Ring ? Ring->BeginWrite() : nullptr;
+		if (!Record)
+		{
+			CountDropped(Ring);
+			return;
+		}
+
+		// Strings get whatever space the fixed size arguments after them don't need
+		std::uint8_t* Cursor = Record->Payload.data();
+		const std::uint8_t* End = Cursor + LogRecord::PayloadSize;
+		int Reserved = FixedSize;
+		((Reserved -= LogArgument<std::decay_t<Args>>::FixedSize, LogArgument<std::decay_t<Args>>::Write(Cursor, End - Reserved, Arguments)), ...);
+
+		Record->Format = &FormatLogRecord<std::decay_t<Args>...>;
+		Record->FormatString = FormatString;
+		Record->Level = Level;
+		Ring->EndWrite();
+	}
+
+	/** Blocks until everything logged before the call has reached the sink */
+	void Flush();
+
+	/** Replaces where formatted text goes, stdout by default. The sink is only ever called from the logger thread, an empty one goes back to stdout */
+	void SetSink(SinkFunction InSink);
+
+private:
+	Logger();
+
+	/** The calling thread's ring, nullptr if every ring is taken */
+	LogRing* GetThreadRing();
+	LogRing* AcquireRing();
+	void CountDropped(LogRing* Ring);
+
+	void Run();
+	bool DrainRings(std::string& OutText);
+
+	std::mutex Mutex;
+	std::condition_variable Wake;
+	std::condition_variable Drained;
+	std::uint64_t FlushesRequested = 0;
+	std::uint64_t FlushesDone = 0;
+	bool bStopping = false;
+
+	/** Only ever grows, so rings can be read without the lock once the count is loaded */
+	std::array<std::unique_ptr<LogRing>, 256> Rings;
+	std::atomic<int> RingCount = 0;
+
+	/** Messages from threads that couldn't get a ring */
+	std::atomic<std::uint32_t> Dropped = 0;
+
+	SinkFunction Sink;
+	std::thread Thread;
+};
+
+#define SCPROOMGEN_LOG(Level, format, ...) \
+	do \
+	{ \
+		if constexpr (Level >= CompiledLogLevel) \
+		{ \
+			Logger::Get().Write(Level, format "\n", ##__VA_ARGS__); \
+		} \
+	} while (0)
+
+/** Same as SCPROOMGEN_LOG, but only when bCondition holds. The condition is compiled out along with the call */
+#define SCPROOMGEN_LOG_IF(bCondition, Level, format, ...) \
+	do \
+	{ \
+		if constexpr (Level >= CompiledLogLevel) \
+		{ \
+			if (bCondition) \
+			{ \
+				Logger::Get().Write(Level, format "\n", ##__VA_ARGS__); \
+			} \
+		} \
+	} while (0)
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "generator.h"
+#include "mappedfile.h"
+
+/**
+* Writes finished maps into a compact archive, one block of MapsPerBlock maps at a time.
+*
+* Inside a block every field is its own column. Each map keeps a 361 bit occupancy bitboard, and only cells that differ from a freshly reset
+* grid get anything else: a 3 bit grid type, 3 bit room type, 2 bit zone, 2 bit rotation and a name flag, each bit-packed into its column.
+* Names go through a dictionary and are stored with as many bits as the block's largest id needs. Maps have to be added in ascending seed order.
+*/
+class MapArchiveWriter
+{
+public:
+	explicit MapArchiveWriter(int InMapsPerBlock = 4096);
+	~MapArchiveWriter();
+
+	bool Open(const std::string& Path);
+
+	/** Fails for maps the format can't hold exactly, e.g. rotations that aren't a multiple of 90 */
+	bool Add(const GeneratedMap& Map);
+
+	/** Writes the last block and the tables, the archive can't be read before this */
+	bool Close();
+
+	std::uint64_t GetMapCount() const { return MapCount; }
+
+private:
+	struct BitColumn
+	{
+		std::vector<std::uint64_t> Words;
+		std::uint64_t BitCount = 0;
+
+		void Push(std::uint32_t Value, int Bits);
+	};
+
+	struct BlockBuilder
+	{
+		std::vector<int> Seeds;
+		std::vector<std::uint64_t> Occupancy;
+		std::vector<std::uint32_t> Samples;
+		BitColumn GridTypes;
+		BitColumn RoomTypes;
+		BitColumn Zones;
+		BitColumn Rotations;
+		BitColumn Named;
+		std::vector<std::uint32_t> NameIds;
+		std::vector<std::uint64_t> Reports;
+		std::uint32_t CellCount = 0;
+	};
+
+	bool WriteBlock();
+	std::uint32_t GetNameId(const std::string& Name);
+
+	int MapsPerBlock = 4096;
+	std::ofstream Out;
+	std::uint64_t Position = 0;
+	std::uint64_t MapCount = 0;
+	GeneratorRuleSet RuleSet = GeneratorRuleSet::Default;
+
+	BlockBuilder Block;
+
+	struct BlockIndexEntry
+	{
+		std::int32_t FirstSeed;
+		std::int32_t LastSeed;
+		std::uint64_t Offset;
+	};
+	std::vector<BlockIndexEntry> BlockIndex;
+
+	std::unordered_map<std::string, std::uint32_t> NameIds;
+	std::vector<std::string> Names;
+};
+
+/** Reads a MapArchiveWriter archive in place. Getting one map only touches its own block and decodes at most 32 maps' worth of bitboards */
+class MapArchive
+{
+public:
+	bool Open(const std::string& Path);
+	bool IsOpen() const { return File.IsOpen(); }
+
+	std::uint64_t GetMapCount() const;
+
+	/** Decodes the map for Seed, false if it isn't in the archive */
+	bool Read(int Seed, GeneratedMap& OutMap) const;
+
+private:
+	MappedFile File;
+	std::vector<std::string> Names;
+};
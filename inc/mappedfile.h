@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/** Read only memory mapping of a whole file. Used by the on-disk formats so they can be read in place */
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	/** Maps Path, dropping whatever was mapped before. Empty files fail */
+	bool Open(const std::string& Path);
+	void Close();
+
+	bool IsOpen() const { return Data != nullptr; }
+	const std::uint8_t* GetData() const { return Data; }
+	size_t GetSize() const { return Size; }
+
+	template<typename T>
+	const T* At(std::uint64_t Offset) const { return reinterpret_cast<const T*>(Data + Offset); }
+
+private:
+	const std::uint8_t* Data = nullptr;
+	size_t Size = 0;
+
+#ifdef _WIN32
+	void* FileHandle = nullptr;
+	void* Mapping = nullptr;
+#endif
+};
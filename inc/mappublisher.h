@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "generator.h"
+
+/**
+* A published map, held for as long as the handle lives. The map can't change underneath it, however many maps get published meanwhile.
+* Keep them short lived: a map stays in memory until every snapshot taken while it was current is gone.
+*/
+class MapSnapshot
+{
+public:
+	MapSnapshot() = default;
+	MapSnapshot(MapSnapshot&& Other) noexcept;
+	MapSnapshot& operator=(MapSnapshot&& Other) noexcept;
+	MapSnapshot(const MapSnapshot&) = delete;
+	MapSnapshot& operator=(const MapSnapshot&) = delete;
+	~MapSnapshot();
+
+	/** False until the first map is published */
+	explicit operator bool() const { return Map != nullptr; }
+
+	const GeneratedMap& operator*() const { return *Map; }
+	const GeneratedMap* operator->() const { return Map; }
+
+	const RoomArrayEntry& GetDataAtCoordinate(int X, int Y) const { return Map->Rooms[X][Y]; }
+
+	/** Gives the map back early */
+	void Release();
+
+private:
+	friend class MapPublisher;
+
+	MapSnapshot(std::atomic<std::uint64_t>* InSlot, const GeneratedMap* InMap)
+		: Slot(InSlot)
+		, Map(InMap)
+	{
+	}
+
+	std::atomic<std::uint64_t>* Slot = nullptr;
+	const GeneratedMap* Map = nullptr;
+};
+
+/**
+* Hands finished maps from a generating thread to any number of reading threads, RCU style.
+* A Generator with a publisher set (Generator::SetPublisher) keeps building maps in its own grid as its back buffer and only publishes
+* a copy once a map is done, so readers never see a half-built map and never touch the grid being generated.
+*
+* Acquire is a slot claim and two loads, with no locks and nothing that waits on generation. Old maps are reclaimed by epoch:
+* a reader marks its slot with the epoch it started in, and a map replaced in epoch E is recycled as the next back buffer
+* once no slot is marked with anything older than E.
+*/
+class MapPublisher
+{
+public:
+	/** Snapshots that can be held at once. Acquiring more waits for one to be released, never for generation */
+	static constexpr int MaxReaders = 64;
+
+	MapPublisher();
+	~MapPublisher();
+
+	MapPublisher(const MapPublisher&) = delete;
+	MapPublisher& operator=(const MapPublisher&) = delete;
+
+	/** The map published last, empty if there isn't one yet */
+	MapSnapshot Acquire() const;
+
+	/** Copies out the map Gen generated last and makes it current */
+	void Publish(const Generator& Gen);
+	void Publish(const GeneratedMap& Map);
+
+	/** Maps published so far */
+	std::uint64_t GetPublishCount() const { return PublishCount.load(std::memory_order_relaxed); }
+
+	/** Replaced maps some reader might still hold, they get reclaimed on the next Publish that finds them unused */
+	int GetRetiredCount() const;
+
+private:
+	/** Reader slots, 0 when free. One per cache line so readers don't slow each other down */
+	struct alignas(64) ReaderSlot
+	{
+		std::atomic<std::uint64_t> Epoch = 0;
+	};
+
+	struct RetiredMap
+	{
+		std::unique_ptr<GeneratedMap> Map;
+
+		/** The epoch that started once it was replaced */
+		std::uint64_t Epoch = 0;
+	};
+
+	/** A buffer to write the next map into, reusing a reclaimed one if there is one. Called with WriterMutex held */
+	std::unique_ptr<GeneratedMap> TakeBuffer();
+	void Swap(std::unique_ptr<GeneratedMap> Map);
+	void Reclaim();
+
+	mutable std::array<ReaderSlot, MaxReaders> Readers;
+	std::atomic<GeneratedMap*> Current = nullptr;
+	std::atomic<std::uint64_t> Epoch = 1;
+	std::atomic<std::uint64_t> PublishCount = 0;
+
+	/** Publishers take turns, readers never take it */
+	mutable std::mutex WriterMutex;
+	std::vector<RetiredMap> Retired;
+	std::vector<std::unique_ptr<GeneratedMap>> FreeBuffers;
+};
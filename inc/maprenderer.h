@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "generator.h"
+
+/** What MapRenderer prints for each cell, in this order */
+enum MapRenderField : unsigned
+{
+	RenderGridType = 1 << 0,
+	RenderRoomType = 1 << 1,
+	RenderZone = 1 << 2,
+	RenderRotation = 1 << 3,
+	RenderName = 1 << 4,
+};
+
+struct MapRenderOptions
+{
+	/** MapRenderField flags */
+	unsigned Fields = RenderGridType;
+
+	/** Names are padded or cut to this */
+	int NameWidth = 14;
+};
+
+/**
+* Formats a whole map as text in one go, laid out like OutputMap always has been (one line per X).
+* The buffer is reused between maps, so printing a map costs one write.
+*/
+class MapRenderer
+{
+public:
+	explicit MapRenderer(MapRenderOptions InOptions = {});
+
+	/** Appends the map to OutText */
+	void Render(Generator& Gen, std::string& OutText) const;
+	void Print(Generator& Gen, std::FILE* File = stdout);
+
+private:
+	void RenderCell(const RoomArrayEntry& Entry, std::string& OutText) const;
+
+	MapRenderOptions Options;
+	std::string Buffer;
+};
+
+/**
+* Tiles many maps into one image, Columns maps wide and as many rows as needed. Each cell is CellSize pixels,
+* coloured by zone with the shade picked by room shape. Checkpoints are white. Laid out the same way as MapRenderer, one pixel row of cells per X.
+*/
+class MapAtlas
+{
+public:
+	MapAtlas(int InColumns, int InCellSize = 3);
+
+	void AddMap(Generator& Gen);
+	void AddLayout(const LayoutStageResult& Layout);
+
+	int GetMapCount() const { return MapCount; }
+	int GetWidth() const;
+	int GetHeight() const;
+
+	/** Binary PPM (P6). Both writers return false for an atlas with no maps in it, which has no pixels to write */
+	bool WritePPM(const std::string& Path) const;
+
+	/** PNG with uncompressed deflate blocks, bigger than it could be but it needs nothing else */
+	bool WritePNG(const std::string& Path) const;
+
+private:
+	/** Makes room for another tile and returns the pixel its top left corner is at */
+	std::uint8_t* AddTile();
+	void FillCell(std::uint8_t* Tile, int X, int Y, int GridType, RoomType Type);
+
+	int GetTileSize() const { return (MapWidth + 1) * CellSize + 1; }
+
+	int Columns = 1;
+	int CellSize = 3;
+	int MapCount = 0;
+
+	/** RGB, GetWidth() * 3 bytes per row */
+	std::vector<std::uint8_t> Pixels;
+};
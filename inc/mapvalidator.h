@@ -0,0 +1,28 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "generator.h"
+
+/**
+* Checks MapInvariants on a grid, cheap enough to run on every map of a sweep.
+* Every invariant is a few mask operations per row of MapBitboards, the generator keeps its boards up to date while validating so they never have to be rebuilt.
+*/
+class MapValidator
+{
+public:
+	/** The invariants that should hold once Stage has finished */
+	static unsigned GetInvariantsAfter(GenerationStage Stage);
+
+	/** Checks Invariants (MapInvariant flags), adding one violation to OutViolations per invariant that doesn't hold */
+	static void Validate(const MapBitboards& Boards, const GenerationReport& Report, int Seed, GenerationStage Stage, unsigned Invariants,
+		std::vector<MapViolation>& OutViolations);
+
+	/** Checks a finished map */
+	static void Validate(const GeneratedMap& Map, unsigned Invariants, std::vector<MapViolation>& OutViolations);
+
+	static const char* GetInvariantName(MapInvariant Invariant);
+	static const char* GetStageName(GenerationStage Stage);
+};
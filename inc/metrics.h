@@ -0,0 +1,128 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "generator.h"
+
+/**
+* 0 compiles every Metrics call out. Set through the SCPROOMGEN_METRICS option in CMake, on by default:
+* recording is a few plain stores into memory only the recording thread writes, plus a clock read per stage.
+*/
+#ifndef SCPROOMGEN_METRICS
+#define SCPROOMGEN_METRICS 1
+#endif
+
+inline constexpr bool bMetricsEnabled = SCPROOMGEN_METRICS != 0;
+
+enum MetricCounter : int
+{
+	/** Maps generated all the way through AssignRooms */
+	CounterMapsGenerated,
+	CounterStageCacheHits,
+	CounterStageCacheMisses,
+	/** ROOM1s, ROOM4s and ROOM2Cs the forcing passes had to add */
+	CounterForcedPlacements,
+	/** Zones the forcing passes couldn't fit their ROOM4 or ROOM2C into */
+	CounterForcedPlacementFailures,
+	CounterSetRoomFailures,
+
+	MetricCounterCount
+};
+
+/**
+* Latencies recorded. The first ones are the stages, indexed by GenerationStage. MapLatency adds up the stages a map went through,
+* so a map finished from a stored layout only counts the stages after it, and GenerateMapAsync (whose steps its caller spreads out) isn't timed at all.
+*/
+constexpr int MapLatency = int(GenerationStage::Done);
+constexpr int MetricLatencyCount = MapLatency + 1;
+
+/**
+* HDR style histogram of nanoseconds: exact below 64, then 32 buckets per power of two so every value is within about 3%.
+* Values past 2^44 ns (almost 5 hours) land in the last bucket.
+*/
+class LatencyHistogram
+{
+public:
+	static constexpr int SubBucketBits = 5;
+	static constexpr int MaxValueBits = 44;
+	static constexpr int BucketCount = (MaxValueBits - SubBucketBits + 1) << SubBucketBits;
+
+	static int GetBucket(std::uint64_t Value);
+
+	/** Smallest and largest value that land in Bucket */
+	static std::uint64_t GetBucketLowest(int Bucket);
+	static std::uint64_t GetBucketHighest(int Bucket);
+
+	void Add(std::uint64_t Value, std::uint64_t Count = 1);
+	void Merge(const LatencyHistogram& Other);
+
+	std::uint64_t GetCount() const { return Count; }
+	std::uint64_t GetSum() const { return Sum; }
+	std::uint64_t GetMax() const { return Max; }
+
+	/** Highest value of the bucket holding the sample Fraction of the way through, so the real percentile is at most 3% lower */
+	std::uint64_t GetPercentile(double Fraction) const;
+
+private:
+	friend class Metrics;
+
+	std::array<std::uint64_t, BucketCount> Buckets{};
+	std::uint64_t Count = 0;
+	std::uint64_t Sum = 0;
+	std::uint64_t Max = 0;
+};
+
+/** Everything Metrics has recorded up to some point, added up over every thread */
+struct MetricsSnapshot
+{
+	std::uint64_t Counters[MetricCounterCount]{};
+	LatencyHistogram Latencies[MetricLatencyCount];
+
+	/** Prometheus text exposition format, stages as a summary with p50, p90, p99 and p99.9 */
+	std::string FormatPrometheus() const;
+
+	/** The same numbers as one JSON object */
+	std::string FormatJson() const;
+};
+
+/**
+* Process wide counters and latency histograms, always on unless compiled out with SCPROOMGEN_METRICS.
+* Every thread records into a shard of its own without locks or atomic read-modify-writes, and Snapshot adds the shards up when asked.
+* Shards of finished threads are handed to new ones with their numbers in them, so nothing recorded is ever lost.
+*/
+class Metrics
+{
+public:
+	static Metrics& Get();
+
+	void Count(MetricCounter Counter, std::uint64_t Amount = 1);
+	void RecordLatency(int Latency, std::uint64_t Nanoseconds);
+
+	MetricsSnapshot Snapshot() const;
+
+	/** Maximum threads that can record at once, any beyond that are dropped */
+	static constexpr int MaxShards = 256;
+
+	struct Shard;
+
+private:
+	Metrics();
+	~Metrics();
+
+	Shard* GetThreadShard();
+	Shard* AcquireShard();
+
+	std::mutex Mutex;
+
+	/** Only ever grows, so shards can be read without the lock once the count is loaded */
+	std::array<std::unique_ptr<Shard>, MaxShards> Shards;
+	std::atomic<int> ShardCount = 0;
+};
+
+/** Nanoseconds on the clock Metrics latencies are measured with */
+std::uint64_t GetMetricsClock();
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "generator.h"
+
+enum PerfCounter : int
+{
+	PerfCycles,
+	PerfInstructions,
+	PerfBranches,
+	PerfBranchMisses,
+	/** L1 data cache read misses */
+	PerfL1DMisses,
+	/** Last level cache read misses */
+	PerfLLCMisses,
+
+	PerfCounterCount
+};
+
+/** Hardware counter totals, plus wall-clock time which is there even without the counters */
+struct PerfSample
+{
+	std::uint64_t Nanoseconds = 0;
+	std::uint64_t Counters[PerfCounterCount]{};
+
+	void Add(const PerfSample& Other);
+
+	/** End - Start, counter by counter */
+	static PerfSample Delta(const PerfSample& Start, const PerfSample& End);
+};
+
+/**
+* The calling thread's hardware counters, through perf_event_open on Linux. User space only, so perf_event_paranoid up to 2 is fine.
+* Counters the kernel, the CPU or a container won't give us are left out and read as 0, anywhere other than Linux that's all of them.
+* Each counter is opened on its own and scaled by how long it was actually scheduled, so the PMU running out of counters doesn't lose the rest.
+*/
+class PerfCounters
+{
+public:
+	PerfCounters();
+	~PerfCounters();
+
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	/** PerfCounter bits for the counters that could be opened */
+	unsigned GetAvailable() const { return Available; }
+
+	/** Current totals. Only counts the thread that constructed this, so that's the thread that has to read it */
+	void Read(PerfSample& OutSample) const;
+
+private:
+	int Descriptors[PerfCounterCount];
+	unsigned Available = 0;
+};
+
+/** Everything recorded for one stage or seed bucket */
+struct ProfileEntry
+{
+	/** Stage runs, or maps for a seed bucket */
+	std::uint64_t Count = 0;
+	PerfSample Totals;
+
+	double GetIPC() const;
+
+	/** Mispredicted branches out of all branches */
+	double GetBranchMissRate() const;
+
+	/** Misses per thousand instructions */
+	double GetMissesPerKiloInstruction(PerfCounter Counter) const;
+
+	void Merge(const ProfileEntry& Other);
+};
+
+/**
+* Collects hardware counters per generation stage and per seed bucket, see Generator::SetProfiler.
+* The counters follow the thread the generator first runs on, so a profiler belongs to one generator on one thread. Merge adds up profilers from several.
+*/
+class GenerationProfiler
+{
+public:
+	explicit GenerationProfiler(int InSeedsPerBucket = 1 << 16);
+	~GenerationProfiler();
+
+	/** Called by the generator around every stage it runs */
+	void BeginStage();
+	void EndStage(int Seed, GenerationStage Stage);
+
+	void Merge(const GenerationProfiler& Other);
+
+	int GetSeedsPerBucket() const { return SeedsPerBucket; }
+
+	/** PerfCounter bits for the counters behind these numbers, 0 if only wall-clock time was recorded */
+	unsigned GetAvailable() const { return Available; }
+
+	const ProfileEntry& GetStage(GenerationStage Stage) const { return Stages[int(Stage)]; }
+
+	/** Keyed by the bucket's first seed */
+	const std::map<std::int64_t, ProfileEntry>& GetBuckets() const { return Buckets; }
+
+	/** One table for the stages and one for the buckets, with IPC, branch miss rate and cache misses per thousand instructions */
+	std::string FormatReport() const;
+
+private:
+	int SeedsPerBucket;
+	std::unique_ptr<PerfCounters> Counters;
+	unsigned Available = 0;
+
+	PerfSample StageStart;
+	ProfileEntry Stages[int(GenerationStage::Done)];
+	std::map<std::int64_t, ProfileEntry> Buckets;
+
+	/** Used to count each map in its bucket once */
+	int LastSeed = 0;
+	GenerationStage LastStage = GenerationStage::Done;
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "generator.h"
+
+struct PregenerationPoolOptions
+{
+	/** Background threads, each with its own Generator that gets reused for every map */
+	int ThreadCount = 1;
+
+	/** Maps for random seeds kept ready */
+	int RandomCapacity = 4;
+
+	/** Announced seeds kept around. Announcing more than this forgets the oldest one that isn't being generated */
+	int AnnouncedCapacity = 32;
+
+	GeneratorRuleSet RuleSet = GeneratorRuleSet::Default;
+
+	/** Where random seeds come from, a std::mt19937 seeded from std::random_device if not set. Only called with the pool locked */
+	std::function<int()> SeedSource;
+};
+
+struct PregenerationStats
+{
+	std::uint64_t RandomHits = 0;
+	std::uint64_t RandomMisses = 0;
+
+	/** Announced seeds that were ready, that were still being generated and had to be waited on, and seeds that were never announced */
+	std::uint64_t AnnouncedHits = 0;
+	std::uint64_t AnnouncedWaits = 0;
+	std::uint64_t AnnouncedMisses = 0;
+
+	int RandomQueueDepth = 0;
+	int AnnouncedPending = 0;
+	int AnnouncedReady = 0;
+};
+
+/**
+* Generates maps before anyone asks for them, so starting a session doesn't have to.
+* Keeps a bounded queue of maps for random seeds, and generates seeds announced ahead of time (e.g. in a lobby) before anything else.
+* Anything that isn't ready when it's taken gets generated on the calling thread, which counts as a miss.
+*/
+class PregenerationPool
+{
+public:
+	explicit PregenerationPool(PregenerationPoolOptions InOptions = {});
+	~PregenerationPool();
+
+	PregenerationPool(const PregenerationPool&) = delete;
+	PregenerationPool& operator=(const PregenerationPool&) = delete;
+
+	/** A map for a random seed. The seed it was generated from is in the map */
+	std::unique_ptr<GeneratedMap> TakeRandom();
+
+	/** Starts generating Seed ahead of time, before any random seeds */
+	void Announce(int Seed);
+
+	/** Forgets an announced seed that won't be played */
+	void Withdraw(int Seed);
+
+	/** The map for Seed. Waits for it if it's being generated */
+	std::unique_ptr<GeneratedMap> Take(int Seed);
+
+	/** Blocks until every announced seed is ready and the random queue is full */
+	void WaitUntilIdle();
+
+	PregenerationStats GetStats() const;
+
+private:
+	struct AnnouncedSeed
+	{
+		std::unique_ptr<GeneratedMap> Map;
+		bool bGenerating = false;
+	};
+
+	void Run();
+	std::unique_ptr<GeneratedMap> Generate(Generator& Gen, int Seed) const;
+	int NextRandomSeed();
+	bool IsIdle() const;
+
+	/** Announced seeds nobody has started on yet */
+	bool HasPendingSeed() const;
+
+	/** Marks the oldest pending announced seed as being generated, returns false if there is none */
+	bool TakePendingSeed(int& OutSeed);
+
+	PregenerationPoolOptions Options;
+
+	mutable std::mutex Mutex;
+	std::condition_variable WorkAvailable;
+	std::condition_variable MapReady;
+	bool bStopping = false;
+
+	std::deque<std::unique_ptr<GeneratedMap>> RandomMaps;
+	int RandomInProgress = 0;
+	std::mt19937 RandomEngine;
+
+	std::map<int, AnnouncedSeed> Announced;
+	/** Announce order, used to pick both the next seed to generate and the one to forget */
+	std::deque<int> AnnouncedOrder;
+
+	PregenerationStats Stats;
+	std::vector<std::thread> Threads;
+};
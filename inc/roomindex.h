@@ -0,0 +1,123 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+/** A grid cell as (X << 8) | Y, small enough to hand out by the million */
+using PackedCoordinate = std::uint16_t;
+
+/** Where a room that isn't on the map is */
+constexpr PackedCoordinate NoCoordinate = 0xFFFF;
+
+constexpr PackedCoordinate PackCoordinate(int X, int Y) { return PackedCoordinate((X << 8) | Y); }
+constexpr int GetPackedX(PackedCoordinate Coordinate) { return Coordinate >> 8; }
+constexpr int GetPackedY(PackedCoordinate Coordinate) { return Coordinate & 0xFF; }
+
+/** Returned for names that aren't one of the names the generator places */
+constexpr int NoRoomNameId = -1;
+
+/**
+* Every name the generator gives a room, each with a small id so lookups never have to compare strings.
+* In the order PlacePredefinedRooms and AssignRooms hand them out. Ids are positions in here, so only ever append.
+*/
+inline constexpr std::string_view RoomNames[] = {
+	// Predefined
+	"start", "roompj", "914", "room1archive", "room205", "lockroom", "room2closets", "room2testroom2", "room2scps", "room2storage",
+	"room2gw_b", "room2sl", "room012", "room2scps2", "room1123", "room2elevator", "room079", "room106", "008", "room035",
+	"coffin", "room2nuke", "room2tunnel", "room049", "room2shaft", "testroom", "room2servers", "room513", "room966", "room2cpit",
+	"exit1", "gateaentrance", "room1lifts", "room2poffices", "room2cafeteria", "room2sroom", "room2servers2", "room2offices", "room2offices4", "room860",
+	"medibay", "room2poffices2", "room2offices2", "room2ccont", "lockroom2", "room3servers", "room3servers2", "room3gw", "room3offices",
+	// Checkpoints and special rooms
+	"checkpoint1", "checkpoint2", "gatea", "pocketdimension", "173", "dimension1499",
+};
+
+inline constexpr int RoomNameCount = int(std::size(RoomNames));
+static_assert(RoomNameCount <= 255, "Name ids have to fit the index's bytes");
+
+/** Ids ordered by name, for binary searching */
+inline constexpr std::array<std::uint8_t, RoomNameCount> SortedRoomNameIds = []()
+{
+	std::array<std::uint8_t, RoomNameCount> Ids{};
+	for (int i = 0; i < RoomNameCount; i++)
+	{
+		Ids[i] = std::uint8_t(i);
+	}
+	std::sort(Ids.begin(), Ids.end(), [](std::uint8_t A, std::uint8_t B) { return RoomNames[A] < RoomNames[B]; });
+	return Ids;
+}();
+
+/** Names the generator doesn't know about (there are none yet) aren't given an id and so can't be looked up */
+constexpr int GetRoomNameId(std::string_view Name)
+{
+	const auto Found = std::lower_bound(SortedRoomNameIds.begin(), SortedRoomNameIds.end(), Name,
+		[](std::uint8_t Id, std::string_view Value) { return RoomNames[Id] < Value; });
+	return Found != SortedRoomNameIds.end() && RoomNames[*Found] == Name ? *Found : NoRoomNameId;
+}
+
+constexpr std::string_view GetRoomName(int NameId)
+{
+	return NameId >= 0 && NameId < RoomNameCount ? RoomNames[NameId] : std::string_view();
+}
+
+constexpr int GetRoomNameCount()
+{
+	return RoomNameCount;
+}
+
+/**
+* Name id -> coordinate for one map, filled in by the generator as it assigns names so finding a room doesn't mean walking the grid.
+* Names that appear more than once (the checkpoints) are kept in the order they were assigned.
+*/
+class RoomIndex
+{
+public:
+	/**
+	* Most named rooms a map can have: every predefined and special room, plus a checkpoint on every cell of both zone boundaries.
+	* Anything past it is dropped, which a 19x19 grid can't get to.
+	*/
+	static constexpr int MaxRooms = 128;
+
+	constexpr void Clear() { Count = 0; }
+
+	/** Records NameId at X, Y. Unknown names are ignored */
+	constexpr void Add(int NameId, int X, int Y)
+	{
+		if (NameId < 0 || NameId >= RoomNameCount || Count >= MaxRooms)
+		{
+			return;
+		}
+
+		NameIds[Count] = std::uint8_t(NameId);
+		Coordinates[Count] = PackCoordinate(X, Y);
+		Count++;
+	}
+
+	/** Drops whatever name was recorded at X, Y, for when a room gets renamed */
+	constexpr void Remove(int X, int Y)
+	{
+		const PackedCoordinate Coordinate = PackCoordinate(X, Y);
+		for (int i = 0; i < Count; i++)
+		{
+			if (Coordinates[i] == Coordinate)
+			{
+				// Shift rather than swap so the rest stay in the order they were assigned
+				std::copy(NameIds + i + 1, NameIds + Count, NameIds + i);
+				std::copy(Coordinates + i + 1, Coordinates + Count, Coordinates + i);
+				Count--;
+				return;
+			}
+		}
+	}
+
+	/** The Occurrence'th room with NameId in the order they were assigned, NoCoordinate if there aren't that many */
+	PackedCoordinate Find(int NameId, int Occurrence = 0) const;
+
+	constexpr int GetCount() const { return Count; }
+
+private:
+	std::uint8_t NameIds[MaxRooms];
+	PackedCoordinate Coordinates[MaxRooms];
+	int Count = 0;
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+
+#include "generator.h"
+
+struct RoomLocatorOptions
+{
+	/** 0 uses every hardware thread */
+	int ThreadCount = 0;
+
+	GeneratorRuleSet RuleSet = GeneratorRuleSet::Default;
+};
+
+/**
+* Answers "where is this room" for many seeds at once, straight into a packed array.
+* Layouts come from the BatchGenerator when the rule set can use them, and every seed is finished by Generator::LocateRoom and answered
+* from its RoomIndex, so no grid is ever copied out or scanned.
+*/
+class RoomLocator
+{
+public:
+	explicit RoomLocator(RoomLocatorOptions InOptions = {});
+
+	/** OutCoordinates[i] is where the first room named NameId is in Seeds[i]'s map, NoCoordinate if it isn't placed */
+	void Locate(int NameId, const int* Seeds, size_t Count, PackedCoordinate* OutCoordinates) const;
+
+private:
+	/** One thread's share, Seeds[First] to Seeds[Last - 1] */
+	void LocateChunk(int NameId, const int* Seeds, size_t First, size_t Last, PackedCoordinate* OutCoordinates, Generator& Gen) const;
+
+	RoomLocatorOptions Options;
+	bool bUseBatchLayouts = false;
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "generator.h"
+#include "mappedfile.h"
+
+enum SeedFeatureKind : std::uint8_t
+{
+	FeatureRoomName = 1,
+	FeatureRoomCount = 2,
+	FeatureCheckpoint = 3,
+	FeatureForcedPlacement = 4,
+};
+
+enum ForcedPlacementKind : std::uint8_t
+{
+	ForcedRoom1s,
+	ForcedRoom4,
+	ForcedRoom4Failed,
+	ForcedRoom2C,
+	ForcedRoom2CFailed,
+};
+
+/**
+* Something a finished map either has or doesn't. Packed as kind, two small coordinates and a 32 bit value, so it can be
+* built without the index at hand. Room names are stored as their FNV-1a hash.
+*/
+struct SeedFeature
+{
+	std::uint64_t Key = 0;
+
+	/** Named room on cell X, Y */
+	static SeedFeature RoomName(int X, int Y, std::string_view Name);
+
+	/** Zone (as returned by Generator::GetMapZone) has exactly Count rooms of Type once forcing is done */
+	static SeedFeature RoomCount(int Zone, RoomType Type, int Count);
+
+	/** A checkpoint in column X, Zone being the zone of the checkpoint's own row */
+	static SeedFeature Checkpoint(int Zone, int X);
+
+	/** The forcing passes did Kind in Zone */
+	static SeedFeature ForcedPlacement(int Zone, ForcedPlacementKind Kind);
+
+	SeedFeatureKind GetKind() const { return SeedFeatureKind(Key >> 56); }
+
+	bool operator==(const SeedFeature& Other) const { return Key == Other.Key; }
+	bool operator<(const SeedFeature& Other) const { return Key < Other.Key; }
+};
+
+struct SeedIndexBuildOptions
+{
+	/** 0 uses every hardware thread */
+	int ThreadCount = 0;
+
+	GeneratorRuleSet RuleSet = GeneratorRuleSet::Default;
+};
+
+/**
+* Runs GenerateMap over a seed range and writes, for every feature, the seeds that have it.
+*
+* Seeds are split into blocks of 65536 sharing their top 16 bits. Every block is gathered by one thread and written out as soon as it's done,
+* so memory only depends on the thread count. Inside a block each feature gets a roaring style container, a sorted array of the low 16 bits
+* when it's sparse or a 65536 bit bitmap once an array would be bigger.
+*/
+class SeedIndexBuilder
+{
+public:
+	explicit SeedIndexBuilder(SeedIndexBuildOptions InOptions = {});
+
+	/** Indexes every seed from FirstSeed to LastSeed (inclusive, clamped to 0 .. INT_MAX) into Path */
+	bool Build(std::int64_t FirstSeed, std::int64_t LastSeed, const std::string& Path);
+
+	/** Every feature of the map Gen generated last */
+	static void GatherFeatures(Generator& Gen, std::vector<SeedFeature>& OutFeatures);
+
+private:
+	SeedIndexBuildOptions Options;
+};
+
+/**
+* Read side of a SeedIndexBuilder file. The file is memory mapped and queried in place, nothing is loaded up front.
+* Queries are conjunctions, a seed matches if it has every feature.
+*/
+class SeedIndex
+{
+public:
+	bool Open(const std::string& Path);
+	bool IsOpen() const;
+
+	std::int64_t GetFirstSeed() const;
+	std::int64_t GetLastSeed() const;
+
+	/** Seeds in the index that have Feature */
+	std::uint64_t GetFeatureSeedCount(SeedFeature Feature) const;
+
+	/** Matching seeds in ascending order, stopping after Limit */
+	std::vector<int> Find(const std::vector<SeedFeature>& Features, size_t Limit = SIZE_MAX) const;
+	std::uint64_t Count(const std::vector<SeedFeature>& Features) const;
+
+	/** Calls OnMatch for every matching seed in ascending order, until it returns false */
+	void ForEachMatch(const std::vector<SeedFeature>& Features, const std::function<bool(int Seed)>& OnMatch) const;
+
+private:
+	MappedFile File;
+};
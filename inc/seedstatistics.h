@@ -0,0 +1,134 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "generator.h"
+#include "perfcounters.h"
+
+/** Which distributions SeedStatisticsEngine gathers. Fewer metrics let it stop each seed at an earlier stage */
+enum SeedMetric : unsigned
+{
+	/** Per-zone room amounts straight out of classification, before anything is forced. Only needs the layout, so runs on the BatchGenerator */
+	MetricLayoutRoomAmounts = 1 << 0,
+	/** Per-zone room amounts once the ROOM1/ROOM4/ROOM2C forcing passes are done */
+	MetricRoomAmounts = 1 << 1,
+	/** How often each forcing path fires or fails */
+	MetricForcedPlacements = 1 << 2,
+	/** How often SetRoom can't find a slot */
+	MetricSetRoomFailures = 1 << 3,
+	/** Per-cell heatmaps of the final grid */
+	MetricOccupancy = 1 << 4,
+
+	MetricAll = (1 << 5) - 1
+};
+
+/** Histogram over small non-negative counts. Anything above MaxValue lands in the last bin */
+class CountHistogram
+{
+public:
+	static constexpr int MaxValue = 63;
+
+	void Add(int Value);
+	void Add(int Value, std::uint64_t Count);
+	void Merge(const CountHistogram& Other);
+
+	std::uint64_t GetCount(int Value) const { return Bins[Value]; }
+	std::uint64_t GetTotal() const;
+	double GetMean() const;
+
+	/** Smallest value at least Fraction of all samples are less than or equal to */
+	int GetPercentile(double Fraction) const;
+
+private:
+	std::array<std::uint64_t, MaxValue + 1> Bins{};
+};
+
+/** Everything gathered over a seed range. Mergeable, so every thread fills its own and they get added up */
+struct SeedStatistics
+{
+	std::uint64_t SeedCount = 0;
+
+	/** [RoomType][Zone], RoomType::Room0 is unused */
+	CountHistogram LayoutRoomAmounts[RoomType::Room4 + 1][ZoneAmount];
+	CountHistogram RoomAmounts[RoomType::Room4 + 1][ZoneAmount];
+
+	/** Maps where the zone's ROOM4/ROOM2C had to be forced, and where forcing it failed */
+	std::uint64_t Room4Forced[ZoneAmount]{};
+	std::uint64_t Room4ForceFailed[ZoneAmount]{};
+	std::uint64_t Room2CForced[ZoneAmount]{};
+	std::uint64_t Room2CForceFailed[ZoneAmount]{};
+
+	/** ROOM1s added per map by the forcing pass */
+	CountHistogram Room1sForced[ZoneAmount];
+
+	/** SetRoom failures per map */
+	CountHistogram SetRoomFailures;
+
+	/** Maps with something on each cell, [RoomType][X][Y]. RoomType::Room0 counts every occupied cell */
+	std::array<std::array<std::array<std::uint64_t, MapHeight + 1>, MapWidth + 1>, RoomType::Room4 + 1> Occupancy{};
+
+	/** Maps that broke each MapInvariant, indexed by the invariant's bit. Only gathered when validating */
+	std::uint64_t InvariantViolations[MapInvariantCount]{};
+
+	/** Some of the violations behind InvariantViolations, at most MaxViolationSamples of them */
+	std::vector<MapViolation> ViolationSamples;
+	static constexpr size_t MaxViolationSamples = 64;
+
+	void Merge(const SeedStatistics& Other);
+
+	/** Appends a binary copy to Out. Sweeps keep their checkpoints and shard outputs in this format */
+	void Write(std::string& Out) const;
+
+	/** Reads what Write produced, advancing Data. False if it runs past End */
+	bool Read(const char*& Data, const char* End);
+};
+
+struct SeedStatisticsOptions
+{
+	/** SeedMetric flags */
+	unsigned Metrics = MetricAll;
+
+	/** 0 uses every hardware thread */
+	int ThreadCount = 0;
+
+	/** MapInvariant flags to check on every seed, see Generator::SetValidation. Only the stages Metrics needs are run and checked, and validating keeps seeds off the BatchGenerator */
+	unsigned Validation = 0;
+
+	/** When set, every thread profiles its generator and adds its numbers to this at the end, see Generator::SetProfiler. Like validating, keeps seeds off the BatchGenerator */
+	GenerationProfiler* Profiler = nullptr;
+
+	/** Seeds a thread generates before folding its results into the totals */
+	int ChunkSize = 4096;
+
+	std::chrono::milliseconds ProgressInterval{ 1000 };
+
+	/** Called on the thread that called Run, with everything merged so far. Also called once at the end */
+	std::function<void(const SeedStatistics& Snapshot, std::int64_t SeedsDone, std::int64_t SeedsTotal)> OnProgress;
+};
+
+/**
+* Runs the generator over a numeric seed range and gathers distributions over it.
+* Memory doesn't depend on the range, every thread keeps one SeedStatistics and nothing is kept per seed.
+*/
+class SeedStatisticsEngine
+{
+public:
+	explicit SeedStatisticsEngine(SeedStatisticsOptions InOptions = {});
+
+	/** Gathers statistics for every seed from FirstSeed to LastSeed (inclusive) */
+	SeedStatistics Run(std::int64_t FirstSeed, std::int64_t LastSeed);
+
+	/** The stage seeds can stop before while still producing Metrics */
+	static GenerationStage GetStopStage(unsigned Metrics);
+
+private:
+	void GatherChunk(Generator& Gen, std::int64_t FirstSeed, std::int64_t LastSeed, SeedStatistics& Stats) const;
+	void GatherLayoutChunk(std::int64_t FirstSeed, std::int64_t LastSeed, SeedStatistics& Stats) const;
+
+	SeedStatisticsOptions Options;
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "seedstatistics.h"
+
+/** One slice of a sweep, written "Index/Count" on the command line */
+struct SweepShard
+{
+	int Index = 0;
+	int Count = 1;
+
+	/** Parses "i/N" with 0 <= i < N */
+	static bool Parse(const std::string& Text, SweepShard& OutShard);
+
+	/** The part of FirstSeed..LastSeed this shard covers. Shards are contiguous and differ by at most one seed, OutFirst > OutLast if there's nothing left for it */
+	void GetRange(std::int64_t FirstSeed, std::int64_t LastSeed, std::int64_t& OutFirst, std::int64_t& OutLast) const;
+
+	bool operator==(const SweepShard& Other) const { return Index == Other.Index && Count == Other.Count; }
+};
+
+/** A shard's progress. It's also the shard's output once complete, and what merging all the shards produces (as shard 0/1) */
+struct SweepCheckpoint
+{
+	SweepShard Shard;
+
+	/** The whole sweep, not just this shard */
+	std::int64_t FirstSeed = 0;
+	std::int64_t LastSeed = 0;
+
+	/** SeedMetric and MapInvariant flags the sweep runs with */
+	unsigned Metrics = 0;
+	unsigned Validation = 0;
+
+	/** First seed of the shard that isn't in Statistics yet */
+	std::int64_t NextSeed = 0;
+
+	SeedStatistics Statistics;
+
+	bool IsComplete() const;
+
+	/** Whether Other belongs to the same sweep, i.e. everything but the shard and progress match */
+	bool IsSameSweep(const SweepCheckpoint& Other) const;
+
+	/** Writes to a temporary file next to Path and renames it over Path, so a crash leaves either the old checkpoint or the new one */
+	bool Save(const std::string& Path) const;
+	bool Load(const std::string& Path);
+};
+
+struct SeedSweepOptions
+{
+	/** Where the shard keeps its checkpoint, every shard of a sweep can share it */
+	std::string Directory;
+
+	std::int64_t FirstSeed = 0;
+	std::int64_t LastSeed = 2147483647;
+
+	SweepShard Shard;
+
+	/** How each segment between checkpoints is run. OnProgress is left to the caller */
+	SeedStatisticsOptions Statistics;
+
+	/** Seeds between checkpoints */
+	std::int64_t CheckpointSeeds = 1 << 22;
+
+	/** Called after every checkpoint is saved. Returning false stops the sweep there, the next Run picks up from that checkpoint */
+	std::function<bool(const SweepCheckpoint& Checkpoint)> OnCheckpoint;
+};
+
+/**
+* Runs one shard of a numeric seed sweep through the SeedStatisticsEngine, saving a checkpoint every CheckpointSeeds seeds.
+* Running a shard again resumes from its checkpoint, so a crash only loses the seeds since the last one. Shards are independent
+* and can run as separate processes on separate machines, as long as their outputs end up in one directory for Merge.
+*/
+class SeedSweep
+{
+public:
+	explicit SeedSweep(SeedSweepOptions InOptions);
+
+	/** Runs or resumes the shard. True once it's complete, false if it was stopped or the checkpoint in the way belongs to a different sweep */
+	bool Run();
+
+	/** Where a shard's checkpoint lives in Directory */
+	static std::string GetShardPath(const std::string& Directory, const SweepShard& Shard);
+
+	/**
+	* Adds up the outputs of all ShardCount shards in Directory, always in shard order so the result doesn't depend on which finished first.
+	* Fails if any shard is missing, unfinished or from another sweep, with the reason in OutError.
+	*/
+	static bool Merge(const std::string& Directory, int ShardCount, SweepCheckpoint& OutMerged, std::string& OutError);
+
+private:
+	SeedSweepOptions Options;
+};
+
+/**
+* Command line front end, argv[0] being "sweep" or "merge":
+*   sweep --out <dir> --shard <i/N> [--from <seed>] [--to <seed>] [--threads <n>] [--checkpoint-seeds <n>] [--metrics <flags>] [--validate <flags>] [--profile <seeds per bucket>]
+*   merge --out <dir> --shards <N>
+* Merging writes the total to <dir>/merged.sweep. Profiling prints the GenerationProfiler report for what this run generated. Returns the process exit code.
+*/
+int RunSweepCommand(int argc, char** argv);
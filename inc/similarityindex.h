@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "generator.h"
+#include "mappedfile.h"
+
+/**
+* A map's layout as packed bitboards, one 361 bit plane (padded to 6 words) per room type from Room1 to Room4.
+* Bit X * (MapHeight + 1) + Y of a plane is set when that cell has a room of the plane's type. Padded to 32 words so every SIMD width divides it.
+*/
+struct LayoutSignature
+{
+	static constexpr int PlaneWords = 6;
+	static constexpr int PlaneCount = RoomType::Room4 - RoomType::Room1 + 1;
+	static constexpr int WordCount = 32;
+
+	alignas(64) std::array<std::uint64_t, WordCount> Words{};
+
+	/** The signature of the map Gen generated last. Only needs the passes up to ForceRoom4sAndRoom2Cs, nothing after moves rooms or changes their type */
+	static LayoutSignature FromGenerator(Generator& Gen);
+	static LayoutSignature FromMap(const GeneratedMap& Map);
+
+	/** Cells that differ, a cell with a room of another type counts twice as it's in two planes */
+	static int GetHammingDistance(const LayoutSignature& A, const LayoutSignature& B);
+
+	/** 1 - |A and B| / |A or B| over (cell, room type) pairs, 0 for two empty maps */
+	static double GetJaccardDistance(const LayoutSignature& A, const LayoutSignature& B);
+
+	int GetRoomCount() const;
+};
+
+static_assert(LayoutSignature::PlaneCount * LayoutSignature::PlaneWords * 64 >= LayoutSignature::PlaneCount * (MapWidth + 1) * (MapHeight + 1));
+static_assert(LayoutSignature::PlaneCount * LayoutSignature::PlaneWords <= LayoutSignature::WordCount);
+
+enum class LayoutMetric
+{
+	Hamming,
+	Jaccard
+};
+
+struct SimilarMap
+{
+	int Seed = 0;
+	double Distance = 0.0;
+};
+
+struct SimilarityIndexBuildOptions
+{
+	/** 0 uses every hardware thread */
+	int ThreadCount = 0;
+
+	GeneratorRuleSet RuleSet = GeneratorRuleSet::Default;
+
+	/**
+	* MinHash banding: a seed becomes a candidate for a query when all RowsPerBand hashes of any one band match.
+	* Two random maps are only about 0.15 similar and a seed's nearest neighbours about 0.4, so the defaults are tuned low:
+	* maps at 0.5 share a band 98% of the time, at 0.4 81% and at 0.15 3%. Bands * RowsPerBand can't be more than MaxHashes.
+	*/
+	int Bands = 64;
+	int RowsPerBand = 4;
+};
+
+/**
+* Runs the generator over a seed range and writes every seed's LayoutSignature plus, per band, its MinHash bucket sorted by bucket.
+* Everything is gathered in memory before it's written, about 520 bytes per seed with the default bands, and the file takes 768.
+*/
+class SimilarityIndexBuilder
+{
+public:
+	static constexpr int MaxHashes = 256;
+
+	explicit SimilarityIndexBuilder(SimilarityIndexBuildOptions InOptions = {});
+
+	/** Indexes every seed from FirstSeed to LastSeed (inclusive, clamped to 0 .. INT_MAX) into Path */
+	bool Build(std::int64_t FirstSeed, std::int64_t LastSeed, const std::string& Path);
+
+private:
+	SimilarityIndexBuildOptions Options;
+};
+
+/** Read side of a SimilarityIndexBuilder file, memory mapped and queried in place */
+class SimilarityIndex
+{
+public:
+	bool Open(const std::string& Path);
+	bool IsOpen() const;
+
+	std::int64_t GetFirstSeed() const;
+	std::int64_t GetLastSeed() const;
+
+	bool GetSignature(int Seed, LayoutSignature& OutSignature) const;
+
+	/** Approximate K nearest seeds, closest first: only seeds sharing a bucket with Reference in some band get compared */
+	std::vector<SimilarMap> FindNearest(const LayoutSignature& Reference, size_t K, LayoutMetric Metric = LayoutMetric::Jaccard) const;
+
+	/** Exact K nearest seeds, closest first, comparing against every seed in the index */
+	std::vector<SimilarMap> FindNearestExact(const LayoutSignature& Reference, size_t K, LayoutMetric Metric = LayoutMetric::Jaccard) const;
+
+	/** How many seeds FindNearest compares for Reference */
+	size_t CountCandidates(const LayoutSignature& Reference) const;
+
+private:
+	void GatherCandidates(const LayoutSignature& Reference, std::vector<std::uint32_t>& OutIndices) const;
+
+	MappedFile File;
+};
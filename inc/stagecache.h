@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "generator.h"
+
+struct StageCacheStats
+{
+	std::uint64_t Hits = 0;
+	std::uint64_t Misses = 0;
+	std::uint64_t Stores = 0;
+};
+
+/**
+* Keeps LayoutStageResults on disk, so a map only has to rerun the passes after classification.
+* Tuning SetRoom fractions or PredefinedRooms doesn't touch the layout, so after the first run every seed starts from its cached layout.
+*
+* Entries are keyed by seed and Generator::GetLayoutStageHash. Each hash gets its own file in the cache directory, so anything that changes
+* the layout passes (a new LayoutStageVersion, a rule set with another checkpoint type) just starts a new file instead of reading stale layouts.
+* Files are append only with fixed size records, and only an index of seed to record is kept in memory. Safe to share between threads.
+*/
+class StageCache
+{
+public:
+	StageCache() = default;
+	~StageCache();
+
+	StageCache(const StageCache&) = delete;
+	StageCache& operator=(const StageCache&) = delete;
+
+	/** Opens (creating it if needed) the file for RuleSet's layout hash in Directory */
+	bool Open(const std::string& Directory, GeneratorRuleSet RuleSet = GeneratorRuleSet::Default);
+	bool Open(const std::string& Directory, std::uint64_t InLayoutHash);
+	void Close();
+
+	bool IsOpen() const { return File.is_open(); }
+	std::uint64_t GetLayoutHash() const { return LayoutHash; }
+
+	bool Find(int Seed, LayoutStageResult& OutLayout);
+
+	/** False if the seed is already cached or the layout can't be stored */
+	bool Store(const LayoutStageResult& Layout);
+
+	/**
+	* Same map as Gen.GenerateMap(Seed), starting from the cached layout when there is one and caching it when there isn't.
+	* Generators whose rule set has a different layout hash than the cache just generate the map.
+	*/
+	void GenerateMap(Generator& Gen, int Seed);
+
+	/** Writes out anything still buffered */
+	void Flush();
+
+	/** Deletes the files in the directory left by other layout hashes, returns how many were removed */
+	int RemoveStaleFiles();
+
+	size_t GetEntryCount() const;
+	StageCacheStats GetStats() const;
+
+private:
+	mutable std::mutex Mutex;
+	std::fstream File;
+	std::string Directory;
+	std::uint64_t LayoutHash = 0;
+
+	/** Seed to record number */
+	std::unordered_map<int, std::uint32_t> Records;
+
+	StageCacheStats Stats;
+};
@@ -0,0 +1,55 @@
+#include "bakedmaps.h"
+
+namespace
+{
+	/** The seeds the test data was dumped from */
+	constexpr BakedMap BakedMaps[] = {
+		BakeMap(Generator::GenerateSeed("MyMap")),
+		BakeMap(Generator::GenerateSeed("DONTBLINK")),
+		BakeMap(Generator::GenerateSeed("d9341")),
+		BakeMap(Generator::GenerateSeed("JORGE")),
+		BakeMap(Generator::GenerateSeed("dirtymetal")),
+	};
+
+	// Golden results, checked by the compiler. A change to the passes that moves any room of these maps breaks the build here.
+	// They're the output of the existing passes, only a change that means to alter the generated maps should move them
+	static_assert(BakedMaps[0].GetHash() == 0xfe10485ca0902fa4ull);
+	static_assert(BakedMaps[1].GetHash() == 0x70597281b91b04c1ull);
+	static_assert(BakedMaps[2].GetHash() == 0xb5acd9393934309full);
+	static_assert(BakedMaps[3].GetHash() == 0xe46576ea098c8130ull);
+	static_assert(BakedMaps[4].GetHash() == 0xe3e1d72bc1e4dc8aull);
+}
+
+void BakedMap::CopyTo(GeneratedMap& OutMap) const
+{
+	OutMap.Seed = Seed;
+	OutMap.RuleSet = RuleSet;
+	OutMap.Report = Report;
+	for (int X = 0; X <= MapWidth; X++)
+	{
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			const BakedRoom& Room = Rooms[X][Y];
+			RoomArrayEntry& Entry = OutMap.Rooms[X][Y];
+			Entry.RoomName = GetRoomName(Room.NameId == NoBakedName ? NoRoomNameId : Room.NameId);
+			Entry.PosX = X;
+			Entry.PosY = Y;
+			Entry.GridType = Room.GridType;
+			Entry.RoomType = RoomType(Room.RoomType);
+			Entry.RoomZone = Room.RoomZone;
+			Entry.RoomRotation = float(Room.Rotation);
+		}
+	}
+}
+
+const BakedMap* FindBakedMap(int Seed, GeneratorRuleSet RuleSet)
+{
+	for (const BakedMap& Map : BakedMaps)
+	{
+		if (Map.Seed == Seed && Map.RuleSet == RuleSet)
+		{
+			return &Map;
+		}
+	}
+	return nullptr;
+}
@@ -0,0 +1,421 @@
+#include "batchgenerator.h"
+#include "blitzrand.h"
+
+#include <algorithm>
+#include <bit>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+static constexpr int CHECKPOINT = 255;
+
+/** Bits 1 -> MapWidth - 1, the columns the classification pass looks at */
+static constexpr std::uint32_t InteriorColumns = (1u << MapWidth) - 2u;
+
+/** Rows where GenerateMap places a checkpoint instead of a hallway, i.e. the zone changes below them */
+static const std::array<bool, MapHeight + 1> CheckpointRows = []()
+{
+	std::array<bool, MapHeight + 1> Rows{};
+	for (int Y = 0; Y <= MapHeight; Y++)
+	{
+		Rows[Y] = Generator::GetMapZone(Y) != Generator::GetMapZone(Y + 1);
+	}
+	return Rows;
+}();
+
+const char* BatchGenerator::GetInstructionSetName()
+{
+#if defined(__AVX512F__)
+	return "AVX-512";
+#elif defined(__AVX2__)
+	return "AVX2";
+#else
+	return "Portable";
+#endif
+}
+
+void BatchGenerator::GenerateLayouts(const int* Seeds, int Count, LayoutStageResult* OutResults)
+{
+	for (int Base = 0; Base < Count; Base += BatchLaneCount)
+	{
+		GenerateLanes(Seeds + Base, std::min(BatchLaneCount, Count - Base), OutResults + Base);
+	}
+}
+
+void BatchGenerator::GenerateLanes(const int* Seeds, int Count, LayoutStageResult* OutResults)
+{
+	// Lanes past Count still run, but nothing reads them back
+	for (int Lane = 0; Lane < BatchLaneCount; Lane++)
+	{
+		RndState[Lane] = BlitzRandSeedState(Lane < Count ? Seeds[Lane] : 0);
+	}
+
+	Occupied = {};
+	Checkpoints = {};
+
+	GenerateLayout();
+	ClassifyRooms(Count, OutResults);
+
+	for (int Lane = 0; Lane < Count; Lane++)
+	{
+		OutResults[Lane].Seed = Seeds[Lane];
+		OutResults[Lane].RndState = RndState[Lane];
+	}
+}
+
+void BatchGenerator::Rand(const LaneInt& Mask, const LaneInt& From, const LaneInt& To, LaneInt& Out)
+{
+#if defined(__AVX512F__)
+	const __m512i Multiplier = _mm512_set1_epi64(RND_A);
+	const __m512i Modulus64 = _mm512_set1_epi64(RND_M);
+	const __m512i Modulus = _mm512_set1_epi32(RND_M);
+
+	for (int Base = 0; Base < BatchLaneCount; Base += 16)
+	{
+		__m512i State = _mm512_load_si512(&RndState[Base]);
+		__mmask16 Active = _mm512_test_epi32_mask(_mm512_loadu_si512(&Mask[Base]), _mm512_set1_epi32(-1));
+
+		// State * A mod (2^31 - 1), using the Mersenne reduction instead of Schrage's method. Both give the exact remainder
+		__m512i Even = _mm512_mul_epu32(State, Multiplier);
+		__m512i Odd = _mm512_mul_epu32(_mm512_srli_epi64(State, 32), Multiplier);
+		Even = _mm512_add_epi64(_mm512_and_si512(Even, Modulus64), _mm512_srli_epi64(Even, 31));
+		Odd = _mm512_add_epi64(_mm512_and_si512(Odd, Modulus64), _mm512_srli_epi64(Odd, 31));
+		__m512i Next = _mm512_mask_blend_epi32(0xAAAA, Even, _mm512_slli_epi64(Odd, 32));
+		Next = _mm512_min_epu32(Next, _mm512_sub_epi32(Next, Modulus));
+
+		_mm512_store_si512(&RndState[Base], _mm512_mask_blend_epi32(Active, State, Next));
+
+		__m512i Low = _mm512_min_epi32(_mm512_loadu_si512(&From[Base]), _mm512_loadu_si512(&To[Base]));
+		__m512i High = _mm512_max_epi32(_mm512_loadu_si512(&From[Base]), _mm512_loadu_si512(&To[Base]));
+		__m512 Value = _mm512_cvtepi32_ps(_mm512_and_si512(Next, _mm512_set1_epi32(65535)));
+		Value = _mm512_add_ps(_mm512_mul_ps(Value, _mm512_set1_ps(1.0f / 65536.0f)), _mm512_set1_ps(.5f / 65536.0f));
+		__m512 Range = _mm512_cvtepi32_ps(_mm512_add_epi32(_mm512_sub_epi32(High, Low), _mm512_set1_epi32(1)));
+		__m512i Result = _mm512_add_epi32(_mm512_cvttps_epi32(_mm512_mul_ps(Value, Range)), Low);
+
+		_mm512_storeu_si512(&Out[Base], _mm512_mask_blend_epi32(Active, _mm512_loadu_si512(&Out[Base]), Result));
+	}
+#elif defined(__AVX2__)
+	const __m256i Multiplier = _mm256_set1_epi64x(RND_A);
+	const __m256i Modulus64 = _mm256_set1_epi64x(RND_M);
+	const __m256i Modulus = _mm256_set1_epi32(RND_M);
+
+	for (int Base = 0; Base < BatchLaneCount; Base += 8)
+	{
+		__m256i State = _mm256_load_si256(reinterpret_cast<const __m256i*>(&RndState[Base]));
+		__m256i Active = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&Mask[Base]));
+
+		// State * A mod (2^31 - 1), using the Mersenne reduction instead of Schrage's method. Both give the exact remainder
+		__m256i Even = _mm256_mul_epu32(State, Multiplier);
+		__m256i Odd = _mm256_mul_epu32(_mm256_srli_epi64(State, 32), Multiplier);
+		Even = _mm256_add_epi64(_mm256_and_si256(Even, Modulus64), _mm256_srli_epi64(Even, 31));
+		Odd = _mm256_add_epi64(_mm256_and_si256(Odd, Modulus64), _mm256_srli_epi64(Odd, 31));
+		__m256i Next = _mm256_blend_epi32(Even, _mm256_slli_epi64(Odd, 32), 0xAA);
+		Next = _mm256_min_epu32(Next, _mm256_sub_epi32(Next, Modulus));
+
+		_mm256_store_si256(reinterpret_cast<__m256i*>(&RndState[Base]), _mm256_blendv_epi8(State, Next, Active));
+
+		__m256i FromVec = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&From[Base]));
+		__m256i ToVec = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&To[Base]));
+		__m256i Low = _mm256_min_epi32(FromVec, ToVec);
+		__m256i High = _mm256_max_epi32(FromVec, ToVec);
+		__m256 Value = _mm256_cvtepi32_ps(_mm256_and_si256(Next, _mm256_set1_epi32(65535)));
+		Value = _mm256_add_ps(_mm256_mul_ps(Value, _mm256_set1_ps(1.0f / 65536.0f)), _mm256_set1_ps(.5f / 65536.0f));
+		__m256 Range = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_sub_epi32(High, Low), _mm256_set1_epi32(1)));
+		__m256i Result = _mm256_add_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(Value, Range)), Low);
+
+		__m256i Previous = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&Out[Base]));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(&Out[Base]), _mm256_blendv_epi8(Previous, Result, Active));
+	}
+#else
+	for (int Lane = 0; Lane < BatchLaneCount; Lane++)
+	{
+		// State * A mod (2^31 - 1), using the Mersenne reduction instead of Schrage's method. Both give the exact remainder
+		std::uint64_t Product = std::uint64_t(std::uint32_t(RndState[Lane])) * RND_A;
+		std::uint32_t Next = std::uint32_t(Product & RND_M) + std::uint32_t(Product >> 31);
+		Next = std::min(Next, Next - std::uint32_t(RND_M));
+
+		int Low = std::min(From[Lane], To[Lane]);
+		int High = std::max(From[Lane], To[Lane]);
+		int Result = ExactMath::ScaleRandState(int(Next), High - Low + 1) + Low;
+
+		RndState[Lane] = Mask[Lane] ? int(Next) : RndState[Lane];
+		Out[Lane] = Mask[Lane] ? Result : Out[Lane];
+	}
+#endif
+}
+
+/**
+* Mirrors Generator::GenerateLayout. Each iteration of the do/while is one hallway row for every lane that hasn't reached the top yet,
+* so lanes only drift apart in how many rows they run and which BlitzRand calls they make, both of which are masked.
+*/
+void BatchGenerator::GenerateLayout()
+{
+	alignas(64) LaneInt X, Y, Width{}, Height{}, Hallways{}, X2{}, Temp{}, Drawn{};
+	alignas(64) LaneInt Active, HallwayMask{}, PlaceMask{}, From{}, To{};
+
+	X.fill(MapWidth / 2);
+	Y.fill(MapHeight - 2);
+	Active.fill(-1);
+
+	for (int i = MapHeight - 2; i < MapHeight; i++)
+	{
+		for (int Lane = 0; Lane < BatchLaneCount; Lane++)
+		{
+			Occupied[i][Lane] |= 1u << (MapWidth / 2);
+		}
+	}
+
+	bool bAnyActive = true;
+	while (bAnyActive)
+	{
+		// Random number between 10 and 15
+		From.fill(10);
+		To.fill(15);
+		Rand(Active, From, To, Width);
+
+		for (int Lane = 0; Lane < BatchLaneCount; Lane++)
+		{
+			int LaneX = X[Lane];
+			int LaneWidth = Width[Lane];
+
+			// LaneX > MapWidth * 0.6f and LaneX > MapWidth * 0.4f in integers, as in GenerateHallwayRow
+			if (LaneX * 5 > MapWidth * 3)
+			{
+				LaneWidth = -LaneWidth;
+			}
+			else if (LaneX * 5 > MapWidth * 2)
+			{
+				LaneX = LaneX - LaneWidth / 2;
+			}
+
+			// Make sure the hallway doesn't go outside the array
+			if ((LaneX + LaneWidth) > (MapWidth - 3))
+			{
+				LaneWidth = MapWidth - 3 - LaneX;
+			}
+			else if ((LaneX + LaneWidth) < 2)
+			{
+				LaneWidth = -LaneX + 2;
+			}
+
+			LaneX = std::min(LaneX, LaneX + LaneWidth);
+			LaneWidth = std::abs(LaneWidth);
+
+			X[Lane] = Active[Lane] ? LaneX : X[Lane];
+			Width[Lane] = Active[Lane] ? LaneWidth : Width[Lane];
+		}
+
+		// The hallway itself, this overwrites any checkpoints in the way
+		for (int Lane = 0; Lane < BatchLaneCount; Lane++)
+		{
+			int High = std::min(X[Lane] + Width[Lane], MapWidth);
+			std::uint32_t Columns = Active[Lane] ? (2u << High) - (1u << X[Lane]) : 0u;
+			Occupied[Y[Lane]][Lane] |= Columns;
+			Checkpoints[Y[Lane]][Lane] &= ~Columns;
+		}
+
+		From.fill(3);
+		To.fill(4);
+		Rand(Active, From, To, Height);
+
+		for (int Lane = 0; Lane < BatchLaneCount; Lane++)
+		{
+			if ((Y[Lane] - Height[Lane]) < 1)
+			{
+				Height[Lane] = Y[Lane] - 1;
+			}
+		}
+
+		From.fill(4);
+		To.fill(5);
+		Rand(Active, From, To, Hallways);
+
+		for (int Lane = 0; Lane < BatchLaneCount; Lane++)
+		{
+			if (Active[Lane] && CheckpointRows[Y[Lane] - Height[Lane]])
+			{
+				Height[Lane] = Height[Lane] - 1;
+			}
+		}
+
+		for (int i = 1; i <= 5; i++)
+		{
+			for (int Lane = 0; Lane < BatchLaneCount; Lane++)
+			{
+				HallwayMask[Lane] = (Active[Lane] && i <= Hallways[Lane]) ? -1 : 0;
+				From[Lane] = X[Lane];
+				To[Lane] = X[Lane] + Width[Lane] - 1;
+			}
+
+			Rand(HallwayMask, From, To, Drawn);
+
+			for (int Lane = 0; Lane < BatchLaneCount; Lane++)
+			{
+				// Slide right until neither this column nor its neighbours are used on the row above
+				std::uint32_t Row = Occupied[Y[Lane] - 1][Lane];
+				std::uint32_t Blocked = Row | (Row << 1) | (Row >> 1);
+				int Start = std::max(std::min(Drawn[Lane], MapWidth - 2), 2);
+				int LaneX2 = std::countr_zero(~Blocked & (~0u << Start));
+
+				X2[Lane] = HallwayMask[Lane] ? LaneX2 : X2[Lane];
+				PlaceMask[Lane] = (HallwayMask[Lane] && LaneX2 < (X[Lane] + Width[Lane])) ? -1 : 0;
+
+				// BlitzRand(2, 1) on the first hallway, BlitzRand(1, Height) on the rest
+				From[Lane] = 1;
+				To[Lane] = i == 1 ? 2 : Height[Lane];
+			}
+
+			Rand(PlaceMask, From, To, Drawn);
+
+			for (int Lane = 0; Lane < BatchLaneCount; Lane++)
+			{
+				if (!PlaceMask[Lane])
+				{
+					continue;
+				}
+
+				int TempHeight = Drawn[Lane];
+				if (i == 1)
+				{
+					TempHeight = Height[Lane];
+					X2[Lane] = Drawn[Lane] == 1 ? X[Lane] : X[Lane] + Width[Lane];
+				}
+
+				std::uint32_t Column = 1u << X2[Lane];
+				for (int Y2 = (Y[Lane] - TempHeight); Y2 <= Y[Lane]; Y2++)
+				{
+					Occupied[Y2][Lane] |= Column;
+					Checkpoints[Y2][Lane] = CheckpointRows[Y2] ? Checkpoints[Y2][Lane] | Column : Checkpoints[Y2][Lane] & ~Column;
+				}
+
+				if (TempHeight == Height[Lane])
+				{
+					Temp[Lane] = X2[Lane];
+				}
+			}
+		}
+
+		bAnyActive = false;
+		for (int Lane = 0; Lane < BatchLaneCount; Lane++)
+		{
+			X[Lane] = Active[Lane] ? Temp[Lane] : X[Lane];
+			Y[Lane] = Active[Lane] ? Y[Lane] - Height[Lane] : Y[Lane];
+			Active[Lane] = (Active[Lane] && !(Y[Lane] < 2)) ? -1 : 0;
+			bAnyActive |= Active[Lane] != 0;
+		}
+	}
+}
+
+/**
+* Mirrors Generator::ClassifyRooms with bitboards. The neighbour count of every cell in a row is added up bit-sliced,
+* which gives one mask per room shape for a whole row of every lane at once.
+*/
+void BatchGenerator::ClassifyRooms(int Count, LayoutStageResult* OutResults)
+{
+	// [Shape][Y][Lane], Shape being the neighbour count
+	alignas(64) std::array<std::array<LaneBits, MapHeight + 1>, 5> Shapes{};
+	alignas(64) std::array<LaneBits, MapHeight + 1> Corners{};
+
+	for (int Y = 1; Y < MapHeight; Y++)
+	{
+		for (int Lane = 0; Lane < BatchLaneCount; Lane++)
+		{
+			std::uint32_t Row = Occupied[Y][Lane];
+			std::uint32_t Right = Row >> 1;
+			std::uint32_t Left = Row << 1;
+			std::uint32_t Below = Occupied[Y + 1][Lane];
+			std::uint32_t Above = Occupied[Y - 1][Lane];
+
+			// Right + Left + Below + Above, one bit of the sum per mask
+			std::uint32_t SumA = Right ^ Left;
+			std::uint32_t CarryA = Right & Left;
+			std::uint32_t SumB = Below ^ Above;
+			std::uint32_t CarryB = Below & Above;
+			std::uint32_t Ones = SumA ^ SumB;
+			std::uint32_t Carry = SumA & SumB;
+			std::uint32_t Twos = CarryA ^ CarryB ^ Carry;
+			std::uint32_t Fours = (CarryA & CarryB) | ((CarryA ^ CarryB) & Carry);
+
+			std::uint32_t Cells = Row & ~Checkpoints[Y][Lane] & InteriorColumns;
+			Shapes[0][Y][Lane] = Cells & ~Ones & ~Twos & ~Fours;
+			Shapes[1][Y][Lane] = Cells & Ones & ~Twos;
+			Shapes[2][Y][Lane] = Cells & ~Ones & Twos;
+			Shapes[3][Y][Lane] = Cells & Ones & Twos;
+			Shapes[4][Y][Lane] = Cells & Fours;
+			Corners[Y][Lane] = Shapes[2][Y][Lane] & ~((Right & Left) | (Below & Above));
+		}
+	}
+
+	for (int Lane = 0; Lane < Count; Lane++)
+	{
+		LayoutStageResult& Result = OutResults[Lane];
+		Result.GridType = {};
+		Result.RoomTypes = {};
+		std::fill(std::begin(Result.Room1Amount), std::end(Result.Room1Amount), 0);
+		std::fill(std::begin(Result.Room2Amount), std::end(Result.Room2Amount), 0);
+		std::fill(std::begin(Result.Room2CAmount), std::end(Result.Room2CAmount), 0);
+		std::fill(std::begin(Result.Room3Amount), std::end(Result.Room3Amount), 0);
+		std::fill(std::begin(Result.Room4Amount), std::end(Result.Room4Amount), 0);
+
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			std::uint32_t Row = Occupied[Y][Lane];
+			std::uint32_t CheckpointRow = Checkpoints[Y][Lane];
+			bool bClassified = Y >= 1 && Y < MapHeight;
+
+			for (std::uint32_t Bits = Row; Bits; Bits &= Bits - 1)
+			{
+				int X = std::countr_zero(Bits);
+				std::uint32_t Column = 1u << X;
+
+				if (CheckpointRow & Column)
+				{
+					Result.GridType[X][Y] = CHECKPOINT;
+					Result.RoomTypes[X][Y] = (bClassified && (Column & InteriorColumns)) ? RoomType::Room2 : RoomType::Room0;
+					continue;
+				}
+
+				Result.GridType[X][Y] = 1;
+				if (!bClassified || !(Column & InteriorColumns))
+				{
+					continue;
+				}
+
+				for (int Shape = 0; Shape <= 4; Shape++)
+				{
+					if (Shapes[Shape][Y][Lane] & Column)
+					{
+						Result.GridType[X][Y] = std::uint8_t(Shape);
+					}
+				}
+
+				switch (Result.GridType[X][Y])
+				{
+				case 1:
+					Result.RoomTypes[X][Y] = RoomType::Room1;
+					break;
+				case 2:
+					Result.RoomTypes[X][Y] = (Corners[Y][Lane] & Column) ? RoomType::Room2C : RoomType::Room2;
+					break;
+				case 3:
+					Result.RoomTypes[X][Y] = RoomType::Room3;
+					break;
+				case 4:
+					Result.RoomTypes[X][Y] = RoomType::Room4;
+					break;
+				}
+			}
+
+			if (bClassified)
+			{
+				int Zone = Generator::GetMapZone(Y);
+				Result.Room1Amount[Zone] += std::popcount(Shapes[1][Y][Lane]);
+				Result.Room2Amount[Zone] += std::popcount(Shapes[2][Y][Lane] & ~Corners[Y][Lane]);
+				Result.Room2CAmount[Zone] += std::popcount(Corners[Y][Lane]);
+				Result.Room3Amount[Zone] += std::popcount(Shapes[3][Y][Lane]);
+				Result.Room4Amount[Zone] += std::popcount(Shapes[4][Y][Lane]);
+			}
+		}
+	}
+}
@@ -0,0 +1,71 @@
+#include "blitzrand.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/** A^1 -> A^BlockSize mod M, so State * BlockMultipliers[k] is the state k + 1 draws ahead */
+alignas(64) static constexpr std::array<int, BlitzRandom::BlockSize> BlockMultipliers = []()
+{
+	std::array<int, BlitzRandom::BlockSize> Multipliers{};
+	std::uint64_t Power = 1;
+	for (int k = 0; k < BlitzRandom::BlockSize; k++)
+	{
+		Power = (Power * RND_A) % RND_M;
+		Multipliers[k] = int(Power);
+	}
+	return Multipliers;
+}();
+
+void BlitzRandom::RefillBlock()
+{
+	// Both operands are below 2^31, so the product fits in 62 bits and two Mersenne folds bring it below 2^31 + 1
+#if defined(__AVX512F__)
+	const __m512i Base = _mm512_set1_epi64(State);
+	const __m512i Modulus64 = _mm512_set1_epi64(RND_M);
+	const __m512i Modulus = _mm512_set1_epi32(RND_M);
+
+	for (int k = 0; k < BlockSize; k += 16)
+	{
+		__m512i Multipliers = _mm512_load_si512(&BlockMultipliers[k]);
+		__m512i Even = _mm512_mul_epu32(Base, Multipliers);
+		__m512i Odd = _mm512_mul_epu32(Base, _mm512_srli_epi64(Multipliers, 32));
+		Even = _mm512_add_epi64(_mm512_and_si512(Even, Modulus64), _mm512_srli_epi64(Even, 31));
+		Odd = _mm512_add_epi64(_mm512_and_si512(Odd, Modulus64), _mm512_srli_epi64(Odd, 31));
+		Even = _mm512_add_epi64(_mm512_and_si512(Even, Modulus64), _mm512_srli_epi64(Even, 31));
+		Odd = _mm512_add_epi64(_mm512_and_si512(Odd, Modulus64), _mm512_srli_epi64(Odd, 31));
+		__m512i Next = _mm512_mask_blend_epi32(0xAAAA, Even, _mm512_slli_epi64(Odd, 32));
+		_mm512_store_si512(&Block[k], _mm512_min_epu32(Next, _mm512_sub_epi32(Next, Modulus)));
+	}
+#elif defined(__AVX2__)
+	const __m256i Base = _mm256_set1_epi64x(State);
+	const __m256i Modulus64 = _mm256_set1_epi64x(RND_M);
+	const __m256i Modulus = _mm256_set1_epi32(RND_M);
+
+	for (int k = 0; k < BlockSize; k += 8)
+	{
+		__m256i Multipliers = _mm256_load_si256(reinterpret_cast<const __m256i*>(&BlockMultipliers[k]));
+		__m256i Even = _mm256_mul_epu32(Base, Multipliers);
+		__m256i Odd = _mm256_mul_epu32(Base, _mm256_srli_epi64(Multipliers, 32));
+		Even = _mm256_add_epi64(_mm256_and_si256(Even, Modulus64), _mm256_srli_epi64(Even, 31));
+		Odd = _mm256_add_epi64(_mm256_and_si256(Odd, Modulus64), _mm256_srli_epi64(Odd, 31));
+		Even = _mm256_add_epi64(_mm256_and_si256(Even, Modulus64), _mm256_srli_epi64(Even, 31));
+		Odd = _mm256_add_epi64(_mm256_and_si256(Odd, Modulus64), _mm256_srli_epi64(Odd, 31));
+		__m256i Next = _mm256_blend_epi32(Even, _mm256_slli_epi64(Odd, 32), 0xAA);
+		_mm256_store_si256(reinterpret_cast<__m256i*>(&Block[k]), _mm256_min_epu32(Next, _mm256_sub_epi32(Next, Modulus)));
+	}
+#else
+	for (int k = 0; k < BlockSize; k++)
+	{
+		std::uint64_t Product = std::uint64_t(State) * std::uint32_t(BlockMultipliers[k]);
+		std::uint64_t Folded = (Product & RND_M) + (Product >> 31);
+		std::uint32_t Next = std::uint32_t((Folded & RND_M) + (Folded >> 31));
+		Block[k] = int(std::min(Next, Next - std::uint32_t(RND_M)));
+	}
+#endif
+
+	BlockIndex = 0;
+}
@@ -0,0 +1,616 @@
+#include "divergencebisector.h"
+#include "generationtask.h"
+#include "mapvalidator.h"
+#include "testdata.h"
+
+#include <glaze/glaze.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace
+{
+	const char* const FieldNames[TraceFieldCount] = { "GridType", "RoomType", "RoomZone", "RoomName" };
+
+	/** The stage that writes a field in the first place, where a field we never wrote gets blamed */
+	constexpr GenerationStage FieldStages[TraceFieldCount] = {
+		GenerationStage::Layout, GenerationStage::Classification, GenerationStage::AssignRooms, GenerationStage::AssignRooms,
+	};
+
+	std::string GetFieldText(const RoomArrayEntry& Entry, TraceField Field)
+	{
+		switch (Field)
+		{
+		case TraceGridType:
+			return std::to_string(Entry.GridType);
+		case TraceRoomType:
+			return std::to_string(int(Entry.RoomType));
+		case TraceRoomZone:
+			return std::to_string(Entry.RoomZone);
+		default:
+			return Entry.RoomName.empty() ? "nothing" : Entry.RoomName;
+		}
+	}
+
+	bool IsFieldEqual(const RoomArrayEntry& A, const RoomArrayEntry& B, TraceField Field)
+	{
+		switch (Field)
+		{
+		case TraceGridType:
+			return A.GridType == B.GridType;
+		case TraceRoomType:
+			return A.RoomType == B.RoomType;
+		case TraceRoomZone:
+			return A.RoomZone == B.RoomZone;
+		default:
+			return A.RoomName == B.RoomName;
+		}
+	}
+
+	/** First step of Stage that changed row Y, or failing that the first step of Stage */
+	int FindFirstStep(const GenerationTrace& Trace, GenerationStage Stage, int Y)
+	{
+		int First = -1;
+		for (int i = 0; i < int(Trace.Steps.size()); i++)
+		{
+			const TraceStep& Step = Trace.Steps[i];
+			if (Step.Stage != Stage)
+			{
+				continue;
+			}
+			if (Step.ChangedRows & (1u << Y))
+			{
+				return i;
+			}
+			if (First < 0)
+			{
+				First = i;
+			}
+		}
+		return First >= 0 ? First : int(Trace.Steps.size()) - 1;
+	}
+
+	std::string GetStepText(const GenerationTrace& Trace, size_t Step)
+	{
+		if (Step >= Trace.Steps.size())
+		{
+			return "the end";
+		}
+		return std::string(MapValidator::GetStageName(Trace.Steps[Step].Stage)) + " step " + std::to_string(Trace.Steps[Step].Iteration);
+	}
+
+	bool ParseStage(const std::string& Name, GenerationStage& OutStage)
+	{
+		for (int Stage = 0; Stage < int(GenerationStage::Done); Stage++)
+		{
+			if (Name == MapValidator::GetStageName(GenerationStage(Stage)))
+			{
+				OutStage = GenerationStage(Stage);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void Print(const std::vector<Divergence>& Divergences, int& OutDiverged)
+	{
+		OutDiverged = 0;
+		for (const Divergence& Found : Divergences)
+		{
+			if (Found.Kind != Divergence::None)
+			{
+				std::printf("%s\n", Found.Describe().c_str());
+				OutDiverged++;
+			}
+		}
+		std::printf("%d of %zu seeds diverge\n", OutDiverged, Divergences.size());
+	}
+}
+
+std::uint64_t GetTraceGridHash(const RoomGrid& Rooms)
+{
+	std::uint64_t Hash = 14695981039346656037ull;
+	const auto Add = [&Hash](std::uint8_t Byte) { Hash = (Hash ^ Byte) * 1099511628211ull; };
+
+	for (int X = 0; X <= MapWidth; X++)
+	{
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			const RoomArrayEntry& Entry = Rooms[X][Y];
+			Add(std::uint8_t(Entry.GridType));
+			Add(std::uint8_t(Entry.RoomType));
+			Add(std::uint8_t(Entry.RoomZone));
+			for (const char Char : Entry.RoomName)
+			{
+				Add(std::uint8_t(Char));
+			}
+			Add(0);
+		}
+	}
+	return Hash;
+}
+
+std::string Divergence::Describe() const
+{
+	char Line[256];
+	const char* StageName = MapValidator::GetStageName(Stage);
+	switch (Kind)
+	{
+	case None:
+		std::snprintf(Line, sizeof(Line), "Seed %d matches", Seed);
+		break;
+	case StepMismatch:
+		std::snprintf(Line, sizeof(Line), "Seed %d diverges at step %d: it's %s, reference has %s", Seed, Step, Ours.c_str(), Reference.c_str());
+		break;
+	case Draws:
+		std::snprintf(Line, sizeof(Line), "Seed %d diverges at %s step %d: %s draws, reference has %s", Seed, StageName, Iteration, Ours.c_str(), Reference.c_str());
+		break;
+	case GridHash:
+		std::snprintf(Line, sizeof(Line), "Seed %d diverges at %s step %d: grid hash %s, reference has %s", Seed, StageName, Iteration, Ours.c_str(),
+			Reference.c_str());
+		break;
+	case Cell:
+		std::snprintf(Line, sizeof(Line), "Seed %d diverges at %s step %d: %s at (%d, %d) is %s, reference has %s", Seed, StageName, Iteration,
+			FieldNames[Field], X, Y, Ours.c_str(), Reference.c_str());
+		break;
+	}
+	return Line;
+}
+
+bool MapDump::Load(const std::string& Path)
+{
+	std::vector<std::vector<TestDataStruct>> Data;
+	if (glz::read_file_json(Data, Path.c_str(), std::string{}))
+	{
+		return false;
+	}
+
+	if (Data.size() != size_t(MapWidth + 1))
+	{
+		return false;
+	}
+
+	for (int X = 0; X <= MapWidth; X++)
+	{
+		if (Data[X].size() != size_t(MapHeight + 1))
+		{
+			return false;
+		}
+
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			const TestDataStruct& Cell = Data[X][Y];
+			RoomArrayEntry& Entry = Rooms[X][Y];
+			Entry.RoomName = Cell.RoomName;
+			Entry.PosX = X;
+			Entry.PosY = Y;
+			Entry.GridType = Cell.GridType;
+			Entry.RoomType = RoomType(Cell.RoomType);
+			Entry.RoomZone = Cell.RoomZone;
+		}
+	}
+	return true;
+}
+
+DivergenceBisector::DivergenceBisector(DivergenceBisectorOptions InOptions)
+	: Options(InOptions)
+{
+}
+
+void DivergenceBisector::Record(Generator& Gen, int Seed, GenerationTrace& OutTrace)
+{
+	OutTrace.Seed = Seed;
+	OutTrace.RuleSet = Gen.GetRuleSet();
+	OutTrace.Steps.clear();
+	OutTrace.LastChanges.assign(size_t(MapWidth + 1) * (MapHeight + 1) * TraceFieldCount, -1);
+
+	// Fields start out as a default RoomArrayEntry's, a step changes a field when it leaves it different from the step before
+	RoomGrid Previous{};
+	int Iterations[int(GenerationStage::Done)]{};
+	std::uint32_t Draws = 0;
+	int State = BlitzRandSeedState(Seed);
+
+	// GenerateMapAsync already stops between steps, so the trace is recorded without touching the passes
+	GenerationTask Task = Gen.GenerateMapAsync(Seed);
+	while (!Task.IsFinished())
+	{
+		TraceStep Step;
+		Step.Stage = Task.GetStage();
+		Step.Iteration = Iterations[int(Step.Stage)]++;
+		Task.Advance(std::chrono::microseconds(0));
+
+		// A step only takes a few dozen draws, stepping a copy of the RNG until it catches up counts them
+		const int NewState = Gen.GetRndState();
+		while (State != NewState)
+		{
+			State = BlitzRandNextState(State);
+			Draws++;
+		}
+		Step.Draws = Draws;
+
+		const RoomGrid& Rooms = Gen.GetMap();
+		const std::int16_t Index = std::int16_t(OutTrace.Steps.size());
+		for (int X = 0; X <= MapWidth; X++)
+		{
+			for (int Y = 0; Y <= MapHeight; Y++)
+			{
+				RoomArrayEntry& Before = Previous[X][Y];
+				const RoomArrayEntry& After = Rooms[X][Y];
+				for (int Field = 0; Field < TraceFieldCount; Field++)
+				{
+					if (!IsFieldEqual(Before, After, TraceField(Field)))
+					{
+						OutTrace.LastChanges[((X * (MapHeight + 1)) + Y) * TraceFieldCount + Field] = Index;
+						Step.ChangedRows |= 1u << Y;
+					}
+				}
+				Before = After;
+			}
+		}
+
+		Step.GridHash = GetTraceGridHash(Rooms);
+		OutTrace.Steps.push_back(Step);
+	}
+}
+
+Divergence DivergenceBisector::Compare(const GenerationTrace& Trace, const GenerationTrace& Reference)
+{
+	Divergence Result;
+	Result.Seed = Trace.Seed;
+
+	for (size_t i = 0; i < std::max(Trace.Steps.size(), Reference.Steps.size()); i++)
+	{
+		const bool bBoth = i < Trace.Steps.size() && i < Reference.Steps.size();
+		if (bBoth)
+		{
+			Result.Stage = Trace.Steps[i].Stage;
+			Result.Iteration = Trace.Steps[i].Iteration;
+		}
+
+		const TraceStep* Ours = bBoth ? &Trace.Steps[i] : nullptr;
+		const TraceStep* Theirs = bBoth ? &Reference.Steps[i] : nullptr;
+		if (!bBoth || Ours->Stage != Theirs->Stage || Ours->Iteration != Theirs->Iteration)
+		{
+			Result.Kind = Divergence::StepMismatch;
+			Result.Ours = GetStepText(Trace, i);
+			Result.Reference = GetStepText(Reference, i);
+		}
+		else if (Ours->Draws != Theirs->Draws)
+		{
+			Result.Kind = Divergence::Draws;
+			Result.Ours = std::to_string(Ours->Draws);
+			Result.Reference = std::to_string(Theirs->Draws);
+		}
+		else if (Ours->GridHash != Theirs->GridHash)
+		{
+			char Hashes[2][17];
+			std::snprintf(Hashes[0], sizeof(Hashes[0]), "%016llx", (unsigned long long)Ours->GridHash);
+			std::snprintf(Hashes[1], sizeof(Hashes[1]), "%016llx", (unsigned long long)Theirs->GridHash);
+			Result.Kind = Divergence::GridHash;
+			Result.Ours = Hashes[0];
+			Result.Reference = Hashes[1];
+		}
+
+		if (Result.Kind != Divergence::None)
+		{
+			Result.Step = int(i);
+			return Result;
+		}
+	}
+	return Result;
+}
+
+Divergence DivergenceBisector::CompareWithDump(const GenerationTrace& Trace, const RoomGrid& Rooms, const RoomGrid& Dump)
+{
+	Divergence Result;
+	Result.Seed = Trace.Seed;
+
+	int FirstStep = INT_MAX;
+	for (int X = 0; X <= MapWidth; X++)
+	{
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			for (int Field = 0; Field < TraceFieldCount; Field++)
+			{
+				if (IsFieldEqual(Rooms[X][Y], Dump[X][Y], TraceField(Field)))
+				{
+					continue;
+				}
+
+				int Step = Trace.GetLastChange(X, Y, TraceField(Field));
+				if (Step < 0)
+				{
+					Step = FindFirstStep(Trace, FieldStages[Field], Y);
+				}
+				if (Step >= FirstStep || Step < 0)
+				{
+					continue;
+				}
+
+				FirstStep = Step;
+				Result.Kind = Divergence::Cell;
+				Result.Step = Step;
+				Result.Stage = Trace.Steps[Step].Stage;
+				Result.Iteration = Trace.Steps[Step].Iteration;
+				Result.X = X;
+				Result.Y = Y;
+				Result.Field = TraceField(Field);
+				Result.Ours = GetFieldText(Rooms[X][Y], TraceField(Field));
+				Result.Reference = GetFieldText(Dump[X][Y], TraceField(Field));
+			}
+		}
+	}
+	return Result;
+}
+
+template<typename Function>
+void DivergenceBisector::ForEach(size_t Count, Function&& Check) const
+{
+	constexpr size_t ChunkSeeds = 16;
+	const int ThreadCount = int(std::min<size_t>(Options.ThreadCount > 0 ? size_t(Options.ThreadCount) : std::max(1u, std::thread::hardware_concurrency()),
+		(Count + ChunkSeeds - 1) / ChunkSeeds));
+
+	std::atomic<size_t> NextChunk = 0;
+	auto Worker = [&]()
+	{
+		Generator Gen(false, Options.RuleSet);
+		for (size_t First = NextChunk.fetch_add(ChunkSeeds); First < Count; First = NextChunk.fetch_add(ChunkSeeds))
+		{
+			for (size_t i = First; i < std::min(First + ChunkSeeds, Count); i++)
+			{
+				Check(Gen, i);
+			}
+		}
+	};
+
+	if (ThreadCount <= 1)
+	{
+		Worker();
+		return;
+	}
+
+	std::vector<std::thread> Threads;
+	for (int i = 0; i < ThreadCount; i++)
+	{
+		Threads.emplace_back(Worker);
+	}
+	for (std::thread& Thread : Threads)
+	{
+		Thread.join();
+	}
+}
+
+void DivergenceBisector::CheckTraces(const std::vector<GenerationTrace>& References, std::vector<Divergence>& OutDivergences) const
+{
+	OutDivergences.assign(References.size(), {});
+	ForEach(References.size(), [&](Generator& Gen, size_t i)
+	{
+		GenerationTrace Trace;
+		Gen.SetRuleSet(References[i].RuleSet);
+		Record(Gen, References[i].Seed, Trace);
+		OutDivergences[i] = Compare(Trace, References[i]);
+	});
+}
+
+void DivergenceBisector::CheckDumps(const std::vector<MapDump>& Dumps, std::vector<Divergence>& OutDivergences) const
+{
+	OutDivergences.assign(Dumps.size(), {});
+	ForEach(Dumps.size(), [&](Generator& Gen, size_t i)
+	{
+		GenerationTrace Trace;
+		Record(Gen, Dumps[i].Seed, Trace);
+		OutDivergences[i] = CompareWithDump(Trace, Gen.GetMap(), Dumps[i].Rooms);
+	});
+}
+
+bool DivergenceBisector::SaveTraces(const std::string& Path, const std::vector<GenerationTrace>& Traces)
+{
+	std::FILE* File = std::fopen(Path.c_str(), "w");
+	if (!File)
+	{
+		return false;
+	}
+
+	for (const GenerationTrace& Trace : Traces)
+	{
+		std::fprintf(File, "trace %d %d\n", Trace.Seed, int(Trace.RuleSet));
+		for (const TraceStep& Step : Trace.Steps)
+		{
+			std::fprintf(File, "%s %d %u %016llx\n", MapValidator::GetStageName(Step.Stage), Step.Iteration, Step.Draws, (unsigned long long)Step.GridHash);
+		}
+		std::fprintf(File, "end\n");
+	}
+	return std::fclose(File) == 0;
+}
+
+bool DivergenceBisector::LoadTraces(const std::string& Path, std::vector<GenerationTrace>& OutTraces)
+{
+	std::ifstream File(Path);
+	if (!File)
+	{
+		return false;
+	}
+
+	OutTraces.clear();
+	GenerationTrace* Trace = nullptr;
+	std::string Line;
+	while (std::getline(File, Line))
+	{
+		std::istringstream Words(Line);
+		std::string First;
+		if (!(Words >> First))
+		{
+			continue;
+		}
+
+		if (First == "trace")
+		{
+			int RuleSet = 0;
+			Trace = &OutTraces.emplace_back();
+			if (!(Words >> Trace->Seed >> RuleSet))
+			{
+				return false;
+			}
+			Trace->RuleSet = GeneratorRuleSet(RuleSet);
+		}
+		else if (First == "end")
+		{
+			Trace = nullptr;
+		}
+		else
+		{
+			TraceStep Step;
+			std::string Hash;
+			if (!Trace || !ParseStage(First, Step.Stage) || !(Words >> Step.Iteration >> Step.Draws >> Hash))
+			{
+				return false;
+			}
+			Step.GridHash = std::strtoull(Hash.c_str(), nullptr, 16);
+			Trace->Steps.push_back(Step);
+		}
+	}
+	return Trace == nullptr;
+}
+
+int RunBisectCommand(int argc, char** argv)
+{
+	const std::string Command = argc > 0 ? argv[0] : "";
+	DivergenceBisectorOptions Options;
+	std::string Out, TracePath, DumpPath, DumpDirectory, SeedText;
+	long long FirstSeed = 0, LastSeed = 0;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		const std::string Name = argv[i];
+		const char* Value = argv[i + 1];
+		if (Name == "--out")
+		{
+			Out = Value;
+		}
+		else if (Name == "--from")
+		{
+			FirstSeed = std::strtoll(Value, nullptr, 10);
+		}
+		else if (Name == "--to")
+		{
+			LastSeed = std::strtoll(Value, nullptr, 10);
+		}
+		else if (Name == "--rules")
+		{
+			Options.RuleSet = GeneratorRuleSet(std::atoi(Value));
+		}
+		else if (Name == "--threads")
+		{
+			Options.ThreadCount = std::atoi(Value);
+		}
+		else if (Name == "--trace")
+		{
+			TracePath = Value;
+		}
+		else if (Name == "--dump")
+		{
+			DumpPath = Value;
+		}
+		else if (Name == "--dumps")
+		{
+			DumpDirectory = Value;
+		}
+		else if (Name == "--seed")
+		{
+			SeedText = Value;
+		}
+		else
+		{
+			std::fprintf(stderr, "Unknown option %s\n", Name.c_str());
+			return 2;
+		}
+	}
+
+	if (Command == "trace")
+	{
+		if (Out.empty() || LastSeed < FirstSeed)
+		{
+			std::fprintf(stderr, "trace needs --out <file> and --from <= --to\n");
+			return 2;
+		}
+
+		std::vector<GenerationTrace> Traces;
+		Generator Gen(false, Options.RuleSet);
+		for (long long Seed = FirstSeed; Seed <= LastSeed; Seed++)
+		{
+			DivergenceBisector::Record(Gen, int(Seed), Traces.emplace_back());
+		}
+		return DivergenceBisector::SaveTraces(Out, Traces) ? 0 : 1;
+	}
+
+	const DivergenceBisector Bisector(Options);
+	std::vector<Divergence> Divergences;
+	if (!TracePath.empty())
+	{
+		std::vector<GenerationTrace> References;
+		if (!DivergenceBisector::LoadTraces(TracePath, References))
+		{
+			std::fprintf(stderr, "Couldn't read traces from %s\n", TracePath.c_str());
+			return 2;
+		}
+		Bisector.CheckTraces(References, Divergences);
+	}
+	else if (!DumpPath.empty() || !DumpDirectory.empty())
+	{
+		// Dumps are named after the seed text CB was given, which is hashed the way CB does
+		std::vector<MapDump> Dumps;
+		std::vector<std::pair<std::string, std::string>> Files;
+		if (!DumpPath.empty())
+		{
+			if (SeedText.empty())
+			{
+				std::fprintf(stderr, "--dump needs the --seed it was generated with\n");
+				return 2;
+			}
+			Files.emplace_back(DumpPath, SeedText);
+		}
+		else
+		{
+			std::error_code Error;
+			for (const auto& Entry : std::filesystem::directory_iterator(DumpDirectory, Error))
+			{
+				const std::string Name = Entry.path().filename().string();
+				if (Name.starts_with("mapdump_") && Name.ends_with(".json"))
+				{
+					Files.emplace_back(Entry.path().string(), Name.substr(8, Name.size() - 13));
+				}
+			}
+			std::sort(Files.begin(), Files.end());
+		}
+
+		for (const auto& [Path, Text] : Files)
+		{
+			MapDump& Dump = Dumps.emplace_back();
+			if (!Dump.Load(Path))
+			{
+				std::fprintf(stderr, "Couldn't read a map dump from %s\n", Path.c_str());
+				return 2;
+			}
+			Dump.Seed = Generator::GenerateSeed(Text);
+		}
+		Bisector.CheckDumps(Dumps, Divergences);
+	}
+	else
+	{
+		std::fprintf(stderr, "bisect needs --trace <file>, --dump <file> --seed <text> or --dumps <dir>\n");
+		return 2;
+	}
+
+	int Diverged = 0;
+	Print(Divergences, Diverged);
+	return Diverged == 0 ? 0 : 1;
+}
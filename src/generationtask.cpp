@@ -0,0 +1,98 @@
+#include "generationtask.h"
+
+#include <utility>
+
+GenerationTask::GenerationTask(GenerationTask&& Other) noexcept
+	: Handle(std::exchange(Other.Handle, {}))
+	, bCancelled(Other.bCancelled)
+{
+}
+
+GenerationTask& GenerationTask::operator=(GenerationTask&& Other) noexcept
+{
+	if (this != &Other)
+	{
+		if (Handle)
+		{
+			Handle.destroy();
+		}
+
+		Handle = std::exchange(Other.Handle, {});
+		bCancelled = Other.bCancelled;
+	}
+
+	return *this;
+}
+
+GenerationTask::~GenerationTask()
+{
+	if (Handle)
+	{
+		Handle.destroy();
+	}
+}
+
+bool GenerationTask::Advance(std::chrono::microseconds Budget)
+{
+	const auto Deadline = std::chrono::steady_clock::now() + Budget;
+
+	while (Step())
+	{
+		if (std::chrono::steady_clock::now() >= Deadline)
+		{
+			break;
+		}
+	}
+
+	return IsFinished();
+}
+
+void GenerationTask::RunToCompletion()
+{
+	while (Step())
+	{
+	}
+}
+
+void GenerationTask::Cancel()
+{
+	if (Handle && !Handle.done())
+	{
+		Handle.destroy();
+		Handle = {};
+		bCancelled = true;
+	}
+}
+
+bool GenerationTask::IsFinished() const
+{
+	return !Handle || Handle.done();
+}
+
+GenerationStage GenerationTask::GetStage() const
+{
+	return Handle ? Handle.promise().Stage : GenerationStage::Done;
+}
+
+bool GenerationTask::Step()
+{
+	if (IsFinished())
+	{
+		return false;
+	}
+
+	if (Handle.promise().StopToken.stop_requested())
+	{
+		Cancel();
+		return false;
+	}
+
+	Handle.resume();
+
+	if (Handle.promise().Exception)
+	{
+		std::rethrow_exception(Handle.promise().Exception);
+	}
+
+	return !Handle.done();
+}
@@ -0,0 +1,456 @@
+#include "loadtest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	Clock::duration ToDuration(double Seconds)
+	{
+		return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(Seconds));
+	}
+
+	double ToSeconds(Clock::duration Duration)
+	{
+		return std::chrono::duration<double>(Duration).count();
+	}
+
+	/** User and kernel time of every thread of the process so far, 0 where it can't be read */
+	std::uint64_t GetProcessCpuNanoseconds()
+	{
+#if defined(_WIN32)
+		FILETIME Creation, Exit, Kernel, User;
+		if (!GetProcessTimes(GetCurrentProcess(), &Creation, &Exit, &Kernel, &User))
+		{
+			return 0;
+		}
+
+		// In 100ns ticks
+		const std::uint64_t KernelTicks = (std::uint64_t(Kernel.dwHighDateTime) << 32) | Kernel.dwLowDateTime;
+		const std::uint64_t UserTicks = (std::uint64_t(User.dwHighDateTime) << 32) | User.dwLowDateTime;
+		return (KernelTicks + UserTicks) * 100;
+#elif defined(__linux__) || defined(__APPLE__)
+		rusage Usage{};
+		if (getrusage(RUSAGE_SELF, &Usage) != 0)
+		{
+			return 0;
+		}
+
+		const auto ToNanoseconds = [](const timeval& Time) { return std::uint64_t(Time.tv_sec) * 1000000000ull + std::uint64_t(Time.tv_usec) * 1000ull; };
+		return ToNanoseconds(Usage.ru_utime) + ToNanoseconds(Usage.ru_stime);
+#else
+		return 0;
+#endif
+	}
+
+	/** What a session recorded since the last interval. Only the session and the interval taker lock it, once per map and once per interval */
+	struct SessionCounters
+	{
+		std::mutex Mutex;
+		LatencyHistogram Latencies;
+		std::uint64_t Repeats = 0;
+	};
+
+	/** A queue in front of a few worker threads, each with its own Generator, standing in for a generation service on the same machine */
+	class StandInService
+	{
+	public:
+		StandInService(int ThreadCount, GeneratorRuleSet RuleSet)
+		{
+			for (int i = 0; i < ThreadCount; i++)
+			{
+				Threads.emplace_back([this, RuleSet]() { Run(RuleSet); });
+			}
+		}
+
+		~StandInService()
+		{
+			{
+				std::lock_guard<std::mutex> Lock(Mutex);
+				bStopping = true;
+			}
+			WorkAvailable.notify_all();
+			for (std::thread& Thread : Threads)
+			{
+				Thread.join();
+			}
+		}
+
+		/** Queues Seed and waits for the map */
+		void Generate(int Seed, GeneratedMap& OutMap)
+		{
+			Request Pending;
+			Pending.Seed = Seed;
+			Pending.Map = &OutMap;
+
+			std::unique_lock<std::mutex> Lock(Mutex);
+			Queue.push_back(&Pending);
+			WorkAvailable.notify_one();
+			Pending.Done.wait(Lock, [&]() { return Pending.bDone; });
+		}
+
+	private:
+		struct Request
+		{
+			int Seed = 0;
+			GeneratedMap* Map = nullptr;
+			bool bDone = false;
+			std::condition_variable Done;
+		};
+
+		void Run(GeneratorRuleSet RuleSet)
+		{
+			Generator Gen(false, RuleSet);
+			for (;;)
+			{
+				Request* Next = nullptr;
+				{
+					std::unique_lock<std::mutex> Lock(Mutex);
+					WorkAvailable.wait(Lock, [&]() { return bStopping || !Queue.empty(); });
+					if (Queue.empty())
+					{
+						return;
+					}
+					Next = Queue.front();
+					Queue.pop_front();
+				}
+
+				Gen.GenerateMap(Next->Seed);
+				Gen.CopyMap(*Next->Map);
+
+				// Notified with the lock held, the request lives on the waiting thread's stack and is gone as soon as it wakes up
+				std::lock_guard<std::mutex> Lock(Mutex);
+				Next->bDone = true;
+				Next->Done.notify_one();
+			}
+		}
+
+		std::mutex Mutex;
+		std::condition_variable WorkAvailable;
+		std::deque<Request*> Queue;
+		bool bStopping = false;
+		std::vector<std::thread> Threads;
+	};
+}
+
+LoadTest::LoadTest(LoadTestOptions InOptions)
+	: Options(std::move(InOptions))
+{
+	Options.Sessions = std::max(Options.Sessions, 1);
+	Options.SeedCount = std::max(Options.SeedCount, 1);
+
+	SeedPopularity.resize(Options.SeedCount);
+	double Total = 0.0;
+	for (int i = 0; i < Options.SeedCount; i++)
+	{
+		Total += 1.0 / std::pow(double(i + 1), Options.ZipfExponent);
+		SeedPopularity[i] = Total;
+	}
+	for (double& Popularity : SeedPopularity)
+	{
+		Popularity /= Total;
+	}
+}
+
+int LoadTest::PickSeed(std::mt19937& Random) const
+{
+	const double Chance = std::uniform_real_distribution<double>(0.0, 1.0)(Random);
+	const size_t Rank = std::min(size_t(std::lower_bound(SeedPopularity.begin(), SeedPopularity.end(), Chance) - SeedPopularity.begin()), SeedPopularity.size() - 1);
+
+	// Spread out so the popular seeds aren't neighbours
+	return int((std::uint32_t(Rank) * 2654435761u) & 0x7FFFFFFF);
+}
+
+LoadTestReport LoadTest::Run()
+{
+	LoadTestReport Report;
+
+	std::unique_ptr<StandInService> Service;
+	if (Options.Target == LoadTargetService)
+	{
+		const int ThreadCount = Options.ServiceThreads > 0 ? Options.ServiceThreads : int(std::max(std::thread::hardware_concurrency(), 1u));
+		Service = std::make_unique<StandInService>(ThreadCount, Options.RuleSet);
+	}
+
+	std::vector<std::unique_ptr<SessionCounters>> Counters;
+	for (int i = 0; i < Options.Sessions; i++)
+	{
+		Counters.push_back(std::make_unique<SessionCounters>());
+	}
+
+	const bool bOpenLoop = Options.ArrivalRate > 0.0;
+	const Clock::time_point Start = Clock::now();
+	const Clock::time_point End = Start + ToDuration(Options.Seconds);
+
+	auto Session = [&](int Index)
+	{
+		std::mt19937 Random(Options.RandomSeed * 7919u + std::uint32_t(Index));
+		std::exponential_distribution<double> Arrivals(bOpenLoop ? Options.ArrivalRate / Options.Sessions : 1.0);
+		std::exponential_distribution<double> Think(Options.ThinkMilliseconds > 0.0 ? 1000.0 / Options.ThinkMilliseconds : 1.0);
+		std::uniform_real_distribution<double> Chance(0.0, 1.0);
+
+		Generator Gen(false, Options.RuleSet);
+		GeneratedMap Map;
+		SessionCounters& Mine = *Counters[Index];
+		int LastSeed = 0;
+		bool bPlayed = false;
+		Clock::time_point Due = Start;
+
+		for (;;)
+		{
+			if (bOpenLoop)
+			{
+				Due += ToDuration(Arrivals(Random));
+				if (Due >= End)
+				{
+					break;
+				}
+				std::this_thread::sleep_until(Due);
+			}
+			else
+			{
+				Due = Clock::now();
+				if (Due >= End)
+				{
+					break;
+				}
+			}
+
+			const bool bRepeat = bPlayed && Chance(Random) < Options.RepeatRate;
+			const int Seed = bRepeat ? LastSeed : PickSeed(Random);
+			if (Service)
+			{
+				Service->Generate(Seed, Map);
+			}
+			else
+			{
+				// Copied out as a server would before handing it on
+				Gen.GenerateMap(Seed);
+				Gen.CopyMap(Map);
+			}
+
+			const std::uint64_t Latency = std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - Due).count());
+			{
+				std::lock_guard<std::mutex> Lock(Mine.Mutex);
+				Mine.Latencies.Add(Latency);
+				Mine.Repeats += bRepeat;
+			}
+			LastSeed = Seed;
+			bPlayed = true;
+
+			if (!bOpenLoop && Options.ThinkMilliseconds > 0.0)
+			{
+				std::this_thread::sleep_until(std::min(Clock::now() + ToDuration(Think(Random) / 1000.0), End));
+			}
+		}
+	};
+
+	std::vector<std::thread> Threads;
+	for (int i = 0; i < Options.Sessions; i++)
+	{
+		Threads.emplace_back(Session, i);
+	}
+
+	const double HardwareThreads = double(std::max(std::thread::hardware_concurrency(), 1u));
+	const std::uint64_t StartCpu = GetProcessCpuNanoseconds();
+	Clock::time_point Previous = Start;
+	std::uint64_t PreviousCpu = StartCpu;
+
+	auto TakeInterval = [&](Clock::time_point Now)
+	{
+		LatencyHistogram Latencies;
+		for (const std::unique_ptr<SessionCounters>& Session : Counters)
+		{
+			std::lock_guard<std::mutex> Lock(Session->Mutex);
+			Latencies.Merge(Session->Latencies);
+			Session->Latencies = LatencyHistogram();
+			Report.Repeats += Session->Repeats;
+			Session->Repeats = 0;
+		}
+
+		const std::uint64_t Cpu = GetProcessCpuNanoseconds();
+		const double Wall = ToSeconds(Now - Previous);
+
+		LoadTestInterval Interval;
+		Interval.Time = ToSeconds(Now - Start);
+		Interval.Completed = Latencies.GetCount();
+		Interval.Throughput = Wall > 0.0 ? double(Interval.Completed) / Wall : 0.0;
+		Interval.P50 = Latencies.GetPercentile(0.5);
+		Interval.P99 = Latencies.GetPercentile(0.99);
+		Interval.P999 = Latencies.GetPercentile(0.999);
+		Interval.Max = Latencies.GetMax();
+		Interval.CpuUtilisation = Cpu != 0 && Wall > 0.0 ? double(Cpu - PreviousCpu) * 1e-9 / (Wall * HardwareThreads) : 0.0;
+
+		Report.Latencies.Merge(Latencies);
+		Report.Intervals.push_back(Interval);
+		if (OnInterval)
+		{
+			OnInterval(Interval);
+		}
+
+		Previous = Now;
+		PreviousCpu = Cpu;
+	};
+
+	const Clock::duration IntervalLength = ToDuration(std::max(Options.IntervalSeconds, 0.001));
+	for (Clock::time_point Tick = Start + IntervalLength; Tick < End; Tick += IntervalLength)
+	{
+		std::this_thread::sleep_until(Tick);
+		TakeInterval(Clock::now());
+	}
+
+	for (std::thread& Thread : Threads)
+	{
+		Thread.join();
+	}
+
+	// The last interval also has the requests that were still running at the end
+	const Clock::time_point Finish = Clock::now();
+	TakeInterval(Finish);
+
+	Report.Completed = Report.Latencies.GetCount();
+	Report.Seconds = ToSeconds(Finish - Start);
+	Report.Throughput = Report.Seconds > 0.0 ? double(Report.Completed) / Report.Seconds : 0.0;
+	if (PreviousCpu != 0 && Report.Seconds > 0.0)
+	{
+		Report.CpuUtilisation = double(PreviousCpu - StartCpu) * 1e-9 / (Report.Seconds * HardwareThreads);
+	}
+	return Report;
+}
+
+int RunLoadTestCommand(int argc, char** argv)
+{
+	LoadTestOptions Options;
+	std::vector<int> SessionCounts;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		const std::string Name = argv[i];
+		const char* Value = argv[i + 1];
+		if (Name == "--sessions")
+		{
+			char* After = nullptr;
+			for (const char* Next = Value;; Next = After + 1)
+			{
+				SessionCounts.push_back(int(std::strtol(Next, &After, 10)));
+				if (*After != ',')
+				{
+					break;
+				}
+			}
+		}
+		else if (Name == "--rate")
+		{
+			Options.ArrivalRate = std::atof(Value);
+		}
+		else if (Name == "--think")
+		{
+			Options.ThinkMilliseconds = std::atof(Value);
+		}
+		else if (Name == "--seconds")
+		{
+			Options.Seconds = std::atof(Value);
+		}
+		else if (Name == "--interval")
+		{
+			Options.IntervalSeconds = std::atof(Value);
+		}
+		else if (Name == "--seeds")
+		{
+			Options.SeedCount = std::atoi(Value);
+		}
+		else if (Name == "--zipf")
+		{
+			Options.ZipfExponent = std::atof(Value);
+		}
+		else if (Name == "--repeat")
+		{
+			Options.RepeatRate = std::atof(Value);
+		}
+		else if (Name == "--service")
+		{
+			Options.Target = LoadTargetService;
+			Options.ServiceThreads = std::atoi(Value);
+		}
+		else if (Name == "--rules")
+		{
+			Options.RuleSet = GeneratorRuleSet(std::atoi(Value));
+		}
+		else if (Name == "--random-seed")
+		{
+			Options.RandomSeed = std::uint32_t(std::strtoul(Value, nullptr, 10));
+		}
+		else
+		{
+			std::fprintf(stderr, "Unknown option %s\n", Name.c_str());
+			return 2;
+		}
+	}
+
+	if (SessionCounts.empty())
+	{
+		SessionCounts.push_back(Options.Sessions);
+	}
+	if (Options.Seconds <= 0.0 || std::any_of(SessionCounts.begin(), SessionCounts.end(), [](int Count) { return Count < 1; }))
+	{
+		std::fprintf(stderr, "loadtest needs --seconds above 0 and at least 1 session\n");
+		return 2;
+	}
+
+	std::vector<LoadTestReport> Reports;
+	for (const int Sessions : SessionCounts)
+	{
+		Options.Sessions = Sessions;
+		std::printf("%d sessions, %s, %s\n", Sessions, Options.Target == LoadTargetService ? "stand-in service" : "in-process",
+			Options.ArrivalRate > 0.0 ? "open loop" : "closed loop");
+		std::printf("%8s %10s %10s %10s %10s %10s %6s\n", "time", "maps/s", "p50 us", "p99 us", "p99.9 us", "max us", "cpu");
+
+		LoadTest Test(Options);
+		Test.OnInterval = [](const LoadTestInterval& Interval)
+		{
+			std::printf("%7.1fs %10.0f %10.1f %10.1f %10.1f %10.1f %5.1f%%\n", Interval.Time, Interval.Throughput, double(Interval.P50) * 1e-3,
+				double(Interval.P99) * 1e-3, double(Interval.P999) * 1e-3, double(Interval.Max) * 1e-3, Interval.CpuUtilisation * 100.0);
+			std::fflush(stdout);
+		};
+		Reports.push_back(Test.Run());
+
+		const LoadTestReport& Report = Reports.back();
+		std::printf("%llu maps (%llu repeats) in %.1fs: %.0f maps/s, p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us, cpu %.1f%%\n\n",
+			(unsigned long long)Report.Completed, (unsigned long long)Report.Repeats, Report.Seconds, Report.Throughput,
+			double(Report.Latencies.GetPercentile(0.5)) * 1e-3, double(Report.Latencies.GetPercentile(0.99)) * 1e-3,
+			double(Report.Latencies.GetPercentile(0.999)) * 1e-3, double(Report.Latencies.GetMax()) * 1e-3, Report.CpuUtilisation * 100.0);
+	}
+
+	if (Reports.size() > 1)
+	{
+		// Throughput per session against the first run's, 100% being perfect scaling
+		const double Baseline = Reports[0].Throughput / SessionCounts[0];
+		std::printf("%8s %10s %10s %10s %6s\n", "sessions", "maps/s", "scaling", "p99 us", "cpu");
+		for (size_t i = 0; i < Reports.size(); i++)
+		{
+			const double Scaling = Baseline > 0.0 ? Reports[i].Throughput / SessionCounts[i] / Baseline : 0.0;
+			std::printf("%8d %10.0f %9.1f%% %10.1f %5.1f%%\n", SessionCounts[i], Reports[i].Throughput, Scaling * 100.0,
+				double(Reports[i].Latencies.GetPercentile(0.99)) * 1e-3, Reports[i].CpuUtilisation * 100.0);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,214 @@
+#include "logger.h"
+
+#include <chrono>
+
+const char* GetLogLevelPrefix(LogLevel Level)
+{
+	switch (Level)
+	{
+	case LogLevel::Debug:
+		return "[DEBUG]";
+	case LogLevel::Warning:
+		return "[WARNING]";
+	case LogLevel::Error:
+		return "[ERROR]";
+	default:
+		return "";
+	}
+}
+
+LogRecord* LogRing::BeginWrite()
+{
+	const std::uint32_t CurrentHead = Head.load(std::memory_order_relaxed);
+	if (CurrentHead - Tail.load(std::memory_order_acquire) >= Capacity)
+	{
+		return nullptr;
+	}
+
+	return &Records[CurrentHead % Capacity];
+}
+
+void LogRing::EndWrite()
+{
+	Head.store(Head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+const LogRecord* LogRing::Peek()
+{
+	const std::uint32_t CurrentTail = Tail.load(std::memory_order_relaxed);
+	if (CurrentTail == Head.load(std::memory_order_acquire))
+	{
+		return nullptr;
+	}
+
+	return &Records[CurrentTail % Capacity];
+}
+
+void LogRing::Pop()
+{
+	Tail.store(Tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+Logger& Logger::Get()
+{
+	static Logger Instance;
+	return Instance;
+}
+
+static void WriteToStdout(std::string_view Text)
+{
+	std::fwrite(Text.data(), 1, Text.size(), stdout);
+	std::fflush(stdout);
+}
+
+Logger::Logger()
+	: Sink(&WriteToStdout)
+{
+	Thread = std::thread(&Logger::Run, this);
+}
+
+Logger::~Logger()
+{
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		bStopping = true;
+	}
+	Wake.notify_all();
+	Thread.join();
+}
+
+void Logger::Flush()
+{
+	std::unique_lock<std::mutex> Lock(Mutex);
+	const std::uint64_t Target = ++FlushesRequested;
+	Wake.notify_all();
+	Drained.wait(Lock, [&]() { return FlushesDone >= Target; });
+}
+
+void Logger::SetSink(SinkFunction InSink)
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	Sink = InSink ? std::move(InSink) : SinkFunction(&WriteToStdout);
+}
+
+LogRing* Logger::GetThreadRing()
+{
+	/** Gives the ring back when the thread exits, whatever is still in it gets drained by whoever takes it next */
+	struct RingOwner
+	{
+		LogRing* Ring = nullptr;
+
+		~RingOwner()
+		{
+			if (Ring)
+			{
+				Ring->bInUse.store(false, std::memory_order_release);
+			}
+		}
+	};
+
+	thread_local RingOwner Owner;
+	if (!Owner.Ring)
+	{
+		Owner.Ring = AcquireRing();
+	}
+	return Owner.Ring;
+}
+
+LogRing* Logger::AcquireRing()
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+
+	const int Count = RingCount.load(std::memory_order_relaxed);
+	for (int i = 0; i < Count; i++)
+	{
+		bool bExpected = false;
+		if (Rings[i]->bInUse.compare_exchange_strong(bExpected, true, std::memory_order_acquire))
+		{
+			return Rings[i].get();
+		}
+	}
+
+	if (Count == int(Rings.size()))
+	{
+		return nullptr;
+	}
+
+	Rings[Count] = std::make_unique<LogRing>();
+	Rings[Count]->bInUse.store(true, std::memory_order_relaxed);
+	RingCount.store(Count + 1, std::memory_order_release);
+	return Rings[Count].get();
+}
+
+void Logger::CountDropped(LogRing* Ring)
+{
+	if (Ring)
+	{
+		Ring->CountDropped();
+	}
+	else
+	{
+		Dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+bool Logger::DrainRings(std::string& OutText)
+{
+	bool bFoundAny = false;
+	std::uint32_t DroppedTotal = Dropped.exchange(0, std::memory_order_relaxed);
+
+	const int Count = RingCount.load(std::memory_order_acquire);
+	for (int i = 0; i < Count; i++)
+	{
+		LogRing& Ring = *Rings[i];
+		while (const LogRecord* Record = Ring.Peek())
+		{
+			Record->Format(*Record, OutText);
+			Ring.Pop();
+			bFoundAny = true;
+		}
+		DroppedTotal += Ring.TakeDropped();
+	}
+
+	if (DroppedTotal > 0)
+	{
+		OutText += GetLogLevelPrefix(LogLevel::Warning);
+		OutText += "Logger dropped " + std::to_string(DroppedTotal) + " messages\n";
+		bFoundAny = true;
+	}
+
+	return bFoundAny;
+}
+
+void Logger::Run()
+{
+	static constexpr std::chrono::milliseconds DrainInterval{ 5 };
+
+	std::string Text;
+	std::unique_lock<std::mutex> Lock(Mutex);
+	while (true)
+	{
+		Wake.wait_for(Lock, DrainInterval, [&]() { return bStopping || FlushesRequested > FlushesDone; });
+		const std::uint64_t Requested = FlushesRequested;
+		const bool bStop = bStopping;
+
+		// One pass is enough for a flush, anything logged before it was requested is already visible in the rings
+		Lock.unlock();
+		Text.clear();
+		bool bFoundAny = DrainRings(Text);
+		Lock.lock();
+
+		if (bFoundAny)
+		{
+			Sink(Text);
+		}
+
+		FlushesDone = Requested;
+		Drained.notify_all();
+
+		if (bStop)
+		{
+			break;
+		}
+	}
+}
@@ -1,6 +1,11 @@
 #include <gtest/gtest.h>
 
 #include "generator.h"
+#include "seedsweep.h"
+#include "divergencebisector.h"
+#include "loadtest.h"
+
+#include <cstring>
 
 #define MANUAL_TEST 0
 
@@ -10,6 +15,19 @@ int main(int argc, char** argv)
 	Generator Gen(true);
 	Gen.GenerateMap("d9341");
 #else
+	if (argc > 1 && (std::strcmp(argv[1], "sweep") == 0 || std::strcmp(argv[1], "merge") == 0))
+	{
+		return RunSweepCommand(argc - 1, argv + 1);
+	}
+	if (argc > 1 && (std::strcmp(argv[1], "trace") == 0 || std::strcmp(argv[1], "bisect") == 0))
+	{
+		return RunBisectCommand(argc - 1, argv + 1);
+	}
+	if (argc > 1 && std::strcmp(argv[1], "loadtest") == 0)
+	{
+		return RunLoadTestCommand(argc - 1, argv + 1);
+	}
+
 	testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
 #endif
@@ -0,0 +1,536 @@
+#include "maparchive.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+/**
+* File layout, little endian with everything 8 byte aligned:
+* ArchiveHeader, the blocks, the block index (sorted by seed) and the name table (u16 length + bytes per name).
+* A block is a BlockHeader followed by its columns, which the header holds the offsets of.
+*/
+namespace
+{
+	constexpr char ArchiveMagic[8] = { 'S', 'C', 'P', 'M', 'A', 'R', 'C', '1' };
+	constexpr std::uint32_t ArchiveVersion = 1;
+
+	constexpr int CellCount = (MapWidth + 1) * (MapHeight + 1);
+	constexpr int OccupancyWords = (CellCount + 63) / 64;
+
+	/** Every this many maps the block stores how many cells and names came before, the rest is counted from the bitboards */
+	constexpr int SampleInterval = 32;
+
+	constexpr int GridTypeBits = 3;
+	constexpr int RoomTypeBits = 3;
+	constexpr int ZoneBits = 2;
+	constexpr int RotationBits = 2;
+
+	/** GridType 255 doesn't fit in 3 bits, it gets the first code after the neighbour counts */
+	constexpr int CheckpointCode = 5;
+
+	struct ArchiveHeader
+	{
+		char Magic[8];
+		std::uint32_t Version;
+		std::uint32_t RuleSet;
+		std::uint64_t MapCount;
+		std::uint64_t BlockCount;
+		std::uint64_t BlockIndexOffset;
+		std::uint64_t NameCount;
+		std::uint64_t NameTableOffset;
+		std::uint64_t Reserved;
+	};
+
+	struct BlockHeader
+	{
+		std::int32_t FirstSeed;
+		std::uint32_t MapCount;
+		std::uint32_t bContiguous;
+		std::uint32_t NameBits;
+		std::uint64_t Seeds;
+		std::uint64_t Occupancy;
+		std::uint64_t Samples;
+		std::uint64_t GridTypes;
+		std::uint64_t RoomTypes;
+		std::uint64_t Zones;
+		std::uint64_t Rotations;
+		std::uint64_t Named;
+		std::uint64_t Names;
+		std::uint64_t Reports;
+	};
+
+	struct BlockIndexEntry
+	{
+		std::int32_t FirstSeed;
+		std::int32_t LastSeed;
+		std::uint64_t Offset;
+	};
+
+	static_assert(sizeof(ArchiveHeader) == 64 && sizeof(BlockHeader) == 96 && sizeof(BlockIndexEntry) == 16, "Archive structs can't have padding");
+
+	std::uint32_t ReadBits(const std::uint64_t* Words, std::uint64_t Offset, int Bits)
+	{
+		const std::uint64_t Word = Offset >> 6;
+		const int Shift = int(Offset & 63);
+
+		std::uint64_t Value = Words[Word] >> Shift;
+		if (Shift + Bits > 64)
+		{
+			Value |= Words[Word + 1] << (64 - Shift);
+		}
+		return std::uint32_t(Value & ((std::uint64_t(1) << Bits) - 1));
+	}
+
+	std::uint32_t CountBits(const std::uint64_t* Words, std::uint64_t Offset, std::uint64_t Count)
+	{
+		std::uint32_t Total = 0;
+		while (Count > 0)
+		{
+			const int Bits = int(std::min<std::uint64_t>(Count, 32));
+			Total += std::popcount(ReadBits(Words, Offset, Bits));
+			Offset += Bits;
+			Count -= Bits;
+		}
+		return Total;
+	}
+
+	bool IsResetCell(const RoomArrayEntry& Entry, int X, int Y)
+	{
+		return Entry.GridType == 0 && Entry.RoomType == RoomType::Room0 && Entry.RoomZone == Generator::GetMapZone(Y) && Entry.RoomRotation == 0.f &&
+			Entry.RoomName.empty() && Entry.PosX == X && Entry.PosY == Y;
+	}
+
+	/** Room1sForced, the report flags, SetRoomFailures and OutOfBoundsWrites in one word */
+	bool PackReport(const GenerationReport& Report, std::uint64_t& OutBits)
+	{
+		OutBits = 0;
+		int Shift = 0;
+		for (int Zone = 0; Zone < ZoneAmount; Zone++)
+		{
+			if (Report.Room1sForced[Zone] < 0 || Report.Room1sForced[Zone] > 255)
+			{
+				return false;
+			}
+			OutBits |= std::uint64_t(Report.Room1sForced[Zone]) << Shift;
+			Shift += 8;
+
+			for (bool bFlag : { Report.bRoom4Forced[Zone], Report.bRoom4ForceFailed[Zone], Report.bRoom2CForced[Zone], Report.bRoom2CForceFailed[Zone] })
+			{
+				OutBits |= std::uint64_t(bFlag) << Shift++;
+			}
+		}
+
+		if (Report.SetRoomFailures < 0 || Report.SetRoomFailures > 0xffff)
+		{
+			return false;
+		}
+		OutBits |= std::uint64_t(Report.SetRoomFailures) << Shift;
+		Shift += 16;
+
+		if (Report.OutOfBoundsWrites < 0 || Report.OutOfBoundsWrites > 0xfff)
+		{
+			return false;
+		}
+		OutBits |= std::uint64_t(Report.OutOfBoundsWrites) << Shift;
+		return true;
+	}
+
+	void UnpackReport(std::uint64_t Bits, GenerationReport& OutReport)
+	{
+		for (int Zone = 0; Zone < ZoneAmount; Zone++)
+		{
+			OutReport.Room1sForced[Zone] = int(Bits & 0xff);
+			OutReport.bRoom4Forced[Zone] = (Bits >> 8) & 1;
+			OutReport.bRoom4ForceFailed[Zone] = (Bits >> 9) & 1;
+			OutReport.bRoom2CForced[Zone] = (Bits >> 10) & 1;
+			OutReport.bRoom2CForceFailed[Zone] = (Bits >> 11) & 1;
+			Bits >>= 12;
+		}
+		OutReport.SetRoomFailures = int(Bits & 0xffff);
+		OutReport.OutOfBoundsWrites = int((Bits >> 16) & 0xfff);
+	}
+
+	template<typename T>
+	void WriteColumn(std::vector<std::uint8_t>& Buffer, std::uint64_t& OutOffset, const T* Data, size_t Count)
+	{
+		OutOffset = Buffer.size();
+		const std::uint8_t* Bytes = reinterpret_cast<const std::uint8_t*>(Data);
+		Buffer.insert(Buffer.end(), Bytes, Bytes + sizeof(T) * Count);
+		Buffer.resize((Buffer.size() + 7) & ~size_t(7), 0);
+	}
+}
+
+void MapArchiveWriter::BitColumn::Push(std::uint32_t Value, int Bits)
+{
+	if (Bits == 0)
+	{
+		return;
+	}
+
+	const int Shift = int(BitCount & 63);
+	if (Shift == 0)
+	{
+		Words.push_back(0);
+	}
+
+	Words.back() |= std::uint64_t(Value) << Shift;
+	if (Shift + Bits > 64)
+	{
+		Words.push_back(std::uint64_t(Value) >> (64 - Shift));
+	}
+	BitCount += Bits;
+}
+
+MapArchiveWriter::MapArchiveWriter(int InMapsPerBlock)
+	: MapsPerBlock(std::max(InMapsPerBlock, 1))
+{
+}
+
+MapArchiveWriter::~MapArchiveWriter()
+{
+	if (Out.is_open())
+	{
+		Close();
+	}
+}
+
+bool MapArchiveWriter::Open(const std::string& Path)
+{
+	Out.open(Path, std::ios::binary | std::ios::trunc);
+	if (!Out)
+	{
+		return false;
+	}
+
+	// Filled in by Close
+	ArchiveHeader Header{};
+	Out.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+	Position = sizeof(Header);
+	MapCount = 0;
+	Block = {};
+	BlockIndex.clear();
+	NameIds.clear();
+	Names.clear();
+	return bool(Out);
+}
+
+bool MapArchiveWriter::Add(const GeneratedMap& Map)
+{
+	if (!Out.is_open())
+	{
+		return false;
+	}
+
+	if (MapCount == 0)
+	{
+		RuleSet = Map.RuleSet;
+	}
+
+	const bool bAscending = Block.Seeds.empty() ? (BlockIndex.empty() || Map.Seed > BlockIndex.back().LastSeed) : Map.Seed > Block.Seeds.back();
+	std::uint64_t Report = 0;
+	if (!bAscending || Map.RuleSet != RuleSet || !PackReport(Map.Report, Report))
+	{
+		return false;
+	}
+
+	// Check the whole map fits before any column is touched, so a failed Add leaves the block as it was
+	std::uint64_t Occupancy[OccupancyWords]{};
+	for (int X = 0; X <= MapWidth; X++)
+	{
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			const RoomArrayEntry& Entry = Map.Rooms[X][Y];
+			if (IsResetCell(Entry, X, Y))
+			{
+				continue;
+			}
+
+			const bool bValidGridType = (Entry.GridType >= 0 && Entry.GridType < CheckpointCode) || Entry.GridType == 255;
+			const int Quarter = int(Entry.RoomRotation / 90.f);
+			const bool bValidRotation = Quarter >= 0 && Quarter < 4 && Entry.RoomRotation == Quarter * 90.f;
+			if (!bValidGridType || !bValidRotation || Entry.RoomZone < 0 || Entry.RoomZone > 3 || Entry.PosX != X || Entry.PosY != Y)
+			{
+				return false;
+			}
+
+			const int Cell = X * (MapHeight + 1) + Y;
+			Occupancy[Cell >> 6] |= std::uint64_t(1) << (Cell & 63);
+		}
+	}
+
+	const int Row = int(Block.Seeds.size());
+	if (Row % SampleInterval == 0)
+	{
+		Block.Samples.push_back(Block.CellCount);
+		Block.Samples.push_back(std::uint32_t(Block.NameIds.size()));
+	}
+
+	for (int Cell = 0; Cell < CellCount; Cell++)
+	{
+		if (!((Occupancy[Cell >> 6] >> (Cell & 63)) & 1))
+		{
+			continue;
+		}
+
+		const RoomArrayEntry& Entry = Map.Rooms[Cell / (MapHeight + 1)][Cell % (MapHeight + 1)];
+		Block.GridTypes.Push(Entry.GridType == 255 ? CheckpointCode : Entry.GridType, GridTypeBits);
+		Block.RoomTypes.Push(Entry.RoomType, RoomTypeBits);
+		Block.Zones.Push(Entry.RoomZone, ZoneBits);
+		Block.Rotations.Push(std::uint32_t(Entry.RoomRotation / 90.f), RotationBits);
+		Block.Named.Push(!Entry.RoomName.empty(), 1);
+		if (!Entry.RoomName.empty())
+		{
+			Block.NameIds.push_back(GetNameId(Entry.RoomName));
+		}
+		Block.CellCount++;
+	}
+
+	Block.Seeds.push_back(Map.Seed);
+	Block.Occupancy.insert(Block.Occupancy.end(), std::begin(Occupancy), std::end(Occupancy));
+	Block.Reports.push_back(Report);
+	MapCount++;
+
+	if (int(Block.Seeds.size()) == MapsPerBlock)
+	{
+		return WriteBlock();
+	}
+	return true;
+}
+
+bool MapArchiveWriter::Close()
+{
+	if (!Out.is_open())
+	{
+		return false;
+	}
+
+	if (!Block.Seeds.empty())
+	{
+		WriteBlock();
+	}
+
+	ArchiveHeader Header{};
+	std::memcpy(Header.Magic, ArchiveMagic, sizeof(ArchiveMagic));
+	Header.Version = ArchiveVersion;
+	Header.RuleSet = std::uint32_t(RuleSet);
+	Header.MapCount = MapCount;
+	Header.BlockCount = BlockIndex.size();
+	Header.BlockIndexOffset = Position;
+	Header.NameCount = Names.size();
+
+	Out.write(reinterpret_cast<const char*>(BlockIndex.data()), std::streamsize(sizeof(BlockIndexEntry) * BlockIndex.size()));
+	Position += sizeof(BlockIndexEntry) * BlockIndex.size();
+	Header.NameTableOffset = Position;
+
+	for (const std::string& Name : Names)
+	{
+		const std::uint16_t Length = std::uint16_t(std::min<size_t>(Name.size(), 0xffff));
+		Out.write(reinterpret_cast<const char*>(&Length), sizeof(Length));
+		Out.write(Name.data(), Length);
+	}
+
+	Out.seekp(0);
+	Out.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+
+	const bool bSucceeded = bool(Out);
+	Out.close();
+	return bSucceeded;
+}
+
+bool MapArchiveWriter::WriteBlock()
+{
+	BlockHeader Header{};
+	Header.FirstSeed = Block.Seeds.front();
+	Header.MapCount = std::uint32_t(Block.Seeds.size());
+	Header.bContiguous = Block.Seeds.back() - Block.Seeds.front() == int(Block.Seeds.size()) - 1;
+
+	std::uint32_t LargestNameId = 0;
+	for (std::uint32_t Id : Block.NameIds)
+	{
+		LargestNameId = std::max(LargestNameId, Id);
+	}
+	Header.NameBits = Block.NameIds.empty() ? 0 : std::uint32_t(std::bit_width(LargestNameId));
+	Header.NameBits = std::max<std::uint32_t>(Header.NameBits, Block.NameIds.empty() ? 0 : 1);
+
+	BitColumn NameColumn;
+	for (std::uint32_t Id : Block.NameIds)
+	{
+		NameColumn.Push(Id, int(Header.NameBits));
+	}
+
+	std::vector<std::uint8_t> Buffer(sizeof(BlockHeader));
+	if (!Header.bContiguous)
+	{
+		WriteColumn(Buffer, Header.Seeds, Block.Seeds.data(), Block.Seeds.size());
+	}
+	WriteColumn(Buffer, Header.Occupancy, Block.Occupancy.data(), Block.Occupancy.size());
+	WriteColumn(Buffer, Header.Samples, Block.Samples.data(), Block.Samples.size());
+
+	// Every bit column gets a spare word, so reads that straddle the last word never go past the column
+	for (auto [Column, Offset] : { std::pair{ &Block.GridTypes, &Header.GridTypes }, { &Block.RoomTypes, &Header.RoomTypes }, { &Block.Zones, &Header.Zones },
+		{ &Block.Rotations, &Header.Rotations }, { &Block.Named, &Header.Named }, { &NameColumn, &Header.Names } })
+	{
+		Column->Words.push_back(0);
+		WriteColumn(Buffer, *Offset, Column->Words.data(), Column->Words.size());
+	}
+	WriteColumn(Buffer, Header.Reports, Block.Reports.data(), Block.Reports.size());
+	std::memcpy(Buffer.data(), &Header, sizeof(Header));
+
+	Out.write(reinterpret_cast<const char*>(Buffer.data()), std::streamsize(Buffer.size()));
+	BlockIndex.push_back({ Block.Seeds.front(), Block.Seeds.back(), Position });
+	Position += Buffer.size();
+
+	Block = {};
+	return bool(Out);
+}
+
+std::uint32_t MapArchiveWriter::GetNameId(const std::string& Name)
+{
+	auto [Found, bInserted] = NameIds.try_emplace(Name, std::uint32_t(Names.size()));
+	if (bInserted)
+	{
+		Names.push_back(Name);
+	}
+	return Found->second;
+}
+
+bool MapArchive::Open(const std::string& Path)
+{
+	Names.clear();
+	if (!File.Open(Path) || File.GetSize() < sizeof(ArchiveHeader))
+	{
+		File.Close();
+		return false;
+	}
+
+	const ArchiveHeader& Header = *File.At<ArchiveHeader>(0);
+	if (std::memcmp(Header.Magic, ArchiveMagic, sizeof(ArchiveMagic)) != 0 || Header.Version != ArchiveVersion ||
+		Header.BlockIndexOffset + sizeof(BlockIndexEntry) * Header.BlockCount > File.GetSize() || Header.NameTableOffset > File.GetSize())
+	{
+		File.Close();
+		return false;
+	}
+
+	// The dictionary is tiny, so it's the one thing read up front
+	std::uint64_t Offset = Header.NameTableOffset;
+	for (std::uint64_t i = 0; i < Header.NameCount; i++)
+	{
+		std::uint16_t Length = 0;
+		if (Offset + sizeof(Length) > File.GetSize())
+		{
+			File.Close();
+			return false;
+		}
+		std::memcpy(&Length, File.GetData() + Offset, sizeof(Length));
+		Offset += sizeof(Length);
+
+		if (Offset + Length > File.GetSize())
+		{
+			File.Close();
+			return false;
+		}
+		Names.emplace_back(reinterpret_cast<const char*>(File.GetData() + Offset), Length);
+		Offset += Length;
+	}
+
+	return true;
+}
+
+std::uint64_t MapArchive::GetMapCount() const
+{
+	return IsOpen() ? File.At<ArchiveHeader>(0)->MapCount : 0;
+}
+
+bool MapArchive::Read(int Seed, GeneratedMap& OutMap) const
+{
+	if (!IsOpen())
+	{
+		return false;
+	}
+
+	const ArchiveHeader& Header = *File.At<ArchiveHeader>(0);
+	const BlockIndexEntry* IndexBegin = File.At<BlockIndexEntry>(Header.BlockIndexOffset);
+	const BlockIndexEntry* IndexEnd = IndexBegin + Header.BlockCount;
+	const BlockIndexEntry* Entry = std::upper_bound(IndexBegin, IndexEnd, Seed, [](int Seed, const BlockIndexEntry& Entry) { return Seed < Entry.FirstSeed; });
+	if (Entry == IndexBegin || Seed > (--Entry)->LastSeed)
+	{
+		return false;
+	}
+
+	const std::uint8_t* BlockData = File.GetData() + Entry->Offset;
+	const BlockHeader& Block = *reinterpret_cast<const BlockHeader*>(BlockData);
+	auto Column = [&](std::uint64_t Offset) { return reinterpret_cast<const std::uint64_t*>(BlockData + Offset); };
+
+	std::uint32_t Row = std::uint32_t(Seed - Block.FirstSeed);
+	if (!Block.bContiguous)
+	{
+		const std::int32_t* Seeds = reinterpret_cast<const std::int32_t*>(BlockData + Block.Seeds);
+		const std::int32_t* Found = std::lower_bound(Seeds, Seeds + Block.MapCount, Seed);
+		if (Found == Seeds + Block.MapCount || *Found != Seed)
+		{
+			return false;
+		}
+		Row = std::uint32_t(Found - Seeds);
+	}
+
+	// Start from the last sample and count forward to the row
+	const std::uint64_t* Occupancy = Column(Block.Occupancy);
+	const std::uint64_t* Named = Column(Block.Named);
+	const std::uint32_t* Samples = reinterpret_cast<const std::uint32_t*>(BlockData + Block.Samples);
+	std::uint64_t CellIndex = Samples[(Row / SampleInterval) * 2];
+	std::uint64_t NameIndex = Samples[(Row / SampleInterval) * 2 + 1];
+	for (std::uint32_t Previous = Row - Row % SampleInterval; Previous < Row; Previous++)
+	{
+		std::uint32_t Cells = 0;
+		for (int Word = 0; Word < OccupancyWords; Word++)
+		{
+			Cells += std::popcount(Occupancy[Previous * OccupancyWords + Word]);
+		}
+		NameIndex += CountBits(Named, CellIndex, Cells);
+		CellIndex += Cells;
+	}
+
+	OutMap.Seed = Seed;
+	OutMap.RuleSet = GeneratorRuleSet(Header.RuleSet);
+	for (int X = 0; X <= MapWidth; X++)
+	{
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			RoomArrayEntry& Cell = OutMap.Rooms[X][Y];
+			Cell = RoomArrayEntry{};
+			Cell.PosX = X;
+			Cell.PosY = Y;
+			Cell.RoomZone = Generator::GetMapZone(Y);
+		}
+	}
+
+	const std::uint64_t* GridTypes = Column(Block.GridTypes);
+	const std::uint64_t* RoomTypes = Column(Block.RoomTypes);
+	const std::uint64_t* Zones = Column(Block.Zones);
+	const std::uint64_t* Rotations = Column(Block.Rotations);
+	const std::uint64_t* NameIds = Column(Block.Names);
+	for (int Word = 0; Word < OccupancyWords; Word++)
+	{
+		for (std::uint64_t Bits = Occupancy[Row * OccupancyWords + Word]; Bits; Bits &= Bits - 1, CellIndex++)
+		{
+			const int Index = Word * 64 + std::countr_zero(Bits);
+			RoomArrayEntry& Cell = OutMap.Rooms[Index / (MapHeight + 1)][Index % (MapHeight + 1)];
+
+			const std::uint32_t GridType = ReadBits(GridTypes, CellIndex * GridTypeBits, GridTypeBits);
+			Cell.GridType = GridType == CheckpointCode ? 255 : int(GridType);
+			Cell.RoomType = RoomType(ReadBits(RoomTypes, CellIndex * RoomTypeBits, RoomTypeBits));
+			Cell.RoomZone = int(ReadBits(Zones, CellIndex * ZoneBits, ZoneBits));
+			Cell.RoomRotation = float(ReadBits(Rotations, CellIndex * RotationBits, RotationBits)) * 90.f;
+
+			if (ReadBits(Named, CellIndex, 1))
+			{
+				const std::uint32_t NameId = ReadBits(NameIds, NameIndex * Block.NameBits, int(Block.NameBits));
+				Cell.RoomName = NameId < Names.size() ? Names[NameId] : std::string();
+				NameIndex++;
+			}
+		}
+	}
+
+	UnpackReport(*reinterpret_cast<const std::uint64_t*>(BlockData + Block.Reports + sizeof(std::uint64_t) * Row), OutMap.Report);
+	return true;
+}
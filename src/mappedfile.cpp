@@ -0,0 +1,93 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const std::string& Path)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE File = CreateFileA(Path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (File == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	FileHandle = File;
+
+	LARGE_INTEGER FileSize;
+	if (!GetFileSizeEx(File, &FileSize) || FileSize.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+
+	Mapping = CreateFileMappingA(File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	Data = Mapping ? static_cast<const std::uint8_t*>(MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+	Size = size_t(FileSize.QuadPart);
+#else
+	int Descriptor = open(Path.c_str(), O_RDONLY);
+	if (Descriptor < 0)
+	{
+		return false;
+	}
+
+	struct stat Stat;
+	if (fstat(Descriptor, &Stat) != 0 || Stat.st_size == 0)
+	{
+		close(Descriptor);
+		return false;
+	}
+
+	void* Mapped = mmap(nullptr, size_t(Stat.st_size), PROT_READ, MAP_SHARED, Descriptor, 0);
+	close(Descriptor);
+	Data = Mapped == MAP_FAILED ? nullptr : static_cast<const std::uint8_t*>(Mapped);
+	Size = size_t(Stat.st_size);
+#endif
+
+	if (!Data)
+	{
+		Close();
+	}
+	return Data != nullptr;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (Data)
+	{
+		UnmapViewOfFile(Data);
+	}
+	if (Mapping)
+	{
+		CloseHandle(Mapping);
+	}
+	if (FileHandle)
+	{
+		CloseHandle(FileHandle);
+	}
+	Mapping = nullptr;
+	FileHandle = nullptr;
+#else
+	if (Data)
+	{
+		munmap(const_cast<std::uint8_t*>(Data), Size);
+	}
+#endif
+
+	Data = nullptr;
+	Size = 0;
+}
@@ -0,0 +1,161 @@
+#include "mappublisher.h"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <thread>
+#include <utility>
+
+/** Reclaimed buffers kept for the next maps, a generator publishing at a steady rate only needs one */
+static constexpr size_t MaxFreeBuffers = 2;
+
+MapSnapshot::MapSnapshot(MapSnapshot&& Other) noexcept
+	: Slot(std::exchange(Other.Slot, nullptr))
+	, Map(std::exchange(Other.Map, nullptr))
+{
+}
+
+MapSnapshot& MapSnapshot::operator=(MapSnapshot&& Other) noexcept
+{
+	if (this != &Other)
+	{
+		Release();
+		Slot = std::exchange(Other.Slot, nullptr);
+		Map = std::exchange(Other.Map, nullptr);
+	}
+	return *this;
+}
+
+MapSnapshot::~MapSnapshot()
+{
+	Release();
+}
+
+void MapSnapshot::Release()
+{
+	if (Slot)
+	{
+		// Everything read from the map happens before the publisher can see the slot free
+		Slot->store(0, std::memory_order_release);
+		Slot = nullptr;
+	}
+	Map = nullptr;
+}
+
+MapPublisher::MapPublisher() = default;
+
+MapPublisher::~MapPublisher()
+{
+	// Nobody can be reading any more, everything still around gets freed
+	delete Current.load(std::memory_order_relaxed);
+}
+
+MapSnapshot MapPublisher::Acquire() const
+{
+	// Threads start looking at different slots so they don't all fight over the first ones
+	const size_t Start = std::hash<std::thread::id>()(std::this_thread::get_id());
+	for (;;)
+	{
+		for (int i = 0; i < MaxReaders; i++)
+		{
+			std::atomic<std::uint64_t>& Slot = Readers[(Start + i) % MaxReaders].Epoch;
+			if (Slot.load(std::memory_order_relaxed) != 0)
+			{
+				continue;
+			}
+
+			// Marking the slot before loading the map means a publisher that doesn't see the mark has already swapped the map out
+			std::uint64_t Expected = 0;
+			if (Slot.compare_exchange_strong(Expected, Epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst))
+			{
+				return MapSnapshot(&Slot, Current.load(std::memory_order_seq_cst));
+			}
+		}
+
+		// Every slot is held by other readers
+		std::this_thread::yield();
+	}
+}
+
+void MapPublisher::Publish(const Generator& Gen)
+{
+	std::lock_guard<std::mutex> Lock(WriterMutex);
+	std::unique_ptr<GeneratedMap> Map = TakeBuffer();
+	Gen.CopyMap(*Map);
+	Swap(std::move(Map));
+}
+
+void MapPublisher::Publish(const GeneratedMap& Map)
+{
+	std::lock_guard<std::mutex> Lock(WriterMutex);
+	std::unique_ptr<GeneratedMap> Buffer = TakeBuffer();
+	*Buffer = Map;
+	Swap(std::move(Buffer));
+}
+
+int MapPublisher::GetRetiredCount() const
+{
+	std::lock_guard<std::mutex> Lock(WriterMutex);
+	return int(Retired.size());
+}
+
+std::unique_ptr<GeneratedMap> MapPublisher::TakeBuffer()
+{
+	Reclaim();
+	if (FreeBuffers.empty())
+	{
+		return std::make_unique<GeneratedMap>();
+	}
+
+	// Copying over an old map reuses its name strings, so publishing doesn't allocate once it's warmed up
+	std::unique_ptr<GeneratedMap> Map = std::move(FreeBuffers.back());
+	FreeBuffers.pop_back();
+	return Map;
+}
+
+void MapPublisher::Swap(std::unique_ptr<GeneratedMap> Map)
+{
+	GeneratedMap* Old = Current.exchange(Map.release(), std::memory_order_seq_cst);
+
+	// Readers that mark their slot from here on load the new map, only older marks can be holding Old
+	const std::uint64_t RetireEpoch = Epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+	PublishCount.fetch_add(1, std::memory_order_relaxed);
+
+	if (Old)
+	{
+		Retired.push_back({ std::unique_ptr<GeneratedMap>(Old), RetireEpoch });
+	}
+	Reclaim();
+}
+
+void MapPublisher::Reclaim()
+{
+	if (Retired.empty())
+	{
+		return;
+	}
+
+	std::uint64_t Oldest = std::numeric_limits<std::uint64_t>::max();
+	for (const ReaderSlot& Reader : Readers)
+	{
+		const std::uint64_t Marked = Reader.Epoch.load(std::memory_order_seq_cst);
+		if (Marked != 0)
+		{
+			Oldest = std::min(Oldest, Marked);
+		}
+	}
+
+	auto Keep = Retired.begin();
+	for (RetiredMap& Map : Retired)
+	{
+		if (Map.Epoch > Oldest)
+		{
+			*Keep++ = std::move(Map);
+		}
+		else if (FreeBuffers.size() < MaxFreeBuffers)
+		{
+			FreeBuffers.push_back(std::move(Map.Map));
+		}
+	}
+	Retired.erase(Keep, Retired.end());
+}
@@ -0,0 +1,307 @@
+#include "maprenderer.h"
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <string_view>
+
+static constexpr int CHECKPOINT = 255;
+
+MapRenderer::MapRenderer(MapRenderOptions InOptions)
+	: Options(InOptions)
+{
+}
+
+void MapRenderer::Render(Generator& Gen, std::string& OutText) const
+{
+	for (int X = 0; X <= MapWidth; X++)
+	{
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			RenderCell(Gen.GetDataAtCoordinate(X, Y), OutText);
+		}
+		OutText += '\n';
+	}
+}
+
+void MapRenderer::Print(Generator& Gen, std::FILE* File)
+{
+	Buffer.clear();
+	Render(Gen, Buffer);
+	std::fwrite(Buffer.data(), 1, Buffer.size(), File);
+}
+
+void MapRenderer::RenderCell(const RoomArrayEntry& Entry, std::string& OutText) const
+{
+	static constexpr const char* RoomTypeNames[] = { "--", "R1", "R2", "R2C", "R3", "R4" };
+
+	char Cell[16];
+	bool bFirstField = true;
+	auto Append = [&](const char* Text, int Length)
+	{
+		OutText += bFirstField ? ' ' : '/';
+		OutText.append(Text, Length);
+		bFirstField = false;
+	};
+
+	if (Options.Fields & RenderGridType)
+	{
+		Append(Cell, std::snprintf(Cell, sizeof(Cell), "%3d", Entry.GridType));
+	}
+
+	if (Options.Fields & RenderRoomType)
+	{
+		int Type = std::clamp(int(Entry.RoomType), 0, int(RoomType::Room4));
+		Append(Cell, std::snprintf(Cell, sizeof(Cell), "%-3s", RoomTypeNames[Type]));
+	}
+
+	if (Options.Fields & RenderZone)
+	{
+		Append(Cell, std::snprintf(Cell, sizeof(Cell), "%d", Entry.RoomZone));
+	}
+
+	if (Options.Fields & RenderRotation)
+	{
+		Append(Cell, std::snprintf(Cell, sizeof(Cell), "%3d", int(Entry.RoomRotation)));
+	}
+
+	if (Options.Fields & RenderName)
+	{
+		std::string_view Name = Entry.RoomName.empty() ? std::string_view(".") : std::string_view(Entry.RoomName);
+		int Length = std::min(int(Name.size()), Options.NameWidth);
+		Append(Name.data(), Length);
+		OutText.append(Options.NameWidth - Length, ' ');
+	}
+}
+
+MapAtlas::MapAtlas(int InColumns, int InCellSize)
+	: Columns(std::max(InColumns, 1))
+	, CellSize(std::max(InCellSize, 1))
+{
+}
+
+int MapAtlas::GetWidth() const
+{
+	return Columns * GetTileSize() + 1;
+}
+
+int MapAtlas::GetHeight() const
+{
+	int Rows = (MapCount + Columns - 1) / Columns;
+	return Rows * GetTileSize() + 1;
+}
+
+void MapAtlas::AddMap(Generator& Gen)
+{
+	std::uint8_t* Tile = AddTile();
+	for (int X = 0; X <= MapWidth; X++)
+	{
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			const RoomArrayEntry& Entry = Gen.GetDataAtCoordinate(X, Y);
+			FillCell(Tile, X, Y, Entry.GridType, Entry.RoomType);
+		}
+	}
+}
+
+void MapAtlas::AddLayout(const LayoutStageResult& Layout)
+{
+	std::uint8_t* Tile = AddTile();
+	for (int X = 0; X <= MapWidth; X++)
+	{
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			FillCell(Tile, X, Y, Layout.GridType[X][Y], RoomType(Layout.RoomTypes[X][Y]));
+		}
+	}
+}
+
+std::uint8_t* MapAtlas::AddTile()
+{
+	static constexpr std::uint8_t Gap = 40;
+
+	const int Width = GetWidth();
+	const int TileSize = GetTileSize();
+	const int Column = MapCount % Columns;
+	const int Row = MapCount / Columns;
+	MapCount++;
+
+	// Start a new row of tiles, the empty space stays the colour of the gaps between tiles
+	if (Column == 0)
+	{
+		Pixels.resize(size_t(GetHeight()) * Width * 3, Gap);
+	}
+
+	const int Left = Column * TileSize + 1;
+	const int Top = Row * TileSize + 1;
+	const int MapPixels = (MapWidth + 1) * CellSize;
+	for (int PixelY = Top; PixelY < Top + MapPixels; PixelY++)
+	{
+		std::fill_n(&Pixels[(size_t(PixelY) * Width + Left) * 3], MapPixels * 3, std::uint8_t(0));
+	}
+
+	return &Pixels[(size_t(Top) * Width + Left) * 3];
+}
+
+void MapAtlas::FillCell(std::uint8_t* Tile, int X, int Y, int GridType, RoomType Type)
+{
+	// LCZ, HCZ, EZ
+	static constexpr std::uint8_t ZoneColours[ZoneAmount][3] = { { 90, 160, 255 }, { 255, 140, 40 }, { 80, 220, 100 } };
+	// Unclassified, ROOM1, ROOM2, ROOM2C, ROOM3, ROOM4
+	static constexpr int ShapeShades[] = { 30, 45, 60, 75, 90, 100 };
+
+	if (GridType == 0)
+	{
+		return;
+	}
+
+	std::array<std::uint8_t, 3> Colour = { 255, 255, 255 };
+	if (GridType != CHECKPOINT)
+	{
+		int Zone = std::clamp(Generator::GetMapZone(Y), 0, ZoneAmount - 1);
+		int Shade = ShapeShades[std::clamp(int(Type), 0, int(RoomType::Room4))];
+		for (int Channel = 0; Channel < 3; Channel++)
+		{
+			Colour[Channel] = std::uint8_t(ZoneColours[Zone][Channel] * Shade / 100);
+		}
+	}
+
+	const int Width = GetWidth();
+	for (int PixelY = 0; PixelY < CellSize; PixelY++)
+	{
+		std::uint8_t* Pixel = Tile + (size_t(X * CellSize + PixelY) * Width + size_t(Y * CellSize)) * 3;
+		for (int PixelX = 0; PixelX < CellSize; PixelX++, Pixel += 3)
+		{
+			std::copy(Colour.begin(), Colour.end(), Pixel);
+		}
+	}
+}
+
+bool MapAtlas::WritePPM(const std::string& Path) const
+{
+	if (MapCount == 0)
+	{
+		return false;
+	}
+
+	std::ofstream File(Path, std::ios::binary);
+	if (!File)
+	{
+		return false;
+	}
+
+	File << "P6\n" << GetWidth() << " " << GetHeight() << "\n255\n";
+	File.write(reinterpret_cast<const char*>(Pixels.data()), std::streamsize(Pixels.size()));
+	return bool(File);
+}
+
+static std::uint32_t Crc32(const std::uint8_t* Data, size_t Size, std::uint32_t Crc = 0)
+{
+	static const std::array<std::uint32_t, 256> Table = []()
+	{
+		std::array<std::uint32_t, 256> Values{};
+		for (std::uint32_t i = 0; i < 256; i++)
+		{
+			std::uint32_t Value = i;
+			for (int Bit = 0; Bit < 8; Bit++)
+			{
+				Value = (Value & 1) ? 0xEDB88320u ^ (Value >> 1) : Value >> 1;
+			}
+			Values[i] = Value;
+		}
+		return Values;
+	}();
+
+	Crc = ~Crc;
+	for (size_t i = 0; i < Size; i++)
+	{
+		Crc = Table[(Crc ^ Data[i]) & 0xff] ^ (Crc >> 8);
+	}
+	return ~Crc;
+}
+
+static void AppendBigEndian(std::vector<std::uint8_t>& Out, std::uint32_t Value)
+{
+	Out.push_back(std::uint8_t(Value >> 24));
+	Out.push_back(std::uint8_t(Value >> 16));
+	Out.push_back(std::uint8_t(Value >> 8));
+	Out.push_back(std::uint8_t(Value));
+}
+
+static void AppendChunk(std::vector<std::uint8_t>& Out, const char* Type, const std::vector<std::uint8_t>& Data)
+{
+	AppendBigEndian(Out, std::uint32_t(Data.size()));
+	size_t TypeStart = Out.size();
+	Out.insert(Out.end(), Type, Type + 4);
+	Out.insert(Out.end(), Data.begin(), Data.end());
+	AppendBigEndian(Out, Crc32(&Out[TypeStart], Out.size() - TypeStart));
+}
+
+bool MapAtlas::WritePNG(const std::string& Path) const
+{
+	if (MapCount == 0)
+	{
+		return false;
+	}
+
+	const int Width = GetWidth();
+	const int Height = GetHeight();
+
+	std::vector<std::uint8_t> Png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+	std::vector<std::uint8_t> Header;
+	AppendBigEndian(Header, std::uint32_t(Width));
+	AppendBigEndian(Header, std::uint32_t(Height));
+	Header.insert(Header.end(), { 8, 2, 0, 0, 0 }); // 8 bit RGB, no interlacing
+	AppendChunk(Png, "IHDR", Header);
+
+	// Every row is prefixed with filter type 0 (none)
+	std::vector<std::uint8_t> Raw;
+	Raw.reserve(size_t(Height) * (size_t(Width) * 3 + 1));
+	for (int Row = 0; Row < Height; Row++)
+	{
+		Raw.push_back(0);
+		const std::uint8_t* RowStart = &Pixels[size_t(Row) * Width * 3];
+		Raw.insert(Raw.end(), RowStart, RowStart + size_t(Width) * 3);
+	}
+
+	// zlib stream made of stored deflate blocks
+	std::vector<std::uint8_t> Zlib = { 0x78, 0x01 };
+	std::uint32_t AdlerA = 1, AdlerB = 0;
+	for (size_t Offset = 0; Offset < Raw.size() || Offset == 0; )
+	{
+		std::uint16_t Length = std::uint16_t(std::min<size_t>(Raw.size() - Offset, 65535));
+		bool bFinal = Offset + Length >= Raw.size();
+		Zlib.push_back(bFinal ? 1 : 0);
+		Zlib.push_back(std::uint8_t(Length));
+		Zlib.push_back(std::uint8_t(Length >> 8));
+		Zlib.push_back(std::uint8_t(~Length));
+		Zlib.push_back(std::uint8_t(~Length >> 8));
+		Zlib.insert(Zlib.end(), Raw.begin() + Offset, Raw.begin() + Offset + Length);
+
+		for (size_t i = Offset; i < Offset + Length; i++)
+		{
+			AdlerA = (AdlerA + Raw[i]) % 65521;
+			AdlerB = (AdlerB + AdlerA) % 65521;
+		}
+
+		Offset += Length;
+		if (bFinal)
+		{
+			break;
+		}
+	}
+	AppendBigEndian(Zlib, (AdlerB << 16) | AdlerA);
+
+	AppendChunk(Png, "IDAT", Zlib);
+	AppendChunk(Png, "IEND", {});
+
+	std::ofstream File(Path, std::ios::binary);
+	if (!File)
+	{
+		return false;
+	}
+
+	File.write(reinterpret_cast<const char*>(Png.data()), std::streamsize(Png.size()));
+	return bool(File);
+}
@@ -0,0 +1,333 @@
+#include "mapvalidator.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+
+namespace
+{
+	constexpr int CheckpointGridType = 255;
+	constexpr std::uint32_t RowMask = (1u << (MapWidth + 1)) - 1;
+
+	using Rows = MapBitboards::Rows;
+
+	/** GetMapZone for every row, looked up once */
+	const std::array<int, MapHeight + 1> RowZones = []()
+	{
+		std::array<int, MapHeight + 1> Zones{};
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			Zones[Y] = Generator::GetMapZone(Y);
+		}
+		return Zones;
+	}();
+
+	/** Rooms a cell has next to it, bit sliced into a mask per count */
+	struct NeighbourCounts
+	{
+		std::uint32_t Count[5];
+
+		/** Two neighbours on opposite sides */
+		std::uint32_t Straight;
+	};
+
+	NeighbourCounts CountNeighbours(const Rows& Occupied, int Y)
+	{
+		const std::uint32_t Left = (Occupied[Y] << 1) & RowMask;
+		const std::uint32_t Right = Occupied[Y] >> 1;
+		const std::uint32_t Up = Y > 0 ? Occupied[Y - 1] : 0;
+		const std::uint32_t Down = Y < MapHeight ? Occupied[Y + 1] : 0;
+
+		// Adds the four one bit masks up into a three bit count
+		const std::uint32_t HorizontalCarry = Left & Right;
+		const std::uint32_t HorizontalSum = Left ^ Right;
+		const std::uint32_t VerticalCarry = Up & Down;
+		const std::uint32_t VerticalSum = Up ^ Down;
+		const std::uint32_t Ones = HorizontalSum ^ VerticalSum;
+		const std::uint32_t OnesCarry = HorizontalSum & VerticalSum;
+		const std::uint32_t Twos = HorizontalCarry ^ VerticalCarry ^ OnesCarry;
+		const std::uint32_t Fours = (HorizontalCarry & VerticalCarry) | ((HorizontalCarry ^ VerticalCarry) & OnesCarry);
+
+		NeighbourCounts Counts;
+		Counts.Count[0] = RowMask & ~(Ones | Twos | Fours);
+		Counts.Count[1] = Ones & ~Twos & ~Fours;
+		Counts.Count[2] = ~Ones & Twos & ~Fours;
+		Counts.Count[3] = Ones & Twos;
+		Counts.Count[4] = Fours;
+		Counts.Straight = HorizontalCarry | VerticalCarry;
+		return Counts;
+	}
+
+	/** Adds a violation for the first bit set in Bad, returns false if there is none */
+	bool ReportFirstCell(const Rows& Bad, int Seed, GenerationStage Stage, MapInvariant Invariant, std::vector<MapViolation>& OutViolations)
+	{
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			if (Bad[Y] != 0)
+			{
+				OutViolations.push_back({ Seed, Stage, Invariant, std::countr_zero(Bad[Y]), Y, RowZones[Y] });
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/** Grows Seeds to the whole runs of Mask they're in, a fixed number of shifts whatever the run lengths */
+	std::uint32_t FillRuns(std::uint32_t Seeds, std::uint32_t Mask)
+	{
+		std::uint32_t Up = Seeds;
+		std::uint32_t Down = Seeds;
+		std::uint32_t UpMask = Mask;
+		std::uint32_t DownMask = Mask;
+		for (int Shift = 1; Shift <= 16; Shift <<= 1)
+		{
+			Up |= UpMask & (Up << Shift);
+			Down |= DownMask & (Down >> Shift);
+			UpMask &= UpMask << Shift;
+			DownMask &= DownMask >> Shift;
+		}
+		return Up | Down;
+	}
+
+	/** Occupied cells that can't be reached from the first one */
+	Rows FindUnreachable(const Rows& Occupied)
+	{
+		Rows Reached{};
+
+		// Rows whose neighbours changed since they were last filled. Only those get looked at again, so long hallways that go up and back down cost a few
+		// extra rows rather than extra passes over the whole map
+		constexpr std::uint32_t AllRows = (1u << (MapHeight + 1)) - 1;
+		auto GetNeighbourRows = [](int Y) { return ((1u << Y) >> 1 | (1u << Y) << 1) & AllRows; };
+
+		std::uint32_t Pending = 0;
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			if (Occupied[Y] != 0)
+			{
+				Reached[Y] = FillRuns(Occupied[Y] & (~Occupied[Y] + 1), Occupied[Y]);
+				Pending = GetNeighbourRows(Y);
+				break;
+			}
+		}
+
+		while (Pending != 0)
+		{
+			const int Y = std::countr_zero(Pending);
+			Pending &= Pending - 1;
+
+			// Cells the rows above and below reach into that this row hasn't got yet
+			std::uint32_t Seeds = Y > 0 ? Reached[Y - 1] : 0;
+			Seeds |= Y < MapHeight ? Reached[Y + 1] : 0;
+			Seeds &= Occupied[Y] & ~Reached[Y];
+			if (Seeds != 0)
+			{
+				Reached[Y] |= FillRuns(Seeds, Occupied[Y]);
+				Pending |= GetNeighbourRows(Y);
+			}
+		}
+
+		Rows Unreachable;
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			Unreachable[Y] = Occupied[Y] & ~Reached[Y];
+		}
+		return Unreachable;
+	}
+}
+
+void MapBitboards::Build(const RoomGrid& Rooms)
+{
+	*this = {};
+
+	// No branches on the cell contents, which are about as predictable as the seed
+	for (int X = 0; X <= MapWidth; X++)
+	{
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			const RoomArrayEntry& Entry = Rooms[X][Y];
+			const std::uint32_t Bit = std::uint32_t(Entry.GridType != 0) << X;
+
+			Occupied[Y] |= Bit;
+			Checkpoints[Y] |= std::uint32_t(Entry.GridType == CheckpointGridType) << X;
+			GridTypes[GetGridTypePlane(Entry.GridType)][Y] |= Bit;
+			RoomTypes[GetRoomTypePlane(Entry.RoomType)][Y] |= Bit;
+		}
+	}
+}
+
+unsigned MapValidator::GetInvariantsAfter(GenerationStage Stage)
+{
+	unsigned Invariants = InvariantInBounds | InvariantConnected | InvariantZoneCheckpoints;
+
+	// Grid types are only neighbour counts once classification has replaced the hallway markers
+	if (Stage >= GenerationStage::Classification)
+	{
+		Invariants |= InvariantNeighbourCount | InvariantRoomShape;
+	}
+
+	if (Stage >= GenerationStage::ForceRoom4sAndRoom2Cs)
+	{
+		Invariants |= InvariantRoom4PerZone | InvariantRoom2CPerZone;
+	}
+
+	return Invariants;
+}
+
+void MapValidator::Validate(const MapBitboards& Boards, const GenerationReport& Report, int Seed, GenerationStage Stage, unsigned Invariants,
+	std::vector<MapViolation>& OutViolations)
+{
+	if ((Invariants & InvariantInBounds) && Report.OutOfBoundsWrites > 0)
+	{
+		OutViolations.push_back({ Seed, Stage, InvariantInBounds });
+	}
+
+	if (!(Invariants & ~InvariantInBounds))
+	{
+		return;
+	}
+
+	if (Invariants & InvariantConnected)
+	{
+		ReportFirstCell(FindUnreachable(Boards.Occupied), Seed, Stage, InvariantConnected, OutViolations);
+	}
+
+	if (Invariants & InvariantZoneCheckpoints)
+	{
+		Rows Bad{};
+		int MissingRow = -1;
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			const bool bBoundary = Y < MapHeight && RowZones[Y] != RowZones[Y + 1];
+			if (!bBoundary)
+			{
+				Bad[Y] = Boards.Checkpoints[Y];
+				continue;
+			}
+
+			// A checkpoint sits on the last row of the zone, with the next zone below it
+			Bad[Y] = Boards.Occupied[Y] & Boards.Occupied[Y + 1] & ~Boards.Checkpoints[Y];
+			if (Boards.Checkpoints[Y] == 0 && MissingRow < 0)
+			{
+				MissingRow = Y;
+			}
+		}
+
+		if (!ReportFirstCell(Bad, Seed, Stage, InvariantZoneCheckpoints, OutViolations) && MissingRow >= 0)
+		{
+			OutViolations.push_back({ Seed, Stage, InvariantZoneCheckpoints, -1, MissingRow, RowZones[MissingRow] });
+		}
+	}
+
+	if (Invariants & (InvariantNeighbourCount | InvariantRoomShape))
+	{
+		Rows BadCount{};
+		Rows BadShape{};
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			const NeighbourCounts Counts = CountNeighbours(Boards.Occupied, Y);
+			const std::uint32_t RoomCells = Boards.Occupied[Y] & ~Boards.Checkpoints[Y];
+
+			std::uint32_t Matching = 0;
+			for (int Count = 1; Count <= 4; Count++)
+			{
+				Matching |= Boards.GridTypes[Count][Y] & Counts.Count[Count];
+			}
+			BadCount[Y] = RoomCells & ~Matching;
+
+			const Rows* Types = Boards.RoomTypes;
+			const std::uint32_t Shaped = (Types[RoomType::Room1][Y] & Counts.Count[1]) | (Types[RoomType::Room2][Y] & Counts.Count[2] & Counts.Straight) |
+				(Types[RoomType::Room2C][Y] & Counts.Count[2] & ~Counts.Straight) | (Types[RoomType::Room3][Y] & Counts.Count[3]) |
+				(Types[RoomType::Room4][Y] & Counts.Count[4]);
+			BadShape[Y] = RoomCells & ~Shaped;
+		}
+
+		if (Invariants & InvariantNeighbourCount)
+		{
+			ReportFirstCell(BadCount, Seed, Stage, InvariantNeighbourCount, OutViolations);
+		}
+		if (Invariants & InvariantRoomShape)
+		{
+			ReportFirstCell(BadShape, Seed, Stage, InvariantRoomShape, OutViolations);
+		}
+	}
+
+	if (Invariants & (InvariantRoom4PerZone | InvariantRoom2CPerZone))
+	{
+		bool bHasRoom4[ZoneAmount]{};
+		bool bHasRoom2C[ZoneAmount]{};
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			const int Zone = RowZones[Y];
+			const std::uint32_t RoomCells = Boards.Occupied[Y] & ~Boards.Checkpoints[Y];
+			bHasRoom4[Zone] |= (Boards.RoomTypes[RoomType::Room4][Y] & RoomCells) != 0;
+			bHasRoom2C[Zone] |= (Boards.RoomTypes[RoomType::Room2C][Y] & RoomCells) != 0;
+		}
+
+		for (int Zone = 0; Zone < ZoneAmount; Zone++)
+		{
+			if ((Invariants & InvariantRoom4PerZone) && !bHasRoom4[Zone] && !Report.bRoom4ForceFailed[Zone])
+			{
+				OutViolations.push_back({ Seed, Stage, InvariantRoom4PerZone, -1, -1, Zone });
+				Invariants &= ~InvariantRoom4PerZone;
+			}
+			if ((Invariants & InvariantRoom2CPerZone) && !bHasRoom2C[Zone] && !Report.bRoom2CForceFailed[Zone])
+			{
+				OutViolations.push_back({ Seed, Stage, InvariantRoom2CPerZone, -1, -1, Zone });
+				Invariants &= ~InvariantRoom2CPerZone;
+			}
+		}
+	}
+}
+
+void MapValidator::Validate(const GeneratedMap& Map, unsigned Invariants, std::vector<MapViolation>& OutViolations)
+{
+	MapBitboards Boards;
+	Boards.Build(Map.Rooms);
+	Validate(Boards, Map.Report, Map.Seed, GenerationStage::Done, Invariants, OutViolations);
+}
+
+const char* MapValidator::GetInvariantName(MapInvariant Invariant)
+{
+	switch (Invariant)
+	{
+	case InvariantInBounds:
+		return "InBounds";
+	case InvariantConnected:
+		return "Connected";
+	case InvariantZoneCheckpoints:
+		return "ZoneCheckpoints";
+	case InvariantNeighbourCount:
+		return "NeighbourCount";
+	case InvariantRoomShape:
+		return "RoomShape";
+	case InvariantRoom4PerZone:
+		return "Room4PerZone";
+	case InvariantRoom2CPerZone:
+		return "Room2CPerZone";
+	default:
+		return "Unknown";
+	}
+}
+
+const char* MapValidator::GetStageName(GenerationStage Stage)
+{
+	switch (Stage)
+	{
+	case GenerationStage::Layout:
+		return "Layout";
+	case GenerationStage::Classification:
+		return "Classification";
+	case GenerationStage::ForceRoom1s:
+		return "ForceRoom1s";
+	case GenerationStage::ForceRoom4sAndRoom2Cs:
+		return "ForceRoom4sAndRoom2Cs";
+	case GenerationStage::PredefinedRooms:
+		return "PredefinedRooms";
+	case GenerationStage::AssignRooms:
+		return "AssignRooms";
+	case GenerationStage::Done:
+		return "Done";
+	default:
+		return "Unknown";
+	}
+}
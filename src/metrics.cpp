@@ -0,0 +1,301 @@
+#include "metrics.h"
+#include "mapvalidator.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+	struct CounterInfo
+	{
+		const char* Name;
+		const char* Help;
+	};
+
+	constexpr CounterInfo CounterInfos[MetricCounterCount] = {
+		{ "maps_generated", "Maps generated all the way through AssignRooms" },
+		{ "stage_cache_hits", "Layouts read back from a StageCache" },
+		{ "stage_cache_misses", "Layouts looked for in a StageCache and not found" },
+		{ "forced_placements", "Rooms the forcing passes had to add" },
+		{ "forced_placement_failures", "Zones the forcing passes couldn't fit their ROOM4 or ROOM2C into" },
+		{ "set_room_failures", "Predefined rooms SetRoom couldn't find a slot for" },
+	};
+
+	constexpr double Quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+	const char* GetLatencyName(int Latency)
+	{
+		return Latency == MapLatency ? "Map" : MapValidator::GetStageName(GenerationStage(Latency));
+	}
+
+	/** Only the thread that owns a shard writes to it, so a plain load and store is enough and there's no locked instruction */
+	void AddOwned(std::atomic<std::uint64_t>& Value, std::uint64_t Amount)
+	{
+		Value.store(Value.load(std::memory_order_relaxed) + Amount, std::memory_order_relaxed);
+	}
+
+	void Append(std::string& Text, const char* Format, auto... Arguments)
+	{
+		char Line[256];
+		const int Length = std::snprintf(Line, sizeof(Line), Format, Arguments...);
+		Text.append(Line, std::min<size_t>(size_t(std::max(Length, 0)), sizeof(Line) - 1));
+	}
+}
+
+int LatencyHistogram::GetBucket(std::uint64_t Value)
+{
+	if (Value >> MaxValueBits)
+	{
+		return BucketCount - 1;
+	}
+
+	const int Shift = std::max(0, int(std::bit_width(Value)) - (SubBucketBits + 1));
+	return (Shift << SubBucketBits) + int(Value >> Shift);
+}
+
+std::uint64_t LatencyHistogram::GetBucketLowest(int Bucket)
+{
+	const int Shift = std::max(0, (Bucket >> SubBucketBits) - 1);
+	return std::uint64_t(Bucket - (Shift << SubBucketBits)) << Shift;
+}
+
+std::uint64_t LatencyHistogram::GetBucketHighest(int Bucket)
+{
+	const int Shift = std::max(0, (Bucket >> SubBucketBits) - 1);
+	return GetBucketLowest(Bucket) + (std::uint64_t(1) << Shift) - 1;
+}
+
+void LatencyHistogram::Add(std::uint64_t Value, std::uint64_t InCount)
+{
+	Buckets[GetBucket(Value)] += InCount;
+	Count += InCount;
+	Sum += Value * InCount;
+	Max = std::max(Max, Value);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& Other)
+{
+	for (int i = 0; i < BucketCount; i++)
+	{
+		Buckets[i] += Other.Buckets[i];
+	}
+	Count += Other.Count;
+	Sum += Other.Sum;
+	Max = std::max(Max, Other.Max);
+}
+
+std::uint64_t LatencyHistogram::GetPercentile(double Fraction) const
+{
+	if (Count == 0)
+	{
+		return 0;
+	}
+
+	const std::uint64_t Rank = std::clamp<std::uint64_t>(std::uint64_t(std::ceil(Fraction * double(Count))), 1, Count);
+	std::uint64_t Seen = 0;
+	for (int i = 0; i < BucketCount; i++)
+	{
+		Seen += Buckets[i];
+		if (Seen >= Rank)
+		{
+			return std::min(GetBucketHighest(i), Max);
+		}
+	}
+	return Max;
+}
+
+std::string MetricsSnapshot::FormatPrometheus() const
+{
+	std::string Text;
+	for (int i = 0; i < MetricCounterCount; i++)
+	{
+		Append(Text, "# HELP scproomgen_%s_total %s.\n", CounterInfos[i].Name, CounterInfos[i].Help);
+		Append(Text, "# TYPE scproomgen_%s_total counter\n", CounterInfos[i].Name);
+		Append(Text, "scproomgen_%s_total %llu\n", CounterInfos[i].Name, (unsigned long long)Counters[i]);
+	}
+
+	Text += "# HELP scproomgen_stage_duration_seconds Time spent in each generation stage.\n";
+	Text += "# TYPE scproomgen_stage_duration_seconds summary\n";
+	for (int Latency = 0; Latency < MetricLatencyCount; Latency++)
+	{
+		if (Latency == MapLatency)
+		{
+			Text += "# HELP scproomgen_map_duration_seconds Time spent generating a whole map.\n";
+			Text += "# TYPE scproomgen_map_duration_seconds summary\n";
+		}
+
+		const LatencyHistogram& Histogram = Latencies[Latency];
+		const char* Metric = Latency == MapLatency ? "scproomgen_map_duration_seconds" : "scproomgen_stage_duration_seconds";
+		char Labels[64];
+		std::snprintf(Labels, sizeof(Labels), Latency == MapLatency ? "" : "stage=\"%s\",", GetLatencyName(Latency));
+
+		for (double Quantile : Quantiles)
+		{
+			Append(Text, "%s{%squantile=\"%g\"} %.9g\n", Metric, Labels, Quantile, double(Histogram.GetPercentile(Quantile)) * 1e-9);
+		}
+
+		// The labels without their trailing comma
+		const std::string Suffix = Labels[0] ? "{" + std::string(Labels, std::strlen(Labels) - 1) + "}" : "";
+		Append(Text, "%s_sum%s %.9g\n", Metric, Suffix.c_str(), double(Histogram.GetSum()) * 1e-9);
+		Append(Text, "%s_count%s %llu\n", Metric, Suffix.c_str(), (unsigned long long)Histogram.GetCount());
+	}
+	return Text;
+}
+
+std::string MetricsSnapshot::FormatJson() const
+{
+	std::string Text = "{\"counters\":{";
+	for (int i = 0; i < MetricCounterCount; i++)
+	{
+		Append(Text, "%s\"%s\":%llu", i ? "," : "", CounterInfos[i].Name, (unsigned long long)Counters[i]);
+	}
+
+	Text += "},\"latencies_ns\":{";
+	for (int Latency = 0; Latency < MetricLatencyCount; Latency++)
+	{
+		const LatencyHistogram& Histogram = Latencies[Latency];
+		Append(Text, "%s\"%s\":{\"count\":%llu,\"sum\":%llu,\"max\":%llu", Latency ? "," : "", GetLatencyName(Latency),
+			(unsigned long long)Histogram.GetCount(), (unsigned long long)Histogram.GetSum(), (unsigned long long)Histogram.GetMax());
+		Append(Text, ",\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu}", (unsigned long long)Histogram.GetPercentile(0.5),
+			(unsigned long long)Histogram.GetPercentile(0.9), (unsigned long long)Histogram.GetPercentile(0.99), (unsigned long long)Histogram.GetPercentile(0.999));
+	}
+	Text += "}}";
+	return Text;
+}
+
+struct Metrics::Shard
+{
+	/** Set while a thread owns the shard */
+	std::atomic<bool> bInUse = false;
+
+	std::atomic<std::uint64_t> Counters[MetricCounterCount]{};
+
+	struct Latency
+	{
+		std::atomic<std::uint64_t> Buckets[LatencyHistogram::BucketCount]{};
+		std::atomic<std::uint64_t> Sum = 0;
+		std::atomic<std::uint64_t> Max = 0;
+	};
+	Latency Latencies[MetricLatencyCount];
+};
+
+Metrics& Metrics::Get()
+{
+	static Metrics Instance;
+	return Instance;
+}
+
+Metrics::Metrics() = default;
+Metrics::~Metrics() = default;
+
+void Metrics::Count(MetricCounter Counter, std::uint64_t Amount)
+{
+	if (Shard* Owned = GetThreadShard())
+	{
+		AddOwned(Owned->Counters[Counter], Amount);
+	}
+}
+
+void Metrics::RecordLatency(int Latency, std::uint64_t Nanoseconds)
+{
+	Shard* Owned = GetThreadShard();
+	if (!Owned)
+	{
+		return;
+	}
+
+	Shard::Latency& Histogram = Owned->Latencies[Latency];
+	AddOwned(Histogram.Buckets[LatencyHistogram::GetBucket(Nanoseconds)], 1);
+	AddOwned(Histogram.Sum, Nanoseconds);
+	if (Nanoseconds > Histogram.Max.load(std::memory_order_relaxed))
+	{
+		Histogram.Max.store(Nanoseconds, std::memory_order_relaxed);
+	}
+}
+
+MetricsSnapshot Metrics::Snapshot() const
+{
+	// Shards keep being written while they're read, each number is as of some moment during the read
+	MetricsSnapshot Result;
+	const int Count = ShardCount.load(std::memory_order_acquire);
+	for (int i = 0; i < Count; i++)
+	{
+		const Shard& Read = *Shards[i];
+		for (int Counter = 0; Counter < MetricCounterCount; Counter++)
+		{
+			Result.Counters[Counter] += Read.Counters[Counter].load(std::memory_order_relaxed);
+		}
+
+		for (int Latency = 0; Latency < MetricLatencyCount; Latency++)
+		{
+			LatencyHistogram& Histogram = Result.Latencies[Latency];
+			for (int Bucket = 0; Bucket < LatencyHistogram::BucketCount; Bucket++)
+			{
+				const std::uint64_t Samples = Read.Latencies[Latency].Buckets[Bucket].load(std::memory_order_relaxed);
+				Histogram.Buckets[Bucket] += Samples;
+				Histogram.Count += Samples;
+			}
+			Histogram.Sum += Read.Latencies[Latency].Sum.load(std::memory_order_relaxed);
+			Histogram.Max = std::max(Histogram.Max, Read.Latencies[Latency].Max.load(std::memory_order_relaxed));
+		}
+	}
+	return Result;
+}
+
+Metrics::Shard* Metrics::GetThreadShard()
+{
+	/** Gives the shard back when the thread exits, the next thread to take it carries on adding to it */
+	struct ShardOwner
+	{
+		Shard* Owned = nullptr;
+
+		~ShardOwner()
+		{
+			if (Owned)
+			{
+				Owned->bInUse.store(false, std::memory_order_release);
+			}
+		}
+	};
+
+	thread_local ShardOwner Owner;
+	if (!Owner.Owned)
+	{
+		Owner.Owned = AcquireShard();
+	}
+	return Owner.Owned;
+}
+
+Metrics::Shard* Metrics::AcquireShard()
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+
+	const int Count = ShardCount.load(std::memory_order_relaxed);
+	for (int i = 0; i < Count; i++)
+	{
+		bool bExpected = false;
+		if (Shards[i]->bInUse.compare_exchange_strong(bExpected, true, std::memory_order_acquire))
+		{
+			return Shards[i].get();
+		}
+	}
+
+	if (Count == MaxShards)
+	{
+		return nullptr;
+	}
+
+	Shards[Count] = std::make_unique<Shard>();
+	Shards[Count]->bInUse.store(true, std::memory_order_relaxed);
+	ShardCount.store(Count + 1, std::memory_order_release);
+	return Shards[Count].get();
+}
+
+std::uint64_t GetMetricsClock()
+{
+	return std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
@@ -0,0 +1,257 @@
+#include "perfcounters.h"
+#include "exactmath.h"
+#include "mapvalidator.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	std::uint64_t GetNanoseconds()
+	{
+		return std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+#if defined(__linux__)
+	int OpenCounter(std::uint32_t Type, std::uint64_t Config)
+	{
+		perf_event_attr Attributes;
+		std::memset(&Attributes, 0, sizeof(Attributes));
+		Attributes.size = sizeof(Attributes);
+		Attributes.type = Type;
+		Attributes.config = Config;
+		Attributes.exclude_kernel = 1;
+		Attributes.exclude_hv = 1;
+		Attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		return int(syscall(SYS_perf_event_open, &Attributes, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+	}
+
+	constexpr std::uint64_t GetCacheMissConfig(std::uint64_t Cache)
+	{
+		return Cache | (std::uint64_t(PERF_COUNT_HW_CACHE_OP_READ) << 8) | (std::uint64_t(PERF_COUNT_HW_CACHE_RESULT_MISS) << 16);
+	}
+#endif
+}
+
+void PerfSample::Add(const PerfSample& Other)
+{
+	Nanoseconds += Other.Nanoseconds;
+	for (int i = 0; i < PerfCounterCount; i++)
+	{
+		Counters[i] += Other.Counters[i];
+	}
+}
+
+PerfSample PerfSample::Delta(const PerfSample& Start, const PerfSample& End)
+{
+	// Scaled counters can step back a little when a counter gets rescheduled, that's noise rather than a wrap
+	PerfSample Result;
+	Result.Nanoseconds = End.Nanoseconds - Start.Nanoseconds;
+	for (int i = 0; i < PerfCounterCount; i++)
+	{
+		Result.Counters[i] = End.Counters[i] > Start.Counters[i] ? End.Counters[i] - Start.Counters[i] : 0;
+	}
+	return Result;
+}
+
+PerfCounters::PerfCounters()
+{
+	for (int& Descriptor : Descriptors)
+	{
+		Descriptor = -1;
+	}
+
+#if defined(__linux__)
+	Descriptors[PerfCycles] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	Descriptors[PerfInstructions] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	Descriptors[PerfBranches] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS);
+	Descriptors[PerfBranchMisses] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+	Descriptors[PerfL1DMisses] = OpenCounter(PERF_TYPE_HW_CACHE, GetCacheMissConfig(PERF_COUNT_HW_CACHE_L1D));
+	Descriptors[PerfLLCMisses] = OpenCounter(PERF_TYPE_HW_CACHE, GetCacheMissConfig(PERF_COUNT_HW_CACHE_LL));
+#endif
+
+	for (int i = 0; i < PerfCounterCount; i++)
+	{
+		Available |= unsigned(Descriptors[i] >= 0) << i;
+	}
+}
+
+PerfCounters::~PerfCounters()
+{
+#if defined(__linux__)
+	for (int Descriptor : Descriptors)
+	{
+		if (Descriptor >= 0)
+		{
+			close(Descriptor);
+		}
+	}
+#endif
+}
+
+void PerfCounters::Read(PerfSample& OutSample) const
+{
+	OutSample = {};
+
+#if defined(__linux__)
+	for (int i = 0; i < PerfCounterCount; i++)
+	{
+		// Value, time enabled, time running
+		std::uint64_t Values[3] = {};
+		if (Descriptors[i] < 0 || read(Descriptors[i], Values, sizeof(Values)) != ssize_t(sizeof(Values)) || Values[2] == 0)
+		{
+			continue;
+		}
+
+		OutSample.Counters[i] = Values[1] == Values[2] ? Values[0] : std::uint64_t(double(Values[0]) * double(Values[1]) / double(Values[2]));
+	}
+#endif
+
+	OutSample.Nanoseconds = GetNanoseconds();
+}
+
+double ProfileEntry::GetIPC() const
+{
+	return Totals.Counters[PerfCycles] ? double(Totals.Counters[PerfInstructions]) / double(Totals.Counters[PerfCycles]) : 0.0;
+}
+
+double ProfileEntry::GetBranchMissRate() const
+{
+	return Totals.Counters[PerfBranches] ? double(Totals.Counters[PerfBranchMisses]) / double(Totals.Counters[PerfBranches]) : 0.0;
+}
+
+double ProfileEntry::GetMissesPerKiloInstruction(PerfCounter Counter) const
+{
+	return Totals.Counters[PerfInstructions] ? double(Totals.Counters[Counter]) * 1000.0 / double(Totals.Counters[PerfInstructions]) : 0.0;
+}
+
+void ProfileEntry::Merge(const ProfileEntry& Other)
+{
+	Count += Other.Count;
+	Totals.Add(Other.Totals);
+}
+
+GenerationProfiler::GenerationProfiler(int InSeedsPerBucket)
+	: SeedsPerBucket(InSeedsPerBucket > 0 ? InSeedsPerBucket : 1)
+{
+}
+
+GenerationProfiler::~GenerationProfiler() = default;
+
+void GenerationProfiler::BeginStage()
+{
+	// Opened on first use rather than in the constructor, so the counters follow the thread that generates
+	if (!Counters)
+	{
+		Counters = std::make_unique<PerfCounters>();
+		Available = Counters->GetAvailable();
+	}
+
+	Counters->Read(StageStart);
+}
+
+void GenerationProfiler::EndStage(int Seed, GenerationStage Stage)
+{
+	PerfSample StageEnd;
+	Counters->Read(StageEnd);
+	const PerfSample Delta = PerfSample::Delta(StageStart, StageEnd);
+
+	ProfileEntry& StageEntry = Stages[int(Stage)];
+	StageEntry.Count++;
+	StageEntry.Totals.Add(Delta);
+
+	// Any stage that doesn't follow the previous one of the same seed starts another map
+	ProfileEntry& Bucket = Buckets[std::int64_t(ExactMath::FloorDiv(Seed, SeedsPerBucket)) * SeedsPerBucket];
+	Bucket.Count += Seed != LastSeed || Stage <= LastStage;
+	Bucket.Totals.Add(Delta);
+	LastSeed = Seed;
+	LastStage = Stage;
+}
+
+void GenerationProfiler::Merge(const GenerationProfiler& Other)
+{
+	const bool bEmpty = Buckets.empty();
+	if (Other.Buckets.empty())
+	{
+		return;
+	}
+
+	// Only counters every part had can be trusted in the total
+	Available = bEmpty ? Other.Available : Available & Other.Available;
+
+	for (int i = 0; i < int(GenerationStage::Done); i++)
+	{
+		Stages[i].Merge(Other.Stages[i]);
+	}
+
+	for (const auto& [FirstSeed, Entry] : Other.Buckets)
+	{
+		Buckets[FirstSeed].Merge(Entry);
+	}
+}
+
+std::string GenerationProfiler::FormatReport() const
+{
+	std::string Report;
+	char Line[256];
+
+	auto AppendEntry = [&](const char* Name, const ProfileEntry& Entry)
+	{
+		const double PerCount = Entry.Count ? 1.0 / double(Entry.Count) : 0.0;
+		std::snprintf(Line, sizeof(Line), "%-24s %10llu %12.3f", Name, (unsigned long long)Entry.Count, double(Entry.Totals.Nanoseconds) * PerCount / 1000.0);
+		Report += Line;
+
+		auto AppendCounter = [&](unsigned Needed, const char* Format, double Value)
+		{
+			if ((Available & Needed) == Needed)
+			{
+				std::snprintf(Line, sizeof(Line), Format, Value);
+			}
+			else
+			{
+				std::snprintf(Line, sizeof(Line), " %12s", "n/a");
+			}
+			Report += Line;
+		};
+
+		AppendCounter(1u << PerfCycles, " %12.0f", double(Entry.Totals.Counters[PerfCycles]) * PerCount);
+		AppendCounter((1u << PerfCycles) | (1u << PerfInstructions), " %12.2f", Entry.GetIPC());
+		AppendCounter((1u << PerfBranches) | (1u << PerfBranchMisses), " %11.2f%%", Entry.GetBranchMissRate() * 100.0);
+		AppendCounter((1u << PerfInstructions) | (1u << PerfL1DMisses), " %12.2f", Entry.GetMissesPerKiloInstruction(PerfL1DMisses));
+		AppendCounter((1u << PerfInstructions) | (1u << PerfLLCMisses), " %12.2f", Entry.GetMissesPerKiloInstruction(PerfLLCMisses));
+		Report += "\n";
+	};
+
+	const char* Header = "%-24s %10s %12s %12s %12s %12s %12s %12s\n";
+	std::snprintf(Line, sizeof(Line), Header, "Stage", "Runs", "us/run", "cycles/run", "IPC", "branch miss", "L1D MPKI", "LLC MPKI");
+	Report += Line;
+	for (int i = 0; i < int(GenerationStage::Done); i++)
+	{
+		AppendEntry(MapValidator::GetStageName(GenerationStage(i)), Stages[i]);
+	}
+
+	Report += "\n";
+	std::snprintf(Line, sizeof(Line), Header, "Seeds", "Maps", "us/map", "cycles/map", "IPC", "branch miss", "L1D MPKI", "LLC MPKI");
+	Report += Line;
+	for (const auto& [FirstSeed, Entry] : Buckets)
+	{
+		char Name[64];
+		std::snprintf(Name, sizeof(Name), "%lld-%lld", (long long)FirstSeed, (long long)(FirstSeed + SeedsPerBucket - 1));
+		AppendEntry(Name, Entry);
+	}
+
+	if (Available == 0)
+	{
+		Report += "Hardware counters aren't available here (perf_event_open failed), only wall-clock times were recorded\n";
+	}
+
+	return Report;
+}
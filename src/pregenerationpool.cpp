@@ -0,0 +1,251 @@
+#include "pregenerationpool.h"
+
+#include <algorithm>
+
+PregenerationPool::PregenerationPool(PregenerationPoolOptions InOptions)
+	: Options(std::move(InOptions))
+	, RandomEngine(std::random_device{}())
+{
+	const int ThreadCount = std::max(Options.ThreadCount, 1);
+	for (int i = 0; i < ThreadCount; i++)
+	{
+		Threads.emplace_back(&PregenerationPool::Run, this);
+	}
+}
+
+PregenerationPool::~PregenerationPool()
+{
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		bStopping = true;
+	}
+	WorkAvailable.notify_all();
+
+	for (std::thread& Thread : Threads)
+	{
+		Thread.join();
+	}
+}
+
+std::unique_ptr<GeneratedMap> PregenerationPool::TakeRandom()
+{
+	std::unique_lock<std::mutex> Lock(Mutex);
+	if (!RandomMaps.empty())
+	{
+		std::unique_ptr<GeneratedMap> Map = std::move(RandomMaps.front());
+		RandomMaps.pop_front();
+		Stats.RandomHits++;
+
+		Lock.unlock();
+		WorkAvailable.notify_one();
+		return Map;
+	}
+
+	Stats.RandomMisses++;
+	const int Seed = NextRandomSeed();
+	Lock.unlock();
+
+	Generator Gen(false, Options.RuleSet);
+	return Generate(Gen, Seed);
+}
+
+void PregenerationPool::Announce(int Seed)
+{
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		if (Announced.count(Seed))
+		{
+			return;
+		}
+
+		if (int(Announced.size()) >= Options.AnnouncedCapacity)
+		{
+			// Forget the oldest seed, unless every one of them is being generated right now
+			auto Oldest = std::find_if(AnnouncedOrder.begin(), AnnouncedOrder.end(), [&](int Other) { return !Announced[Other].bGenerating; });
+			if (Oldest != AnnouncedOrder.end())
+			{
+				Announced.erase(*Oldest);
+				AnnouncedOrder.erase(Oldest);
+			}
+		}
+
+		Announced[Seed] = {};
+		AnnouncedOrder.push_back(Seed);
+	}
+	WorkAvailable.notify_one();
+}
+
+void PregenerationPool::Withdraw(int Seed)
+{
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		Announced.erase(Seed);
+		AnnouncedOrder.erase(std::remove(AnnouncedOrder.begin(), AnnouncedOrder.end(), Seed), AnnouncedOrder.end());
+	}
+	MapReady.notify_all();
+}
+
+std::unique_ptr<GeneratedMap> PregenerationPool::Take(int Seed)
+{
+	std::unique_lock<std::mutex> Lock(Mutex);
+
+	auto Found = Announced.find(Seed);
+	if (Found == Announced.end())
+	{
+		Stats.AnnouncedMisses++;
+	}
+	else if (Found->second.Map)
+	{
+		Stats.AnnouncedHits++;
+	}
+	else
+	{
+		Stats.AnnouncedWaits++;
+
+		// Only worth waiting for if a worker already started on it, otherwise it's quicker to do it here
+		if (Found->second.bGenerating)
+		{
+			MapReady.wait(Lock, [&]()
+			{
+				Found = Announced.find(Seed);
+				return Found == Announced.end() || Found->second.Map || !Found->second.bGenerating;
+			});
+		}
+	}
+
+	std::unique_ptr<GeneratedMap> Map;
+	if (Found != Announced.end())
+	{
+		Map = std::move(Found->second.Map);
+		Announced.erase(Found);
+		AnnouncedOrder.erase(std::remove(AnnouncedOrder.begin(), AnnouncedOrder.end(), Seed), AnnouncedOrder.end());
+	}
+	Lock.unlock();
+
+	if (!Map)
+	{
+		Generator Gen(false, Options.RuleSet);
+		Map = Generate(Gen, Seed);
+	}
+	return Map;
+}
+
+void PregenerationPool::WaitUntilIdle()
+{
+	std::unique_lock<std::mutex> Lock(Mutex);
+	MapReady.wait(Lock, [&]() { return IsIdle(); });
+}
+
+PregenerationStats PregenerationPool::GetStats() const
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+
+	PregenerationStats Result = Stats;
+	Result.RandomQueueDepth = int(RandomMaps.size());
+	for (const auto& [Seed, Entry] : Announced)
+	{
+		(Entry.Map ? Result.AnnouncedReady : Result.AnnouncedPending)++;
+	}
+	return Result;
+}
+
+void PregenerationPool::Run()
+{
+	Generator Gen(false, Options.RuleSet);
+
+	std::unique_lock<std::mutex> Lock(Mutex);
+	while (true)
+	{
+		int Seed = 0;
+		WorkAvailable.wait(Lock, [&]()
+		{
+			return bStopping || HasPendingSeed() || int(RandomMaps.size()) + RandomInProgress < Options.RandomCapacity;
+		});
+
+		if (bStopping)
+		{
+			break;
+		}
+
+		// Announced seeds always go first, they're about to be played
+		if (TakePendingSeed(Seed))
+		{
+			Lock.unlock();
+			std::unique_ptr<GeneratedMap> Map = Generate(Gen, Seed);
+			Lock.lock();
+
+			// It might have been withdrawn while we were busy
+			auto Found = Announced.find(Seed);
+			if (Found != Announced.end() && Found->second.bGenerating)
+			{
+				Found->second.Map = std::move(Map);
+				Found->second.bGenerating = false;
+			}
+		}
+		else
+		{
+			Seed = NextRandomSeed();
+			RandomInProgress++;
+
+			Lock.unlock();
+			std::unique_ptr<GeneratedMap> Map = Generate(Gen, Seed);
+			Lock.lock();
+
+			RandomInProgress--;
+			RandomMaps.push_back(std::move(Map));
+		}
+
+		MapReady.notify_all();
+	}
+}
+
+std::unique_ptr<GeneratedMap> PregenerationPool::Generate(Generator& Gen, int Seed) const
+{
+	auto Map = std::make_unique<GeneratedMap>();
+	Gen.GenerateMap(Seed);
+	Gen.CopyMap(*Map);
+	return Map;
+}
+
+int PregenerationPool::NextRandomSeed()
+{
+	if (Options.SeedSource)
+	{
+		return Options.SeedSource();
+	}
+
+	return int(RandomEngine() & 0x7fffffff);
+}
+
+bool PregenerationPool::HasPendingSeed() const
+{
+	for (const auto& [Seed, Entry] : Announced)
+	{
+		if (!Entry.Map && !Entry.bGenerating)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool PregenerationPool::TakePendingSeed(int& OutSeed)
+{
+	for (int Seed : AnnouncedOrder)
+	{
+		AnnouncedSeed& Entry = Announced[Seed];
+		if (!Entry.Map && !Entry.bGenerating)
+		{
+			Entry.bGenerating = true;
+			OutSeed = Seed;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool PregenerationPool::IsIdle() const
+{
+	return !HasPendingSeed() && RandomInProgress == 0 && int(RandomMaps.size()) >= Options.RandomCapacity &&
+		std::none_of(Announced.begin(), Announced.end(), [](const auto& Entry) { return Entry.second.bGenerating; });
+}
@@ -0,0 +1,25 @@
+#include "roomindex.h"
+
+#include <cstring>
+
+PackedCoordinate RoomIndex::Find(int NameId, int Occurrence) const
+{
+	if (NameId < 0 || NameId >= RoomNameCount)
+	{
+		return NoCoordinate;
+	}
+
+	// A few dozen bytes, memchr gets through them faster than a hash would
+	const std::uint8_t* Start = NameIds;
+	const std::uint8_t* End = NameIds + Count;
+	while (const void* Found = std::memchr(Start, NameId, End - Start))
+	{
+		const std::uint8_t* Match = static_cast<const std::uint8_t*>(Found);
+		if (Occurrence-- == 0)
+		{
+			return Coordinates[Match - NameIds];
+		}
+		Start = Match + 1;
+	}
+	return NoCoordinate;
+}
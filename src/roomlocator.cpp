@@ -0,0 +1,81 @@
+#include "roomlocator.h"
+#include "batchgenerator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+RoomLocator::RoomLocator(RoomLocatorOptions InOptions)
+	: Options(InOptions)
+{
+	// The BatchGenerator only produces default layouts, rule sets that change them have to run the layout passes themselves
+	bUseBatchLayouts = Generator::GetLayoutStageHash(Options.RuleSet) == Generator::GetLayoutStageHash(GeneratorRuleSet::Default);
+}
+
+void RoomLocator::Locate(int NameId, const int* Seeds, size_t Count, PackedCoordinate* OutCoordinates) const
+{
+	if (GetRoomName(NameId).empty())
+	{
+		std::fill(OutCoordinates, OutCoordinates + Count, NoCoordinate);
+		return;
+	}
+
+	constexpr size_t ChunkSeeds = 1024;
+	const int ThreadCount = int(std::min<size_t>(Options.ThreadCount > 0 ? size_t(Options.ThreadCount) : std::max(1u, std::thread::hardware_concurrency()),
+		(Count + ChunkSeeds - 1) / ChunkSeeds));
+
+	std::atomic<size_t> NextChunk = 0;
+	auto Worker = [&]()
+	{
+		Generator Gen(false, Options.RuleSet);
+		for (size_t First = NextChunk.fetch_add(ChunkSeeds); First < Count; First = NextChunk.fetch_add(ChunkSeeds))
+		{
+			LocateChunk(NameId, Seeds, First, std::min(First + ChunkSeeds, Count), OutCoordinates, Gen);
+		}
+	};
+
+	// Small batches aren't worth starting threads for
+	if (ThreadCount <= 1)
+	{
+		Worker();
+		return;
+	}
+
+	std::vector<std::thread> Threads;
+	for (int i = 0; i < ThreadCount; i++)
+	{
+		Threads.emplace_back(Worker);
+	}
+	for (std::thread& Thread : Threads)
+	{
+		Thread.join();
+	}
+}
+
+void RoomLocator::LocateChunk(int NameId, const int* Seeds, size_t First, size_t Last, PackedCoordinate* OutCoordinates, Generator& Gen) const
+{
+	if (!bUseBatchLayouts)
+	{
+		for (size_t i = First; i < Last; i++)
+		{
+			Gen.GenerateMapUntil(Seeds[i], GenerationStage::ForceRoom1s);
+			OutCoordinates[i] = Gen.LocateRoom(NameId);
+		}
+		return;
+	}
+
+	BatchGenerator Batch;
+	LayoutStageResult Layouts[BatchLaneCount];
+	for (size_t Base = First; Base < Last; Base += BatchLaneCount)
+	{
+		const int Count = int(std::min<size_t>(BatchLaneCount, Last - Base));
+		Batch.GenerateLayouts(Seeds + Base, Count, Layouts);
+
+		for (int Lane = 0; Lane < Count; Lane++)
+		{
+			Gen.GenerateMapFromLayout(Layouts[Lane], GenerationStage::ForceRoom1s);
+			OutCoordinates[Base + Lane] = Gen.LocateRoom(NameId);
+		}
+	}
+}
@@ -0,0 +1,516 @@
+#include "seedindex.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+/**
+* File layout, all little endian and every table 8 byte aligned so it can be used straight out of the mapping:
+* IndexHeader, then the blocks in whatever order they finished, then the block table sorted by High and the feature table sorted by Key.
+* A block is a BlockHeader, its ContainerEntry table sorted by Key, then the container data.
+*/
+namespace
+{
+	constexpr char IndexMagic[8] = { 'S', 'C', 'P', 'S', 'I', 'D', 'X', '1' };
+	constexpr std::uint32_t IndexVersion = 1;
+
+	constexpr int BlockBits = 16;
+	constexpr std::int64_t BlockSeeds = std::int64_t(1) << BlockBits;
+	constexpr int BitmapWords = int(BlockSeeds / 64);
+
+	/** Past this many seeds an array takes more space than a bitmap */
+	constexpr std::uint32_t ArrayContainerMax = 4096;
+
+	struct IndexHeader
+	{
+		char Magic[8];
+		std::uint32_t Version;
+		std::uint32_t RuleSet;
+		std::int64_t FirstSeed;
+		std::int64_t LastSeed;
+		std::uint64_t BlockCount;
+		std::uint64_t BlockTableOffset;
+		std::uint64_t FeatureCount;
+		std::uint64_t FeatureTableOffset;
+	};
+
+	struct BlockTableEntry
+	{
+		std::uint32_t High;
+		std::uint32_t Reserved;
+		std::uint64_t Offset;
+	};
+
+	struct BlockHeader
+	{
+		std::uint32_t ContainerCount;
+		std::uint32_t High;
+	};
+
+	struct ContainerEntry
+	{
+		std::uint64_t Key;
+		std::uint32_t Cardinality;
+		std::uint32_t bBitmap;
+		/** From the start of the block */
+		std::uint64_t DataOffset;
+	};
+
+	struct FeatureTableEntry
+	{
+		std::uint64_t Key;
+		std::uint64_t SeedCount;
+	};
+
+	static_assert(sizeof(IndexHeader) == 64 && sizeof(ContainerEntry) == 24 && sizeof(BlockTableEntry) == 16, "Index structs can't have padding");
+
+	std::uint64_t MakeFeatureKey(SeedFeatureKind Kind, int A, int B, std::uint32_t Value)
+	{
+		return (std::uint64_t(Kind) << 56) | (std::uint64_t(std::uint8_t(A)) << 48) | (std::uint64_t(std::uint8_t(B)) << 40) | Value;
+	}
+
+	std::uint32_t HashName(std::string_view Name)
+	{
+		std::uint32_t Hash = 2166136261u;
+		for (char Char : Name)
+		{
+			Hash = (Hash ^ std::uint8_t(Char)) * 16777619u;
+		}
+		return Hash;
+	}
+
+	template<typename T>
+	void AppendBytes(std::vector<std::uint8_t>& Buffer, const T* Data, size_t Count)
+	{
+		const std::uint8_t* Bytes = reinterpret_cast<const std::uint8_t*>(Data);
+		Buffer.insert(Buffer.end(), Bytes, Bytes + sizeof(T) * Count);
+	}
+
+	const IndexHeader& GetIndexHeader(const MappedFile& File)
+	{
+		return *File.At<IndexHeader>(0);
+	}
+
+	void AlignBuffer(std::vector<std::uint8_t>& Buffer)
+	{
+		Buffer.resize((Buffer.size() + 7) & ~size_t(7), 0);
+	}
+}
+
+SeedFeature SeedFeature::RoomName(int X, int Y, std::string_view Name)
+{
+	return { MakeFeatureKey(FeatureRoomName, X, Y, HashName(Name)) };
+}
+
+SeedFeature SeedFeature::RoomCount(int Zone, RoomType Type, int Count)
+{
+	return { MakeFeatureKey(FeatureRoomCount, Zone, int(Type), std::uint32_t(Count)) };
+}
+
+SeedFeature SeedFeature::Checkpoint(int Zone, int X)
+{
+	return { MakeFeatureKey(FeatureCheckpoint, Zone, 0, std::uint32_t(X)) };
+}
+
+SeedFeature SeedFeature::ForcedPlacement(int Zone, ForcedPlacementKind Kind)
+{
+	return { MakeFeatureKey(FeatureForcedPlacement, Zone, int(Kind), 1) };
+}
+
+SeedIndexBuilder::SeedIndexBuilder(SeedIndexBuildOptions InOptions)
+	: Options(InOptions)
+{
+}
+
+void SeedIndexBuilder::GatherFeatures(Generator& Gen, std::vector<SeedFeature>& OutFeatures)
+{
+	OutFeatures.clear();
+
+	for (int X = 0; X <= MapWidth; X++)
+	{
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			const RoomArrayEntry& Entry = Gen.GetDataAtCoordinate(X, Y);
+			if (!Entry.RoomName.empty())
+			{
+				OutFeatures.push_back(SeedFeature::RoomName(X, Y, Entry.RoomName));
+			}
+
+			if (Entry.GridType == 255)
+			{
+				OutFeatures.push_back(SeedFeature::Checkpoint(Generator::GetMapZone(Y), X));
+			}
+		}
+	}
+
+	const GenerationReport& Report = Gen.GetReport();
+	for (int Zone = 0; Zone < ZoneAmount; Zone++)
+	{
+		for (int Type = RoomType::Room1; Type <= RoomType::Room4; Type++)
+		{
+			OutFeatures.push_back(SeedFeature::RoomCount(Zone, RoomType(Type), Gen.GetRoomAmount(RoomType(Type), Zone)));
+		}
+
+		const std::pair<bool, ForcedPlacementKind> Forced[] = {
+			{ Report.Room1sForced[Zone] > 0, ForcedRoom1s },
+			{ Report.bRoom4Forced[Zone], ForcedRoom4 },
+			{ Report.bRoom4ForceFailed[Zone], ForcedRoom4Failed },
+			{ Report.bRoom2CForced[Zone], ForcedRoom2C },
+			{ Report.bRoom2CForceFailed[Zone], ForcedRoom2CFailed },
+		};
+		for (const auto& [bHappened, Kind] : Forced)
+		{
+			if (bHappened)
+			{
+				OutFeatures.push_back(SeedFeature::ForcedPlacement(Zone, Kind));
+			}
+		}
+	}
+
+	std::sort(OutFeatures.begin(), OutFeatures.end());
+	OutFeatures.erase(std::unique(OutFeatures.begin(), OutFeatures.end()), OutFeatures.end());
+}
+
+bool SeedIndexBuilder::Build(std::int64_t FirstSeed, std::int64_t LastSeed, const std::string& Path)
+{
+	FirstSeed = std::max<std::int64_t>(FirstSeed, 0);
+	LastSeed = std::min<std::int64_t>(LastSeed, INT_MAX);
+
+	std::ofstream Out(Path, std::ios::binary | std::ios::trunc);
+	if (!Out)
+	{
+		return false;
+	}
+
+	IndexHeader Header{};
+	std::memcpy(Header.Magic, IndexMagic, sizeof(IndexMagic));
+	Header.Version = IndexVersion;
+	Header.RuleSet = std::uint32_t(Options.RuleSet);
+	Header.FirstSeed = FirstSeed;
+	Header.LastSeed = LastSeed;
+	Out.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+
+	std::uint64_t Position = sizeof(Header);
+	std::vector<BlockTableEntry> Blocks;
+	std::map<std::uint64_t, std::uint64_t> FeatureSeedCounts;
+	std::mutex Mutex;
+
+	const std::int64_t FirstBlock = FirstSeed >> BlockBits;
+	const std::int64_t LastBlock = LastSeed >> BlockBits;
+	std::atomic<std::int64_t> NextBlock = FirstBlock;
+
+	auto Worker = [&]()
+	{
+		Generator Gen(false, Options.RuleSet);
+		std::vector<SeedFeature> Features;
+		std::unordered_map<std::uint64_t, std::vector<std::uint16_t>> Postings;
+		std::vector<std::uint64_t> Keys;
+		std::vector<std::uint8_t> Buffer;
+
+		for (std::int64_t Block = NextBlock++; Block <= LastBlock && FirstSeed <= LastSeed; Block = NextBlock++)
+		{
+			const std::int64_t Start = std::max(FirstSeed, Block << BlockBits);
+			const std::int64_t End = std::min(LastSeed, (Block << BlockBits) + BlockSeeds - 1);
+
+			for (auto& [Key, Seeds] : Postings)
+			{
+				Seeds.clear();
+			}
+
+			for (std::int64_t Seed = Start; Seed <= End; Seed++)
+			{
+				Gen.GenerateMap(int(Seed));
+				GatherFeatures(Gen, Features);
+				for (const SeedFeature& Feature : Features)
+				{
+					Postings[Feature.Key].push_back(std::uint16_t(Seed & (BlockSeeds - 1)));
+				}
+			}
+
+			Keys.clear();
+			for (const auto& [Key, Seeds] : Postings)
+			{
+				if (!Seeds.empty())
+				{
+					Keys.push_back(Key);
+				}
+			}
+			std::sort(Keys.begin(), Keys.end());
+
+			// Header and container table first, the data offsets get filled in as the containers are appended
+			BlockHeader BlockInfo{ std::uint32_t(Keys.size()), std::uint32_t(Block) };
+			Buffer.clear();
+			AppendBytes(Buffer, &BlockInfo, 1);
+			const size_t TableStart = Buffer.size();
+			Buffer.resize(TableStart + sizeof(ContainerEntry) * Keys.size());
+
+			for (size_t i = 0; i < Keys.size(); i++)
+			{
+				const std::vector<std::uint16_t>& Seeds = Postings[Keys[i]];
+
+				ContainerEntry Entry{ Keys[i], std::uint32_t(Seeds.size()), Seeds.size() > ArrayContainerMax, Buffer.size() };
+				if (Entry.bBitmap)
+				{
+					std::uint64_t Bitmap[BitmapWords]{};
+					for (std::uint16_t Low : Seeds)
+					{
+						Bitmap[Low >> 6] |= std::uint64_t(1) << (Low & 63);
+					}
+					AppendBytes(Buffer, Bitmap, BitmapWords);
+				}
+				else
+				{
+					AppendBytes(Buffer, Seeds.data(), Seeds.size());
+					AlignBuffer(Buffer);
+				}
+
+				std::memcpy(&Buffer[TableStart + sizeof(ContainerEntry) * i], &Entry, sizeof(Entry));
+			}
+
+			std::lock_guard<std::mutex> Lock(Mutex);
+			Out.write(reinterpret_cast<const char*>(Buffer.data()), std::streamsize(Buffer.size()));
+			Blocks.push_back({ std::uint32_t(Block), 0, Position });
+			Position += Buffer.size();
+
+			for (std::uint64_t Key : Keys)
+			{
+				FeatureSeedCounts[Key] += Postings[Key].size();
+			}
+		}
+	};
+
+	const int ThreadCount = Options.ThreadCount > 0 ? Options.ThreadCount : int(std::max(1u, std::thread::hardware_concurrency()));
+	std::vector<std::thread> Threads;
+	for (int i = 0; i < ThreadCount; i++)
+	{
+		Threads.emplace_back(Worker);
+	}
+	for (std::thread& Thread : Threads)
+	{
+		Thread.join();
+	}
+
+	std::sort(Blocks.begin(), Blocks.end(), [](const BlockTableEntry& A, const BlockTableEntry& B) { return A.High < B.High; });
+	Header.BlockCount = Blocks.size();
+	Header.BlockTableOffset = Position;
+	Out.write(reinterpret_cast<const char*>(Blocks.data()), std::streamsize(sizeof(BlockTableEntry) * Blocks.size()));
+	Position += sizeof(BlockTableEntry) * Blocks.size();
+
+	std::vector<FeatureTableEntry> FeatureTable;
+	for (const auto& [Key, SeedCount] : FeatureSeedCounts)
+	{
+		FeatureTable.push_back({ Key, SeedCount });
+	}
+	Header.FeatureCount = FeatureTable.size();
+	Header.FeatureTableOffset = Position;
+	Out.write(reinterpret_cast<const char*>(FeatureTable.data()), std::streamsize(sizeof(FeatureTableEntry) * FeatureTable.size()));
+
+	Out.seekp(0);
+	Out.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+	return bool(Out);
+}
+
+bool SeedIndex::Open(const std::string& Path)
+{
+	if (!File.Open(Path) || File.GetSize() < sizeof(IndexHeader))
+	{
+		File.Close();
+		return false;
+	}
+
+	const IndexHeader& Header = GetIndexHeader(File);
+	const bool bValid = std::memcmp(Header.Magic, IndexMagic, sizeof(IndexMagic)) == 0 && Header.Version == IndexVersion &&
+		Header.BlockTableOffset + sizeof(BlockTableEntry) * Header.BlockCount <= File.GetSize() &&
+		Header.FeatureTableOffset + sizeof(FeatureTableEntry) * Header.FeatureCount <= File.GetSize();
+	if (!bValid)
+	{
+		File.Close();
+	}
+	return bValid;
+}
+
+bool SeedIndex::IsOpen() const
+{
+	return File.IsOpen();
+}
+
+std::int64_t SeedIndex::GetFirstSeed() const
+{
+	return IsOpen() ? GetIndexHeader(File).FirstSeed : 0;
+}
+
+std::int64_t SeedIndex::GetLastSeed() const
+{
+	return IsOpen() ? GetIndexHeader(File).LastSeed : -1;
+}
+
+std::uint64_t SeedIndex::GetFeatureSeedCount(SeedFeature Feature) const
+{
+	if (!IsOpen())
+	{
+		return 0;
+	}
+
+	const IndexHeader& Header = GetIndexHeader(File);
+	const FeatureTableEntry* Begin = File.At<FeatureTableEntry>(Header.FeatureTableOffset);
+	const FeatureTableEntry* End = Begin + Header.FeatureCount;
+	const FeatureTableEntry* Found = std::lower_bound(Begin, End, Feature.Key, [](const FeatureTableEntry& Entry, std::uint64_t Key) { return Entry.Key < Key; });
+	return Found != End && Found->Key == Feature.Key ? Found->SeedCount : 0;
+}
+
+std::vector<int> SeedIndex::Find(const std::vector<SeedFeature>& Features, size_t Limit) const
+{
+	std::vector<int> Seeds;
+	if (Limit == 0)
+	{
+		return Seeds;
+	}
+
+	ForEachMatch(Features, [&](int Seed)
+	{
+		Seeds.push_back(Seed);
+		return Seeds.size() < Limit;
+	});
+	return Seeds;
+}
+
+std::uint64_t SeedIndex::Count(const std::vector<SeedFeature>& Features) const
+{
+	std::uint64_t Matches = 0;
+	ForEachMatch(Features, [&](int)
+	{
+		Matches++;
+		return true;
+	});
+	return Matches;
+}
+
+void SeedIndex::ForEachMatch(const std::vector<SeedFeature>& Features, const std::function<bool(int Seed)>& OnMatch) const
+{
+	if (!IsOpen())
+	{
+		return;
+	}
+
+	const IndexHeader& Header = GetIndexHeader(File);
+
+	// No features means no restrictions
+	if (Features.empty())
+	{
+		for (std::int64_t Seed = Header.FirstSeed; Seed <= Header.LastSeed; Seed++)
+		{
+			if (!OnMatch(int(Seed)))
+			{
+				return;
+			}
+		}
+		return;
+	}
+
+	// Rarest features first, a block can be skipped as soon as one of them is missing from it
+	std::vector<std::pair<std::uint64_t, std::uint64_t>> Query;
+	for (const SeedFeature& Feature : Features)
+	{
+		const std::uint64_t SeedCount = GetFeatureSeedCount(Feature);
+		if (SeedCount == 0)
+		{
+			return;
+		}
+		Query.emplace_back(SeedCount, Feature.Key);
+	}
+	std::sort(Query.begin(), Query.end());
+	Query.erase(std::unique(Query.begin(), Query.end()), Query.end());
+
+	std::vector<const ContainerEntry*> Containers(Query.size());
+	std::vector<std::uint32_t> Cursors(Query.size());
+	std::uint64_t Bitmap[BitmapWords];
+
+	const BlockTableEntry* Blocks = File.At<BlockTableEntry>(Header.BlockTableOffset);
+	for (std::uint64_t BlockIndex = 0; BlockIndex < Header.BlockCount; BlockIndex++)
+	{
+		const std::uint8_t* BlockData = File.GetData() + Blocks[BlockIndex].Offset;
+		const BlockHeader& Block = *reinterpret_cast<const BlockHeader*>(BlockData);
+		const ContainerEntry* Begin = reinterpret_cast<const ContainerEntry*>(BlockData + sizeof(BlockHeader));
+		const ContainerEntry* End = Begin + Block.ContainerCount;
+
+		bool bAllFound = true;
+		for (size_t i = 0; i < Query.size() && bAllFound; i++)
+		{
+			const std::uint64_t Key = Query[i].second;
+			const ContainerEntry* Found = std::lower_bound(Begin, End, Key, [](const ContainerEntry& Entry, std::uint64_t Key) { return Entry.Key < Key; });
+			bAllFound = Found != End && Found->Key == Key;
+			Containers[i] = Found;
+			Cursors[i] = 0;
+		}
+
+		if (!bAllFound)
+		{
+			continue;
+		}
+
+		std::sort(Containers.begin(), Containers.end(), [](const ContainerEntry* A, const ContainerEntry* B) { return A->Cardinality < B->Cardinality; });
+		const int SeedBase = int(Block.High) << BlockBits;
+
+		// The smallest container being a bitmap means they all are, so AND them together
+		if (Containers[0]->bBitmap)
+		{
+			std::memcpy(Bitmap, BlockData + Containers[0]->DataOffset, sizeof(Bitmap));
+			for (size_t i = 1; i < Containers.size(); i++)
+			{
+				const std::uint64_t* Other = reinterpret_cast<const std::uint64_t*>(BlockData + Containers[i]->DataOffset);
+				for (int Word = 0; Word < BitmapWords; Word++)
+				{
+					Bitmap[Word] &= Other[Word];
+				}
+			}
+
+			for (int Word = 0; Word < BitmapWords; Word++)
+			{
+				for (std::uint64_t Bits = Bitmap[Word]; Bits; Bits &= Bits - 1)
+				{
+					if (!OnMatch(SeedBase + Word * 64 + std::countr_zero(Bits)))
+					{
+						return;
+					}
+				}
+			}
+			continue;
+		}
+
+		// Otherwise walk the smallest array and probe the rest, arrays keep a cursor since the probes only ever go up
+		const std::uint16_t* Candidates = reinterpret_cast<const std::uint16_t*>(BlockData + Containers[0]->DataOffset);
+		for (std::uint32_t Candidate = 0; Candidate < Containers[0]->Cardinality; Candidate++)
+		{
+			const std::uint16_t Low = Candidates[Candidate];
+
+			bool bMatches = true;
+			for (size_t i = 1; i < Containers.size() && bMatches; i++)
+			{
+				const std::uint8_t* Data = BlockData + Containers[i]->DataOffset;
+				if (Containers[i]->bBitmap)
+				{
+					bMatches = (reinterpret_cast<const std::uint64_t*>(Data)[Low >> 6] >> (Low & 63)) & 1;
+				}
+				else
+				{
+					const std::uint16_t* Values = reinterpret_cast<const std::uint16_t*>(Data);
+					const std::uint16_t* Found = std::lower_bound(Values + Cursors[i], Values + Containers[i]->Cardinality, Low);
+					Cursors[i] = std::uint32_t(Found - Values);
+					bMatches = Cursors[i] < Containers[i]->Cardinality && *Found == Low;
+				}
+			}
+
+			if (bMatches && !OnMatch(SeedBase + Low))
+			{
+				return;
+			}
+		}
+	}
+}
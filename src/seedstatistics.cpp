@@ -0,0 +1,468 @@
+#include "seedstatistics.h"
+#include "batchgenerator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+void CountHistogram::Add(int Value)
+{
+	Bins[std::clamp(Value, 0, MaxValue)]++;
+}
+
+void CountHistogram::Add(int Value, std::uint64_t Count)
+{
+	Bins[std::clamp(Value, 0, MaxValue)] += Count;
+}
+
+void CountHistogram::Merge(const CountHistogram& Other)
+{
+	for (int i = 0; i <= MaxValue; i++)
+	{
+		Bins[i] += Other.Bins[i];
+	}
+}
+
+std::uint64_t CountHistogram::GetTotal() const
+{
+	std::uint64_t Total = 0;
+	for (std::uint64_t Count : Bins)
+	{
+		Total += Count;
+	}
+	return Total;
+}
+
+double CountHistogram::GetMean() const
+{
+	std::uint64_t Total = 0;
+	double Sum = 0.0;
+	for (int i = 0; i <= MaxValue; i++)
+	{
+		Total += Bins[i];
+		Sum += double(i) * double(Bins[i]);
+	}
+	return Total ? Sum / double(Total) : 0.0;
+}
+
+int CountHistogram::GetPercentile(double Fraction) const
+{
+	const double Target = Fraction * double(GetTotal());
+
+	std::uint64_t Seen = 0;
+	for (int i = 0; i <= MaxValue; i++)
+	{
+		Seen += Bins[i];
+		if (Seen > 0 && double(Seen) >= Target)
+		{
+			return i;
+		}
+	}
+	return MaxValue;
+}
+
+void SeedStatistics::Merge(const SeedStatistics& Other)
+{
+	SeedCount += Other.SeedCount;
+
+	for (int Type = 0; Type <= RoomType::Room4; Type++)
+	{
+		for (int Zone = 0; Zone < ZoneAmount; Zone++)
+		{
+			LayoutRoomAmounts[Type][Zone].Merge(Other.LayoutRoomAmounts[Type][Zone]);
+			RoomAmounts[Type][Zone].Merge(Other.RoomAmounts[Type][Zone]);
+		}
+
+		for (int X = 0; X <= MapWidth; X++)
+		{
+			for (int Y = 0; Y <= MapHeight; Y++)
+			{
+				Occupancy[Type][X][Y] += Other.Occupancy[Type][X][Y];
+			}
+		}
+	}
+
+	for (int Zone = 0; Zone < ZoneAmount; Zone++)
+	{
+		Room4Forced[Zone] += Other.Room4Forced[Zone];
+		Room4ForceFailed[Zone] += Other.Room4ForceFailed[Zone];
+		Room2CForced[Zone] += Other.Room2CForced[Zone];
+		Room2CForceFailed[Zone] += Other.Room2CForceFailed[Zone];
+		Room1sForced[Zone].Merge(Other.Room1sForced[Zone]);
+	}
+
+	SetRoomFailures.Merge(Other.SetRoomFailures);
+
+	for (int i = 0; i < MapInvariantCount; i++)
+	{
+		InvariantViolations[i] += Other.InvariantViolations[i];
+	}
+
+	for (const MapViolation& Violation : Other.ViolationSamples)
+	{
+		if (ViolationSamples.size() >= MaxViolationSamples)
+		{
+			break;
+		}
+		ViolationSamples.push_back(Violation);
+	}
+}
+
+namespace
+{
+	template<typename T>
+	void WriteValue(std::string& Out, const T& Value)
+	{
+		Out.append(reinterpret_cast<const char*>(&Value), sizeof(T));
+	}
+
+	template<typename T>
+	bool ReadValue(const char*& Data, const char* End, T& OutValue)
+	{
+		if (size_t(End - Data) < sizeof(T))
+		{
+			return false;
+		}
+		std::memcpy(&OutValue, Data, sizeof(T));
+		Data += sizeof(T);
+		return true;
+	}
+
+	void WriteHistogram(std::string& Out, const CountHistogram& Histogram)
+	{
+		for (int i = 0; i <= CountHistogram::MaxValue; i++)
+		{
+			WriteValue(Out, Histogram.GetCount(i));
+		}
+	}
+
+	bool ReadHistogram(const char*& Data, const char* End, CountHistogram& OutHistogram)
+	{
+		OutHistogram = {};
+		for (int i = 0; i <= CountHistogram::MaxValue; i++)
+		{
+			std::uint64_t Count = 0;
+			if (!ReadValue(Data, End, Count))
+			{
+				return false;
+			}
+			OutHistogram.Add(i, Count);
+		}
+		return true;
+	}
+}
+
+void SeedStatistics::Write(std::string& Out) const
+{
+	WriteValue(Out, SeedCount);
+
+	for (int Type = 0; Type <= RoomType::Room4; Type++)
+	{
+		for (int Zone = 0; Zone < ZoneAmount; Zone++)
+		{
+			WriteHistogram(Out, LayoutRoomAmounts[Type][Zone]);
+			WriteHistogram(Out, RoomAmounts[Type][Zone]);
+		}
+	}
+
+	for (int Zone = 0; Zone < ZoneAmount; Zone++)
+	{
+		WriteValue(Out, Room4Forced[Zone]);
+		WriteValue(Out, Room4ForceFailed[Zone]);
+		WriteValue(Out, Room2CForced[Zone]);
+		WriteValue(Out, Room2CForceFailed[Zone]);
+		WriteHistogram(Out, Room1sForced[Zone]);
+	}
+
+	WriteHistogram(Out, SetRoomFailures);
+	WriteValue(Out, Occupancy);
+	WriteValue(Out, InvariantViolations);
+
+	WriteValue(Out, std::uint32_t(ViolationSamples.size()));
+	for (const MapViolation& Violation : ViolationSamples)
+	{
+		WriteValue(Out, std::int32_t(Violation.Seed));
+		WriteValue(Out, std::int32_t(Violation.Stage));
+		WriteValue(Out, std::uint32_t(Violation.Invariant));
+		WriteValue(Out, std::int32_t(Violation.X));
+		WriteValue(Out, std::int32_t(Violation.Y));
+		WriteValue(Out, std::int32_t(Violation.Zone));
+	}
+}
+
+bool SeedStatistics::Read(const char*& Data, const char* End)
+{
+	*this = {};
+	bool bOk = ReadValue(Data, End, SeedCount);
+
+	for (int Type = 0; Type <= RoomType::Room4; Type++)
+	{
+		for (int Zone = 0; Zone < ZoneAmount; Zone++)
+		{
+			bOk = bOk && ReadHistogram(Data, End, LayoutRoomAmounts[Type][Zone]);
+			bOk = bOk && ReadHistogram(Data, End, RoomAmounts[Type][Zone]);
+		}
+	}
+
+	for (int Zone = 0; Zone < ZoneAmount; Zone++)
+	{
+		bOk = bOk && ReadValue(Data, End, Room4Forced[Zone]);
+		bOk = bOk && ReadValue(Data, End, Room4ForceFailed[Zone]);
+		bOk = bOk && ReadValue(Data, End, Room2CForced[Zone]);
+		bOk = bOk && ReadValue(Data, End, Room2CForceFailed[Zone]);
+		bOk = bOk && ReadHistogram(Data, End, Room1sForced[Zone]);
+	}
+
+	bOk = bOk && ReadHistogram(Data, End, SetRoomFailures);
+	bOk = bOk && ReadValue(Data, End, Occupancy);
+	bOk = bOk && ReadValue(Data, End, InvariantViolations);
+
+	std::uint32_t SampleCount = 0;
+	bOk = bOk && ReadValue(Data, End, SampleCount) && SampleCount <= MaxViolationSamples;
+	for (std::uint32_t i = 0; bOk && i < SampleCount; i++)
+	{
+		std::int32_t Seed = 0, Stage = 0, X = 0, Y = 0, Zone = 0;
+		std::uint32_t Invariant = 0;
+		bOk = ReadValue(Data, End, Seed) && ReadValue(Data, End, Stage) && ReadValue(Data, End, Invariant) && ReadValue(Data, End, X) &&
+			ReadValue(Data, End, Y) && ReadValue(Data, End, Zone);
+		ViolationSamples.push_back({ Seed, GenerationStage(Stage), MapInvariant(Invariant), X, Y, Zone });
+	}
+
+	return bOk;
+}
+
+SeedStatisticsEngine::SeedStatisticsEngine(SeedStatisticsOptions InOptions)
+	: Options(std::move(InOptions))
+{
+}
+
+GenerationStage SeedStatisticsEngine::GetStopStage(unsigned Metrics)
+{
+	GenerationStage Stage = GenerationStage::Layout;
+
+	if (Metrics & MetricLayoutRoomAmounts)
+	{
+		Stage = std::max(Stage, GenerationStage::ForceRoom1s);
+	}
+
+	if (Metrics & (MetricRoomAmounts | MetricForcedPlacements | MetricOccupancy))
+	{
+		Stage = std::max(Stage, GenerationStage::PredefinedRooms);
+	}
+
+	if (Metrics & MetricSetRoomFailures)
+	{
+		Stage = std::max(Stage, GenerationStage::AssignRooms);
+	}
+
+	return Stage;
+}
+
+SeedStatistics SeedStatisticsEngine::Run(std::int64_t FirstSeed, std::int64_t LastSeed)
+{
+	const std::int64_t SeedsTotal = std::max<std::int64_t>(LastSeed - FirstSeed + 1, 0);
+	const int ChunkSize = std::max(Options.ChunkSize, 1);
+	const int ThreadCount = Options.ThreadCount > 0 ? Options.ThreadCount : int(std::max(1u, std::thread::hardware_concurrency()));
+
+	auto Totals = std::make_unique<SeedStatistics>();
+	std::int64_t SeedsDone = 0;
+	int ThreadsRunning = ThreadCount;
+	std::mutex Mutex;
+	std::condition_variable Wake;
+	std::atomic<std::int64_t> NextSeed = FirstSeed;
+
+	auto Worker = [&]()
+	{
+		Generator Gen(false);
+		auto Local = std::make_unique<SeedStatistics>();
+
+		std::unique_ptr<GenerationProfiler> Profiler;
+		if (Options.Profiler)
+		{
+			Profiler = std::make_unique<GenerationProfiler>(Options.Profiler->GetSeedsPerBucket());
+			Gen.SetProfiler(Profiler.get());
+		}
+
+		while (true)
+		{
+			std::int64_t ChunkStart = NextSeed.fetch_add(ChunkSize);
+			if (ChunkStart > LastSeed)
+			{
+				break;
+			}
+
+			std::int64_t ChunkEnd = std::min(ChunkStart + ChunkSize - 1, LastSeed);
+			if (GetStopStage(Options.Metrics) <= GenerationStage::ForceRoom1s && Options.Validation == 0 && !Profiler)
+			{
+				GatherLayoutChunk(ChunkStart, ChunkEnd, *Local);
+			}
+			else
+			{
+				GatherChunk(Gen, ChunkStart, ChunkEnd, *Local);
+			}
+
+			std::lock_guard<std::mutex> Lock(Mutex);
+			Totals->Merge(*Local);
+			SeedsDone += ChunkEnd - ChunkStart + 1;
+			*Local = {};
+		}
+
+		std::lock_guard<std::mutex> Lock(Mutex);
+		if (Profiler)
+		{
+			Options.Profiler->Merge(*Profiler);
+		}
+		ThreadsRunning--;
+		Wake.notify_all();
+	};
+
+	std::vector<std::thread> Threads;
+	for (int i = 0; i < ThreadCount; i++)
+	{
+		Threads.emplace_back(Worker);
+	}
+
+	auto Snapshot = std::make_unique<SeedStatistics>();
+	std::unique_lock<std::mutex> Lock(Mutex);
+	while (!Wake.wait_for(Lock, Options.ProgressInterval, [&]() { return ThreadsRunning == 0; }))
+	{
+		if (Options.OnProgress)
+		{
+			*Snapshot = *Totals;
+			std::int64_t Done = SeedsDone;
+
+			Lock.unlock();
+			Options.OnProgress(*Snapshot, Done, SeedsTotal);
+			Lock.lock();
+		}
+	}
+	Lock.unlock();
+
+	for (std::thread& Thread : Threads)
+	{
+		Thread.join();
+	}
+
+	if (Options.OnProgress)
+	{
+		Options.OnProgress(*Totals, SeedsDone, SeedsTotal);
+	}
+
+	return *Totals;
+}
+
+void SeedStatisticsEngine::GatherChunk(Generator& Gen, std::int64_t FirstSeed, std::int64_t LastSeed, SeedStatistics& Stats) const
+{
+	const unsigned Metrics = Options.Metrics;
+	const GenerationStage StopStage = GetStopStage(Metrics);
+	Gen.SetValidation(Options.Validation);
+
+	for (std::int64_t Seed = FirstSeed; Seed <= LastSeed; Seed++)
+	{
+		Stats.SeedCount++;
+
+		Gen.GenerateMapUntil(int(Seed), std::min(StopStage, GenerationStage::ForceRoom1s));
+		if (Metrics & MetricLayoutRoomAmounts)
+		{
+			for (int Type = RoomType::Room1; Type <= RoomType::Room4; Type++)
+			{
+				for (int Zone = 0; Zone < ZoneAmount; Zone++)
+				{
+					Stats.LayoutRoomAmounts[Type][Zone].Add(Gen.GetRoomAmount(RoomType(Type), Zone));
+				}
+			}
+		}
+
+		Gen.ContinueMapUntil(StopStage);
+
+		const GenerationReport& Report = Gen.GetReport();
+		for (int Zone = 0; Zone < ZoneAmount; Zone++)
+		{
+			if (Metrics & MetricRoomAmounts)
+			{
+				for (int Type = RoomType::Room1; Type <= RoomType::Room4; Type++)
+				{
+					Stats.RoomAmounts[Type][Zone].Add(Gen.GetRoomAmount(RoomType(Type), Zone));
+				}
+			}
+
+			if (Metrics & MetricForcedPlacements)
+			{
+				Stats.Room4Forced[Zone] += Report.bRoom4Forced[Zone];
+				Stats.Room4ForceFailed[Zone] += Report.bRoom4ForceFailed[Zone];
+				Stats.Room2CForced[Zone] += Report.bRoom2CForced[Zone];
+				Stats.Room2CForceFailed[Zone] += Report.bRoom2CForceFailed[Zone];
+				Stats.Room1sForced[Zone].Add(Report.Room1sForced[Zone]);
+			}
+		}
+
+		if (Metrics & MetricSetRoomFailures)
+		{
+			Stats.SetRoomFailures.Add(Report.SetRoomFailures);
+		}
+
+		for (const MapViolation& Violation : Gen.GetViolations())
+		{
+			Stats.InvariantViolations[std::countr_zero(unsigned(Violation.Invariant))]++;
+			if (Stats.ViolationSamples.size() < SeedStatistics::MaxViolationSamples)
+			{
+				Stats.ViolationSamples.push_back(Violation);
+			}
+		}
+
+		if (Metrics & MetricOccupancy)
+		{
+			for (int X = 0; X <= MapWidth; X++)
+			{
+				for (int Y = 0; Y <= MapHeight; Y++)
+				{
+					const RoomArrayEntry& Entry = Gen.GetDataAtCoordinate(X, Y);
+					if (Entry.GridType > 0)
+					{
+						Stats.Occupancy[RoomType::Room0][X][Y]++;
+						Stats.Occupancy[Entry.RoomType][X][Y]++;
+					}
+				}
+			}
+		}
+	}
+}
+
+void SeedStatisticsEngine::GatherLayoutChunk(std::int64_t FirstSeed, std::int64_t LastSeed, SeedStatistics& Stats) const
+{
+	BatchGenerator Batch;
+	int Seeds[BatchLaneCount];
+	LayoutStageResult Layouts[BatchLaneCount];
+
+	for (std::int64_t Base = FirstSeed; Base <= LastSeed; Base += BatchLaneCount)
+	{
+		int Count = int(std::min<std::int64_t>(BatchLaneCount, LastSeed - Base + 1));
+		for (int Lane = 0; Lane < Count; Lane++)
+		{
+			Seeds[Lane] = int(Base + Lane);
+		}
+
+		Batch.GenerateLayouts(Seeds, Count, Layouts);
+
+		for (int Lane = 0; Lane < Count; Lane++)
+		{
+			const LayoutStageResult& Layout = Layouts[Lane];
+			Stats.SeedCount++;
+
+			for (int Zone = 0; Zone < ZoneAmount; Zone++)
+			{
+				Stats.LayoutRoomAmounts[RoomType::Room1][Zone].Add(Layout.Room1Amount[Zone]);
+				Stats.LayoutRoomAmounts[RoomType::Room2][Zone].Add(Layout.Room2Amount[Zone]);
+				Stats.LayoutRoomAmounts[RoomType::Room2C][Zone].Add(Layout.Room2CAmount[Zone]);
+				Stats.LayoutRoomAmounts[RoomType::Room3][Zone].Add(Layout.Room3Amount[Zone]);
+				Stats.LayoutRoomAmounts[RoomType::Room4][Zone].Add(Layout.Room4Amount[Zone]);
+			}
+		}
+	}
+}
@@ -0,0 +1,396 @@
+#include "seedsweep.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+
+namespace
+{
+	constexpr char CheckpointMagic[8] = { 'S', 'C', 'P', 'S', 'W', 'E', 'P', '1' };
+
+	std::uint64_t HashBytes(const char* Data, size_t Size)
+	{
+		std::uint64_t Hash = 14695981039346656037ull;
+		for (size_t i = 0; i < Size; i++)
+		{
+			Hash = (Hash ^ std::uint8_t(Data[i])) * 1099511628211ull;
+		}
+		return Hash;
+	}
+
+	template<typename T>
+	void WriteValue(std::string& Out, const T& Value)
+	{
+		Out.append(reinterpret_cast<const char*>(&Value), sizeof(T));
+	}
+
+	template<typename T>
+	bool ReadValue(const char*& Data, const char* End, T& OutValue)
+	{
+		if (size_t(End - Data) < sizeof(T))
+		{
+			return false;
+		}
+		std::memcpy(&OutValue, Data, sizeof(T));
+		Data += sizeof(T);
+		return true;
+	}
+}
+
+bool SweepShard::Parse(const std::string& Text, SweepShard& OutShard)
+{
+	int ShardIndex = 0;
+	int ShardCount = 0;
+	char Trailing = 0;
+	if (std::sscanf(Text.c_str(), "%d/%d%c", &ShardIndex, &ShardCount, &Trailing) != 2 || ShardCount < 1 || ShardIndex < 0 || ShardIndex >= ShardCount)
+	{
+		return false;
+	}
+
+	OutShard.Index = ShardIndex;
+	OutShard.Count = ShardCount;
+	return true;
+}
+
+void SweepShard::GetRange(std::int64_t FirstSeed, std::int64_t LastSeed, std::int64_t& OutFirst, std::int64_t& OutLast) const
+{
+	const std::int64_t Total = std::max<std::int64_t>(LastSeed - FirstSeed + 1, 0);
+	OutFirst = FirstSeed + Total * Index / Count;
+	OutLast = FirstSeed + Total * (Index + 1) / Count - 1;
+}
+
+bool SweepCheckpoint::IsComplete() const
+{
+	std::int64_t ShardFirst = 0, ShardLast = 0;
+	Shard.GetRange(FirstSeed, LastSeed, ShardFirst, ShardLast);
+	return NextSeed > ShardLast;
+}
+
+bool SweepCheckpoint::IsSameSweep(const SweepCheckpoint& Other) const
+{
+	return Shard.Count == Other.Shard.Count && FirstSeed == Other.FirstSeed && LastSeed == Other.LastSeed && Metrics == Other.Metrics &&
+		Validation == Other.Validation;
+}
+
+bool SweepCheckpoint::Save(const std::string& Path) const
+{
+	std::string Payload;
+	Statistics.Write(Payload);
+
+	std::string Data(CheckpointMagic, sizeof(CheckpointMagic));
+	WriteValue(Data, std::int32_t(Shard.Index));
+	WriteValue(Data, std::int32_t(Shard.Count));
+	WriteValue(Data, FirstSeed);
+	WriteValue(Data, LastSeed);
+	WriteValue(Data, NextSeed);
+	WriteValue(Data, std::uint32_t(Metrics));
+	WriteValue(Data, std::uint32_t(Validation));
+	WriteValue(Data, std::uint64_t(Payload.size()));
+	WriteValue(Data, HashBytes(Payload.data(), Payload.size()));
+	Data += Payload;
+
+	const std::string TempPath = Path + ".tmp";
+	{
+		std::ofstream File(TempPath, std::ios::binary | std::ios::trunc);
+		if (!File.write(Data.data(), std::streamsize(Data.size())) || !File.flush())
+		{
+			return false;
+		}
+	}
+
+	std::error_code Error;
+	std::filesystem::rename(TempPath, Path, Error);
+	return !Error;
+}
+
+bool SweepCheckpoint::Load(const std::string& Path)
+{
+	std::ifstream File(Path, std::ios::binary);
+	if (!File)
+	{
+		return false;
+	}
+
+	const std::string Data((std::istreambuf_iterator<char>(File)), std::istreambuf_iterator<char>());
+	const char* Cursor = Data.data();
+	const char* End = Data.data() + Data.size();
+	if (Data.size() < sizeof(CheckpointMagic) || std::memcmp(Cursor, CheckpointMagic, sizeof(CheckpointMagic)) != 0)
+	{
+		return false;
+	}
+	Cursor += sizeof(CheckpointMagic);
+
+	std::int32_t ShardIndex = 0, ShardCount = 0;
+	std::uint32_t SavedMetrics = 0, SavedValidation = 0;
+	std::uint64_t PayloadSize = 0, PayloadHash = 0;
+	if (!ReadValue(Cursor, End, ShardIndex) || !ReadValue(Cursor, End, ShardCount) || !ReadValue(Cursor, End, FirstSeed) ||
+		!ReadValue(Cursor, End, LastSeed) || !ReadValue(Cursor, End, NextSeed) || !ReadValue(Cursor, End, SavedMetrics) ||
+		!ReadValue(Cursor, End, SavedValidation) || !ReadValue(Cursor, End, PayloadSize) || !ReadValue(Cursor, End, PayloadHash))
+	{
+		return false;
+	}
+
+	if (PayloadSize != std::uint64_t(End - Cursor) || PayloadHash != HashBytes(Cursor, size_t(PayloadSize)) || ShardCount < 1 || ShardIndex < 0 ||
+		ShardIndex >= ShardCount)
+	{
+		return false;
+	}
+
+	Shard = { ShardIndex, ShardCount };
+	Metrics = SavedMetrics;
+	Validation = SavedValidation;
+	return Statistics.Read(Cursor, End) && Cursor == End;
+}
+
+SeedSweep::SeedSweep(SeedSweepOptions InOptions)
+	: Options(std::move(InOptions))
+{
+}
+
+bool SeedSweep::Run()
+{
+	std::error_code Error;
+	std::filesystem::create_directories(Options.Directory, Error);
+	const std::string Path = GetShardPath(Options.Directory, Options.Shard);
+
+	std::int64_t ShardFirst = 0, ShardLast = 0;
+	Options.Shard.GetRange(Options.FirstSeed, Options.LastSeed, ShardFirst, ShardLast);
+
+	auto Checkpoint = std::make_unique<SweepCheckpoint>();
+	Checkpoint->Shard = Options.Shard;
+	Checkpoint->FirstSeed = Options.FirstSeed;
+	Checkpoint->LastSeed = Options.LastSeed;
+	Checkpoint->Metrics = Options.Statistics.Metrics;
+	Checkpoint->Validation = Options.Statistics.Validation;
+	Checkpoint->NextSeed = ShardFirst;
+
+	bool bSaved = false;
+	if (std::filesystem::exists(Path, Error))
+	{
+		auto Saved = std::make_unique<SweepCheckpoint>();
+		if (!Saved->Load(Path))
+		{
+			SCPROOMGEN_LOG(LogLevel::Warning, "Sweep checkpoint %s can't be read, starting the shard over", Path.c_str());
+		}
+		else if (!Saved->IsSameSweep(*Checkpoint) || !(Saved->Shard == Options.Shard))
+		{
+			// Someone else's output, leave it alone
+			SCPROOMGEN_LOG(LogLevel::Error, "Sweep checkpoint %s belongs to a different sweep", Path.c_str());
+			return false;
+		}
+		else
+		{
+			Checkpoint = std::move(Saved);
+			bSaved = true;
+		}
+	}
+
+	SeedStatisticsEngine Engine(Options.Statistics);
+	const std::int64_t CheckpointSeeds = std::max<std::int64_t>(Options.CheckpointSeeds, 1);
+	while (!Checkpoint->IsComplete())
+	{
+		const std::int64_t SegmentLast = std::min(Checkpoint->NextSeed + CheckpointSeeds - 1, ShardLast);
+		Checkpoint->Statistics.Merge(Engine.Run(Checkpoint->NextSeed, SegmentLast));
+		Checkpoint->NextSeed = SegmentLast + 1;
+
+		if (!Checkpoint->Save(Path))
+		{
+			SCPROOMGEN_LOG(LogLevel::Error, "Couldn't save sweep checkpoint %s", Path.c_str());
+			return false;
+		}
+		bSaved = true;
+
+		if (Options.OnCheckpoint && !Options.OnCheckpoint(*Checkpoint))
+		{
+			return false;
+		}
+	}
+
+	// A shard with no seeds still needs its output for Merge
+	if (!bSaved && !Checkpoint->Save(Path))
+	{
+		SCPROOMGEN_LOG(LogLevel::Error, "Couldn't save sweep checkpoint %s", Path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+std::string SeedSweep::GetShardPath(const std::string& Directory, const SweepShard& Shard)
+{
+	char Name[64];
+	std::snprintf(Name, sizeof(Name), "shard-%d-of-%d.sweep", Shard.Index, Shard.Count);
+	return (std::filesystem::path(Directory) / Name).string();
+}
+
+bool SeedSweep::Merge(const std::string& Directory, int ShardCount, SweepCheckpoint& OutMerged, std::string& OutError)
+{
+	OutMerged = {};
+	if (ShardCount < 1)
+	{
+		OutError = "No shards to merge";
+		return false;
+	}
+
+	auto Part = std::make_unique<SweepCheckpoint>();
+
+	for (int Index = 0; Index < ShardCount; Index++)
+	{
+		const SweepShard Shard{ Index, ShardCount };
+		const std::string Name = std::to_string(Index) + "/" + std::to_string(ShardCount);
+		if (!Part->Load(GetShardPath(Directory, Shard)) || !(Part->Shard == Shard))
+		{
+			OutError = "Shard " + Name + " is missing or unreadable";
+			return false;
+		}
+
+		if (!Part->IsComplete())
+		{
+			OutError = "Shard " + Name + " hasn't finished, it's up to seed " + std::to_string(Part->NextSeed);
+			return false;
+		}
+
+		if (Index == 0)
+		{
+			OutMerged.Shard = { 0, 1 };
+			OutMerged.FirstSeed = Part->FirstSeed;
+			OutMerged.LastSeed = Part->LastSeed;
+			OutMerged.Metrics = Part->Metrics;
+			OutMerged.Validation = Part->Validation;
+			OutMerged.NextSeed = Part->LastSeed + 1;
+		}
+		else if (Part->FirstSeed != OutMerged.FirstSeed || Part->LastSeed != OutMerged.LastSeed || Part->Metrics != OutMerged.Metrics ||
+			Part->Validation != OutMerged.Validation)
+		{
+			OutError = "Shard " + Name + " is from a different sweep than shard 0/" + std::to_string(ShardCount);
+			return false;
+		}
+
+		OutMerged.Statistics.Merge(Part->Statistics);
+	}
+
+	return true;
+}
+
+int RunSweepCommand(int argc, char** argv)
+{
+	const std::string Command = argc > 0 ? argv[0] : "";
+	SeedSweepOptions Options;
+	int ShardCount = 0;
+	bool bHasShard = false;
+	std::unique_ptr<GenerationProfiler> Profiler;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		const std::string Name = argv[i];
+		const char* Value = argv[i + 1];
+		if (Name == "--out")
+		{
+			Options.Directory = Value;
+		}
+		else if (Name == "--shard")
+		{
+			bHasShard = SweepShard::Parse(Value, Options.Shard);
+		}
+		else if (Name == "--shards")
+		{
+			ShardCount = std::atoi(Value);
+		}
+		else if (Name == "--from")
+		{
+			Options.FirstSeed = std::strtoll(Value, nullptr, 10);
+		}
+		else if (Name == "--to")
+		{
+			Options.LastSeed = std::strtoll(Value, nullptr, 10);
+		}
+		else if (Name == "--threads")
+		{
+			Options.Statistics.ThreadCount = std::atoi(Value);
+		}
+		else if (Name == "--checkpoint-seeds")
+		{
+			Options.CheckpointSeeds = std::strtoll(Value, nullptr, 10);
+		}
+		else if (Name == "--metrics")
+		{
+			Options.Statistics.Metrics = unsigned(std::strtoul(Value, nullptr, 0));
+		}
+		else if (Name == "--validate")
+		{
+			Options.Statistics.Validation = unsigned(std::strtoul(Value, nullptr, 0));
+		}
+		else if (Name == "--profile")
+		{
+			Profiler = std::make_unique<GenerationProfiler>(std::atoi(Value));
+			Options.Statistics.Profiler = Profiler.get();
+		}
+		else
+		{
+			std::fprintf(stderr, "Unknown option %s\n", Name.c_str());
+			return 2;
+		}
+	}
+
+	if (Options.Directory.empty())
+	{
+		std::fprintf(stderr, "%s needs --out <dir>\n", Command.c_str());
+		return 2;
+	}
+
+	if (Command == "sweep")
+	{
+		if (!bHasShard)
+		{
+			std::fprintf(stderr, "sweep needs --shard <i/N>\n");
+			return 2;
+		}
+
+		std::int64_t ShardFirst = 0, ShardLast = 0;
+		Options.Shard.GetRange(Options.FirstSeed, Options.LastSeed, ShardFirst, ShardLast);
+		Options.OnCheckpoint = [&](const SweepCheckpoint& Checkpoint)
+		{
+			std::printf("Shard %d/%d: %lld of %lld seeds\n", Checkpoint.Shard.Index, Checkpoint.Shard.Count, (long long)(Checkpoint.NextSeed - ShardFirst),
+				(long long)(ShardLast - ShardFirst + 1));
+			std::fflush(stdout);
+			return true;
+		};
+
+		const bool bComplete = SeedSweep(std::move(Options)).Run();
+		if (Profiler)
+		{
+			std::printf("%s", Profiler->FormatReport().c_str());
+		}
+		return bComplete ? 0 : 1;
+	}
+
+	if (Command == "merge")
+	{
+		auto Merged = std::make_unique<SweepCheckpoint>();
+		std::string Error;
+		if (!SeedSweep::Merge(Options.Directory, ShardCount, *Merged, Error))
+		{
+			std::fprintf(stderr, "%s\n", Error.c_str());
+			return 1;
+		}
+
+		const std::string Path = (std::filesystem::path(Options.Directory) / "merged.sweep").string();
+		if (!Merged->Save(Path))
+		{
+			std::fprintf(stderr, "Couldn't write %s\n", Path.c_str());
+			return 1;
+		}
+
+		std::printf("Merged %d shards, %llu seeds, into %s\n", ShardCount, (unsigned long long)Merged->Statistics.SeedCount, Path.c_str());
+		return 0;
+	}
+
+	std::fprintf(stderr, "Unknown command %s\n", Command.c_str());
+	return 2;
+}
@@ -0,0 +1,471 @@
+#include "similarityindex.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <queue>
+#include <thread>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/**
+* File layout, all little endian: SimilarityHeader, the signatures of every seed in order, then one BandEntry table per band sorted by Key.
+* Every table starts 64 byte aligned.
+*/
+namespace
+{
+	constexpr char SimilarityMagic[8] = { 'S', 'C', 'P', 'S', 'I', 'M', 'I', '1' };
+
+	struct SimilarityHeader
+	{
+		char Magic[8];
+		std::uint32_t RuleSet;
+		std::uint32_t Bands;
+		std::uint32_t RowsPerBand;
+		std::uint32_t SignatureWords;
+		std::int64_t FirstSeed;
+		std::uint64_t SeedCount;
+		std::uint64_t SignatureOffset;
+		std::uint64_t BandOffset;
+		std::uint64_t Reserved;
+	};
+
+	struct BandEntry
+	{
+		std::uint32_t Key;
+		/** Seed - FirstSeed */
+		std::uint32_t Index;
+	};
+
+	static_assert(sizeof(SimilarityHeader) == 64 && sizeof(BandEntry) == 8 && sizeof(LayoutSignature) == 256, "Index structs can't have padding");
+
+	/** Xor and odd multiplier for every MinHash function */
+	struct MinHashConstants
+	{
+		alignas(64) std::uint32_t Xors[SimilarityIndexBuilder::MaxHashes];
+		alignas(64) std::uint32_t Multipliers[SimilarityIndexBuilder::MaxHashes];
+	};
+
+	constexpr MinHashConstants HashConstants = []()
+	{
+		MinHashConstants Constants{};
+		std::uint64_t State = 0x5C9B00D5EEDull;
+		for (int i = 0; i < SimilarityIndexBuilder::MaxHashes; i++)
+		{
+			// splitmix64
+			State += 0x9E3779B97F4A7C15ull;
+			std::uint64_t Value = State;
+			Value = (Value ^ (Value >> 30)) * 0xBF58476D1CE4E5B9ull;
+			Value = (Value ^ (Value >> 27)) * 0x94D049BB133111EBull;
+			Value ^= Value >> 31;
+
+			Constants.Xors[i] = std::uint32_t(Value);
+			Constants.Multipliers[i] = std::uint32_t(Value >> 32) | 1;
+		}
+		return Constants;
+	}();
+
+	/** murmur3's finaliser */
+	std::uint32_t MixBits(std::uint32_t Value)
+	{
+		Value ^= Value >> 16;
+		Value *= 0x85EBCA6Bu;
+		Value ^= Value >> 13;
+		Value *= 0xC2B2AE35u;
+		Value ^= Value >> 16;
+		return Value;
+	}
+
+	/** One bucket key per band, each the hash of the band's RowsPerBand MinHashes over the signature's set bits */
+	void ComputeBandKeys(const LayoutSignature& Signature, int Bands, int RowsPerBand, std::uint32_t* OutKeys)
+	{
+		const int HashCount = Bands * RowsPerBand;
+		alignas(64) std::uint32_t Minimums[SimilarityIndexBuilder::MaxHashes];
+		std::fill(Minimums, Minimums + HashCount, UINT32_MAX);
+
+		for (int Word = 0; Word < LayoutSignature::WordCount; Word++)
+		{
+			for (std::uint64_t Bits = Signature.Words[Word]; Bits; Bits &= Bits - 1)
+			{
+				const std::uint32_t Element = MixBits(std::uint32_t(Word * 64 + std::countr_zero(Bits)) + 1);
+
+				// No dependency between hash functions, so this vectorises
+				for (int i = 0; i < HashCount; i++)
+				{
+					std::uint32_t Hash = (Element ^ HashConstants.Xors[i]) * HashConstants.Multipliers[i];
+					Hash ^= Hash >> 16;
+					Minimums[i] = std::min(Minimums[i], Hash);
+				}
+			}
+		}
+
+		for (int Band = 0; Band < Bands; Band++)
+		{
+			std::uint32_t Key = 2166136261u;
+			for (int Row = 0; Row < RowsPerBand; Row++)
+			{
+				Key = MixBits(Key ^ Minimums[Band * RowsPerBand + Row]);
+			}
+			OutKeys[Band] = Key;
+		}
+	}
+
+	enum class BitOperation
+	{
+		Xor,
+		And,
+		Or
+	};
+
+	/** popcount(A op B) over the whole signature */
+	template<BitOperation Operation>
+	int CountBits(const LayoutSignature& A, const LayoutSignature& B)
+	{
+#if defined(__AVX512VPOPCNTDQ__) && defined(__AVX512F__)
+		__m512i Sum = _mm512_setzero_si512();
+		for (int i = 0; i < LayoutSignature::WordCount; i += 8)
+		{
+			const __m512i Left = _mm512_loadu_si512(&A.Words[i]);
+			const __m512i Right = _mm512_loadu_si512(&B.Words[i]);
+			__m512i Combined;
+			if constexpr (Operation == BitOperation::Xor) Combined = _mm512_xor_si512(Left, Right);
+			else if constexpr (Operation == BitOperation::And) Combined = _mm512_and_si512(Left, Right);
+			else Combined = _mm512_or_si512(Left, Right);
+			Sum = _mm512_add_epi64(Sum, _mm512_popcnt_epi64(Combined));
+		}
+		return int(_mm512_reduce_add_epi64(Sum));
+#elif defined(__AVX2__)
+		// Nibble lookup popcount, summed per 64 bit lane with SAD
+		const __m256i Lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+		const __m256i LowNibbles = _mm256_set1_epi8(0x0F);
+		__m256i Sum = _mm256_setzero_si256();
+		for (int i = 0; i < LayoutSignature::WordCount; i += 4)
+		{
+			const __m256i Left = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&A.Words[i]));
+			const __m256i Right = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&B.Words[i]));
+			__m256i Combined;
+			if constexpr (Operation == BitOperation::Xor) Combined = _mm256_xor_si256(Left, Right);
+			else if constexpr (Operation == BitOperation::And) Combined = _mm256_and_si256(Left, Right);
+			else Combined = _mm256_or_si256(Left, Right);
+
+			const __m256i Counts = _mm256_add_epi8(_mm256_shuffle_epi8(Lookup, _mm256_and_si256(Combined, LowNibbles)),
+				_mm256_shuffle_epi8(Lookup, _mm256_and_si256(_mm256_srli_epi16(Combined, 4), LowNibbles)));
+			Sum = _mm256_add_epi64(Sum, _mm256_sad_epu8(Counts, _mm256_setzero_si256()));
+		}
+		return int(_mm256_extract_epi64(Sum, 0) + _mm256_extract_epi64(Sum, 1) + _mm256_extract_epi64(Sum, 2) + _mm256_extract_epi64(Sum, 3));
+#else
+		int Count = 0;
+		for (int i = 0; i < LayoutSignature::WordCount; i++)
+		{
+			if constexpr (Operation == BitOperation::Xor) Count += std::popcount(A.Words[i] ^ B.Words[i]);
+			else if constexpr (Operation == BitOperation::And) Count += std::popcount(A.Words[i] & B.Words[i]);
+			else Count += std::popcount(A.Words[i] | B.Words[i]);
+		}
+		return Count;
+#endif
+	}
+
+	double GetDistance(const LayoutSignature& A, const LayoutSignature& B, LayoutMetric Metric)
+	{
+		return Metric == LayoutMetric::Hamming ? double(LayoutSignature::GetHammingDistance(A, B)) : LayoutSignature::GetJaccardDistance(A, B);
+	}
+
+	bool IsCloser(const SimilarMap& A, const SimilarMap& B)
+	{
+		return A.Distance < B.Distance || (A.Distance == B.Distance && A.Seed < B.Seed);
+	}
+
+	/** Keeps the K closest of whatever it's offered */
+	class NearestSet
+	{
+	public:
+		explicit NearestSet(size_t InK) : K(InK) {}
+
+		void Offer(int Seed, double Distance)
+		{
+			const SimilarMap Candidate{ Seed, Distance };
+			if (Heap.size() < K)
+			{
+				Heap.push(Candidate);
+			}
+			else if (K > 0 && IsCloser(Candidate, Heap.top()))
+			{
+				Heap.pop();
+				Heap.push(Candidate);
+			}
+		}
+
+		std::vector<SimilarMap> Take()
+		{
+			std::vector<SimilarMap> Result;
+			Result.reserve(Heap.size());
+			for (; !Heap.empty(); Heap.pop())
+			{
+				Result.push_back(Heap.top());
+			}
+			std::reverse(Result.begin(), Result.end());
+			return Result;
+		}
+
+	private:
+		struct FurthestFirst
+		{
+			bool operator()(const SimilarMap& A, const SimilarMap& B) const { return IsCloser(A, B); }
+		};
+
+		size_t K;
+		std::priority_queue<SimilarMap, std::vector<SimilarMap>, FurthestFirst> Heap;
+	};
+}
+
+LayoutSignature LayoutSignature::FromGenerator(Generator& Gen)
+{
+	LayoutSignature Signature;
+	for (int X = 0; X <= MapWidth; X++)
+	{
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			const RoomArrayEntry& Entry = Gen.GetDataAtCoordinate(X, Y);
+			if (Entry.GridType > 0 && Entry.RoomType >= RoomType::Room1 && Entry.RoomType <= RoomType::Room4)
+			{
+				const int Bit = (Entry.RoomType - RoomType::Room1) * PlaneWords * 64 + X * (MapHeight + 1) + Y;
+				Signature.Words[Bit / 64] |= std::uint64_t(1) << (Bit % 64);
+			}
+		}
+	}
+	return Signature;
+}
+
+LayoutSignature LayoutSignature::FromMap(const GeneratedMap& Map)
+{
+	LayoutSignature Signature;
+	for (int X = 0; X <= MapWidth; X++)
+	{
+		for (int Y = 0; Y <= MapHeight; Y++)
+		{
+			const RoomArrayEntry& Entry = Map.Rooms[X][Y];
+			if (Entry.GridType > 0 && Entry.RoomType >= RoomType::Room1 && Entry.RoomType <= RoomType::Room4)
+			{
+				const int Bit = (Entry.RoomType - RoomType::Room1) * PlaneWords * 64 + X * (MapHeight + 1) + Y;
+				Signature.Words[Bit / 64] |= std::uint64_t(1) << (Bit % 64);
+			}
+		}
+	}
+	return Signature;
+}
+
+int LayoutSignature::GetHammingDistance(const LayoutSignature& A, const LayoutSignature& B)
+{
+	return CountBits<BitOperation::Xor>(A, B);
+}
+
+double LayoutSignature::GetJaccardDistance(const LayoutSignature& A, const LayoutSignature& B)
+{
+	const int Union = CountBits<BitOperation::Or>(A, B);
+	return Union ? 1.0 - double(CountBits<BitOperation::And>(A, B)) / double(Union) : 0.0;
+}
+
+int LayoutSignature::GetRoomCount() const
+{
+	int Count = 0;
+	for (std::uint64_t Word : Words)
+	{
+		Count += std::popcount(Word);
+	}
+	return Count;
+}
+
+SimilarityIndexBuilder::SimilarityIndexBuilder(SimilarityIndexBuildOptions InOptions)
+	: Options(InOptions)
+{
+}
+
+bool SimilarityIndexBuilder::Build(std::int64_t FirstSeed, std::int64_t LastSeed, const std::string& Path)
+{
+	FirstSeed = std::max<std::int64_t>(FirstSeed, 0);
+	LastSeed = std::min<std::int64_t>(LastSeed, INT_MAX);
+	const int Bands = std::clamp(Options.Bands, 1, MaxHashes);
+	const int RowsPerBand = std::clamp(Options.RowsPerBand, 1, MaxHashes / Bands);
+
+	std::ofstream Out(Path, std::ios::binary | std::ios::trunc);
+	if (!Out)
+	{
+		return false;
+	}
+
+	const std::uint64_t SeedCount = std::uint64_t(std::max<std::int64_t>(LastSeed - FirstSeed + 1, 0));
+	std::vector<LayoutSignature> Signatures(SeedCount);
+	std::vector<std::uint32_t> Keys(SeedCount * Bands);
+
+	constexpr std::int64_t ChunkSeeds = 4096;
+	std::atomic<std::uint64_t> NextChunk = 0;
+	auto Worker = [&]()
+	{
+		Generator Gen(false, Options.RuleSet);
+		for (std::uint64_t Start = NextChunk.fetch_add(ChunkSeeds); Start < SeedCount; Start = NextChunk.fetch_add(ChunkSeeds))
+		{
+			const std::uint64_t End = std::min<std::uint64_t>(Start + ChunkSeeds, SeedCount);
+			for (std::uint64_t Index = Start; Index < End; Index++)
+			{
+				Gen.GenerateMapUntil(int(FirstSeed + std::int64_t(Index)), GenerationStage::PredefinedRooms);
+				Signatures[Index] = LayoutSignature::FromGenerator(Gen);
+				ComputeBandKeys(Signatures[Index], Bands, RowsPerBand, &Keys[Index * Bands]);
+			}
+		}
+	};
+
+	const int ThreadCount = Options.ThreadCount > 0 ? Options.ThreadCount : int(std::max(1u, std::thread::hardware_concurrency()));
+	std::vector<std::thread> Threads;
+	for (int i = 0; i < ThreadCount; i++)
+	{
+		Threads.emplace_back(Worker);
+	}
+	for (std::thread& Thread : Threads)
+	{
+		Thread.join();
+	}
+
+	SimilarityHeader Header{};
+	std::memcpy(Header.Magic, SimilarityMagic, sizeof(SimilarityMagic));
+	Header.RuleSet = std::uint32_t(Options.RuleSet);
+	Header.Bands = std::uint32_t(Bands);
+	Header.RowsPerBand = std::uint32_t(RowsPerBand);
+	Header.SignatureWords = LayoutSignature::WordCount;
+	Header.FirstSeed = FirstSeed;
+	Header.SeedCount = SeedCount;
+	Header.SignatureOffset = sizeof(SimilarityHeader);
+	Header.BandOffset = Header.SignatureOffset + SeedCount * sizeof(LayoutSignature);
+	Out.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+	Out.write(reinterpret_cast<const char*>(Signatures.data()), std::streamsize(SeedCount * sizeof(LayoutSignature)));
+
+	std::vector<BandEntry> Entries(SeedCount);
+	for (int Band = 0; Band < Bands; Band++)
+	{
+		for (std::uint64_t Index = 0; Index < SeedCount; Index++)
+		{
+			Entries[Index] = { Keys[Index * Bands + Band], std::uint32_t(Index) };
+		}
+		std::sort(Entries.begin(), Entries.end(), [](const BandEntry& A, const BandEntry& B) { return A.Key < B.Key || (A.Key == B.Key && A.Index < B.Index); });
+		Out.write(reinterpret_cast<const char*>(Entries.data()), std::streamsize(SeedCount * sizeof(BandEntry)));
+	}
+
+	return bool(Out.flush());
+}
+
+bool SimilarityIndex::Open(const std::string& Path)
+{
+	if (!File.Open(Path))
+	{
+		return false;
+	}
+
+	const SimilarityHeader* Header = File.At<SimilarityHeader>(0);
+	const bool bValid = File.GetSize() >= sizeof(SimilarityHeader) && std::memcmp(Header->Magic, SimilarityMagic, sizeof(SimilarityMagic)) == 0 &&
+		Header->SignatureWords == LayoutSignature::WordCount && Header->Bands * Header->RowsPerBand <= SimilarityIndexBuilder::MaxHashes &&
+		Header->BandOffset + Header->SeedCount * Header->Bands * sizeof(BandEntry) == File.GetSize();
+	if (!bValid)
+	{
+		File.Close();
+	}
+	return bValid;
+}
+
+bool SimilarityIndex::IsOpen() const
+{
+	return File.IsOpen();
+}
+
+std::int64_t SimilarityIndex::GetFirstSeed() const
+{
+	return IsOpen() ? File.At<SimilarityHeader>(0)->FirstSeed : 0;
+}
+
+std::int64_t SimilarityIndex::GetLastSeed() const
+{
+	return IsOpen() ? GetFirstSeed() + std::int64_t(File.At<SimilarityHeader>(0)->SeedCount) - 1 : -1;
+}
+
+bool SimilarityIndex::GetSignature(int Seed, LayoutSignature& OutSignature) const
+{
+	if (!IsOpen() || Seed < GetFirstSeed() || Seed > GetLastSeed())
+	{
+		return false;
+	}
+
+	const SimilarityHeader* Header = File.At<SimilarityHeader>(0);
+	std::memcpy(&OutSignature, File.At<LayoutSignature>(Header->SignatureOffset + std::uint64_t(Seed - Header->FirstSeed) * sizeof(LayoutSignature)),
+		sizeof(LayoutSignature));
+	return true;
+}
+
+void SimilarityIndex::GatherCandidates(const LayoutSignature& Reference, std::vector<std::uint32_t>& OutIndices) const
+{
+	OutIndices.clear();
+	if (!IsOpen())
+	{
+		return;
+	}
+
+	const SimilarityHeader* Header = File.At<SimilarityHeader>(0);
+	std::uint32_t Keys[SimilarityIndexBuilder::MaxHashes];
+	ComputeBandKeys(Reference, int(Header->Bands), int(Header->RowsPerBand), Keys);
+
+	for (std::uint32_t Band = 0; Band < Header->Bands; Band++)
+	{
+		const BandEntry* Table = File.At<BandEntry>(Header->BandOffset + std::uint64_t(Band) * Header->SeedCount * sizeof(BandEntry));
+		auto [First, Last] = std::equal_range(Table, Table + Header->SeedCount, BandEntry{ Keys[Band], 0 },
+			[](const BandEntry& A, const BandEntry& B) { return A.Key < B.Key; });
+		for (const BandEntry* Entry = First; Entry != Last; Entry++)
+		{
+			OutIndices.push_back(Entry->Index);
+		}
+	}
+
+	std::sort(OutIndices.begin(), OutIndices.end());
+	OutIndices.erase(std::unique(OutIndices.begin(), OutIndices.end()), OutIndices.end());
+}
+
+std::vector<SimilarMap> SimilarityIndex::FindNearest(const LayoutSignature& Reference, size_t K, LayoutMetric Metric) const
+{
+	std::vector<std::uint32_t> Candidates;
+	GatherCandidates(Reference, Candidates);
+
+	NearestSet Nearest(K);
+	LayoutSignature Signature;
+	for (std::uint32_t Index : Candidates)
+	{
+		const int Seed = int(GetFirstSeed() + Index);
+		GetSignature(Seed, Signature);
+		Nearest.Offer(Seed, GetDistance(Reference, Signature, Metric));
+	}
+	return Nearest.Take();
+}
+
+std::vector<SimilarMap> SimilarityIndex::FindNearestExact(const LayoutSignature& Reference, size_t K, LayoutMetric Metric) const
+{
+	NearestSet Nearest(K);
+	if (!IsOpen())
+	{
+		return Nearest.Take();
+	}
+
+	const SimilarityHeader* Header = File.At<SimilarityHeader>(0);
+	const LayoutSignature* Signatures = File.At<LayoutSignature>(Header->SignatureOffset);
+	for (std::uint64_t Index = 0; Index < Header->SeedCount; Index++)
+	{
+		Nearest.Offer(int(Header->FirstSeed + std::int64_t(Index)), GetDistance(Reference, Signatures[Index], Metric));
+	}
+	return Nearest.Take();
+}
+
+size_t SimilarityIndex::CountCandidates(const LayoutSignature& Reference) const
+{
+	std::vector<std::uint32_t> Candidates;
+	GatherCandidates(Reference, Candidates);
+	return Candidates.size();
+}
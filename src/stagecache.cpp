@@ -0,0 +1,319 @@
+#include "stagecache.h"
+#include "metrics.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+namespace
+{
+	constexpr char CacheMagic[8] = { 'S', 'C', 'P', 'S', 'T', 'G', 'C', '1' };
+	constexpr int CellCount = (MapWidth + 1) * (MapHeight + 1);
+
+	/** GridType 255 gets the first code after the neighbour counts, so a cell's grid and room type fit in one byte */
+	constexpr std::uint8_t CheckpointCode = 5;
+
+	struct CacheFileHeader
+	{
+		char Magic[8];
+		std::uint64_t LayoutHash;
+		std::uint32_t RecordSize;
+		std::uint32_t Reserved;
+	};
+
+	struct CachedLayout
+	{
+		std::int32_t Seed;
+		std::int32_t RndState;
+
+		/** Room1 to Room4 amounts, [RoomType - Room1][Zone] */
+		std::uint8_t Amounts[5][ZoneAmount];
+
+		/** Grid type code in the low 3 bits and room type in the next 3, X major */
+		std::uint8_t Cells[CellCount];
+	};
+
+	static_assert(sizeof(CacheFileHeader) == 24 && sizeof(CachedLayout) == 384, "Cache records can't have padding");
+
+	std::string GetCacheFileName(std::uint64_t LayoutHash)
+	{
+		char Name[32];
+		std::snprintf(Name, sizeof(Name), "layout-%016llx.cache", (unsigned long long)LayoutHash);
+		return Name;
+	}
+
+	bool PackLayout(const LayoutStageResult& Layout, CachedLayout& OutRecord)
+	{
+		OutRecord = {};
+		OutRecord.Seed = Layout.Seed;
+		OutRecord.RndState = Layout.RndState;
+
+		const int* Amounts[5] = { Layout.Room1Amount, Layout.Room2Amount, Layout.Room2CAmount, Layout.Room3Amount, Layout.Room4Amount };
+		for (int Type = 0; Type < 5; Type++)
+		{
+			for (int Zone = 0; Zone < ZoneAmount; Zone++)
+			{
+				if (Amounts[Type][Zone] < 0 || Amounts[Type][Zone] > 255)
+				{
+					return false;
+				}
+				OutRecord.Amounts[Type][Zone] = std::uint8_t(Amounts[Type][Zone]);
+			}
+		}
+
+		for (int X = 0; X <= MapWidth; X++)
+		{
+			for (int Y = 0; Y <= MapHeight; Y++)
+			{
+				const std::uint8_t GridType = Layout.GridType[X][Y];
+				const std::uint8_t Type = Layout.RoomTypes[X][Y];
+				if ((GridType >= CheckpointCode && GridType != 255) || Type > RoomType::Room4)
+				{
+					return false;
+				}
+				OutRecord.Cells[X * (MapHeight + 1) + Y] = std::uint8_t((GridType == 255 ? CheckpointCode : GridType) | (Type << 3));
+			}
+		}
+
+		return true;
+	}
+
+	void UnpackLayout(const CachedLayout& Record, LayoutStageResult& OutLayout)
+	{
+		OutLayout.Seed = Record.Seed;
+		OutLayout.RndState = Record.RndState;
+
+		int* Amounts[5] = { OutLayout.Room1Amount, OutLayout.Room2Amount, OutLayout.Room2CAmount, OutLayout.Room3Amount, OutLayout.Room4Amount };
+		for (int Type = 0; Type < 5; Type++)
+		{
+			for (int Zone = 0; Zone < ZoneAmount; Zone++)
+			{
+				Amounts[Type][Zone] = Record.Amounts[Type][Zone];
+			}
+		}
+
+		for (int X = 0; X <= MapWidth; X++)
+		{
+			for (int Y = 0; Y <= MapHeight; Y++)
+			{
+				const std::uint8_t Cell = Record.Cells[X * (MapHeight + 1) + Y];
+				const std::uint8_t GridType = Cell & 7;
+				OutLayout.GridType[X][Y] = GridType == CheckpointCode ? 255 : GridType;
+				OutLayout.RoomTypes[X][Y] = Cell >> 3;
+			}
+		}
+	}
+}
+
+StageCache::~StageCache()
+{
+	Close();
+}
+
+bool StageCache::Open(const std::string& InDirectory, GeneratorRuleSet RuleSet)
+{
+	return Open(InDirectory, Generator::GetLayoutStageHash(RuleSet));
+}
+
+bool StageCache::Open(const std::string& InDirectory, std::uint64_t InLayoutHash)
+{
+	Close();
+
+	std::lock_guard<std::mutex> Lock(Mutex);
+	std::error_code Error;
+	std::filesystem::create_directories(InDirectory, Error);
+
+	Directory = InDirectory;
+	LayoutHash = InLayoutHash;
+	const std::filesystem::path Path = std::filesystem::path(Directory) / GetCacheFileName(LayoutHash);
+
+	// Anything that isn't a whole, matching file gets started over, it's only a cache
+	CacheFileHeader Header{};
+	std::uint64_t RecordCount = 0;
+	{
+		std::ifstream Existing(Path, std::ios::binary);
+		const std::uint64_t Size = Existing ? std::filesystem::file_size(Path, Error) : 0;
+		const bool bValid = Existing.read(reinterpret_cast<char*>(&Header), sizeof(Header)) && std::memcmp(Header.Magic, CacheMagic, sizeof(CacheMagic)) == 0 &&
+			Header.LayoutHash == LayoutHash && Header.RecordSize == sizeof(CachedLayout);
+
+		if (bValid)
+		{
+			RecordCount = (Size - sizeof(Header)) / sizeof(CachedLayout);
+
+			// Records are read in batches, only their seeds are needed for the index
+			std::vector<CachedLayout> Batch(1024);
+			for (std::uint64_t First = 0; First < RecordCount; First += Batch.size())
+			{
+				const size_t Count = size_t(std::min<std::uint64_t>(Batch.size(), RecordCount - First));
+				if (!Existing.read(reinterpret_cast<char*>(Batch.data()), std::streamsize(sizeof(CachedLayout) * Count)))
+				{
+					RecordCount = First;
+					break;
+				}
+
+				for (size_t i = 0; i < Count; i++)
+				{
+					Records.emplace(Batch[i].Seed, std::uint32_t(First + i));
+				}
+			}
+		}
+		else
+		{
+			std::memcpy(Header.Magic, CacheMagic, sizeof(CacheMagic));
+			Header.LayoutHash = LayoutHash;
+			Header.RecordSize = sizeof(CachedLayout);
+			Header.Reserved = 0;
+		}
+	}
+
+	if (RecordCount == 0)
+	{
+		std::ofstream Created(Path, std::ios::binary | std::ios::trunc);
+		Created.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+		if (!Created)
+		{
+			return false;
+		}
+	}
+	else
+	{
+		// Drops a record that was only partly written
+		std::filesystem::resize_file(Path, sizeof(Header) + RecordCount * sizeof(CachedLayout), Error);
+	}
+
+	File.open(Path, std::ios::binary | std::ios::in | std::ios::out);
+	return File.is_open();
+}
+
+void StageCache::Close()
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	if (File.is_open())
+	{
+		File.close();
+	}
+	Records.clear();
+	Stats = {};
+}
+
+bool StageCache::Find(int Seed, LayoutStageResult& OutLayout)
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+
+	auto Found = Records.find(Seed);
+	if (Found == Records.end())
+	{
+		Stats.Misses++;
+		if constexpr (bMetricsEnabled)
+		{
+			Metrics::Get().Count(CounterStageCacheMisses);
+		}
+		return false;
+	}
+
+	CachedLayout Record;
+	File.seekg(std::streamoff(sizeof(CacheFileHeader) + std::uint64_t(Found->second) * sizeof(CachedLayout)));
+	if (!File.read(reinterpret_cast<char*>(&Record), sizeof(Record)) || Record.Seed != Seed)
+	{
+		File.clear();
+		Stats.Misses++;
+		if constexpr (bMetricsEnabled)
+		{
+			Metrics::Get().Count(CounterStageCacheMisses);
+		}
+		return false;
+	}
+
+	UnpackLayout(Record, OutLayout);
+	Stats.Hits++;
+	if constexpr (bMetricsEnabled)
+	{
+		Metrics::Get().Count(CounterStageCacheHits);
+	}
+	return true;
+}
+
+bool StageCache::Store(const LayoutStageResult& Layout)
+{
+	CachedLayout Record;
+	if (!PackLayout(Layout, Record))
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> Lock(Mutex);
+	if (!File.is_open() || Records.count(Layout.Seed))
+	{
+		return false;
+	}
+
+	const std::uint32_t Index = std::uint32_t(Records.size());
+	File.seekp(std::streamoff(sizeof(CacheFileHeader) + std::uint64_t(Index) * sizeof(CachedLayout)));
+	if (!File.write(reinterpret_cast<const char*>(&Record), sizeof(Record)))
+	{
+		File.clear();
+		return false;
+	}
+
+	Records.emplace(Layout.Seed, Index);
+	Stats.Stores++;
+	return true;
+}
+
+void StageCache::GenerateMap(Generator& Gen, int Seed)
+{
+	if (!IsOpen() || Generator::GetLayoutStageHash(Gen.GetRuleSet()) != LayoutHash)
+	{
+		Gen.GenerateMap(Seed);
+		return;
+	}
+
+	LayoutStageResult Layout;
+	if (Find(Seed, Layout))
+	{
+		Gen.GenerateMapFromLayout(Layout);
+		return;
+	}
+
+	// The generator is left at the stage boundary, so the map carries on from the layout that gets stored
+	Gen.GenerateLayoutStage(Seed, Layout);
+	Store(Layout);
+	Gen.ContinueMapUntil(GenerationStage::Done);
+}
+
+void StageCache::Flush()
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	File.flush();
+}
+
+int StageCache::RemoveStaleFiles()
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+
+	const std::string Current = GetCacheFileName(LayoutHash);
+	int Removed = 0;
+	std::error_code Error;
+	for (const std::filesystem::directory_entry& Entry : std::filesystem::directory_iterator(Directory, Error))
+	{
+		const std::string Name = Entry.path().filename().string();
+		if (Name != Current && Name.rfind("layout-", 0) == 0 && Entry.path().extension() == ".cache" && std::filesystem::remove(Entry.path(), Error))
+		{
+			Removed++;
+		}
+	}
+	return Removed;
+}
+
+size_t StageCache::GetEntryCount() const
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	return Records.size();
+}
+
+StageCacheStats StageCache::GetStats() const
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	return Stats;
+}
@@ -4,6 +4,34 @@
 #include "config.h"
 #include "testdata.h"
 #include "generator.h"
+#include "batchgenerator.h"
+#include "generationtask.h"
+#include "seedstatistics.h"
+#include "maprenderer.h"
+#include "logger.h"
+#include "pregenerationpool.h"
+#include "seedindex.h"
+#include "maparchive.h"
+#include "mapvalidator.h"
+#include "stagecache.h"
+#include "exactmath.h"
+#include "seedsweep.h"
+#include "perfcounters.h"
+#include "similarityindex.h"
+#include "roomlocator.h"
+#include "metrics.h"
+#include "bakedmaps.h"
+#include "divergencebisector.h"
+#include "mappublisher.h"
+#include "loadtest.h"
+
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <thread>
 
 // ADD BACK MyMap, DONTBLINK, d9341, JORGE, dirtymetal
 
@@ -30,4 +58,1423 @@ TEST(MapGeneration, MyMap)
             EXPECT_EQ(RoomEntry.RoomZone, TestData.RoomZone) << "Invalid room type on " << RoomEntry.PosX << ", " << RoomEntry.PosY << ". Test Data Room: " << TestData.RoomName;
         }
     }
-}
\ No newline at end of file
+}
+
+TEST(BatchGeneration, MatchesScalarLayout)
+{
+    std::vector<int> Seeds;
+    for (int i = 0; i < 4096; i++)
+    {
+        Seeds.push_back(i * 7919);
+    }
+
+    std::vector<LayoutStageResult> BatchResults(Seeds.size());
+    BatchGenerator Batch;
+    Batch.GenerateLayouts(Seeds.data(), int(Seeds.size()), BatchResults.data());
+
+    Generator Gen(false);
+    for (size_t i = 0; i < Seeds.size(); i++)
+    {
+        LayoutStageResult Expected;
+        Gen.GenerateLayoutStage(Seeds[i], Expected);
+
+        const LayoutStageResult& Actual = BatchResults[i];
+        ASSERT_EQ(Actual.Seed, Expected.Seed);
+        EXPECT_EQ(Actual.RndState, Expected.RndState) << "Seed " << Seeds[i] << " on " << Batch.GetInstructionSetName();
+        EXPECT_EQ(Actual.GridType, Expected.GridType) << "Seed " << Seeds[i] << " on " << Batch.GetInstructionSetName();
+        EXPECT_EQ(Actual.RoomTypes, Expected.RoomTypes) << "Seed " << Seeds[i] << " on " << Batch.GetInstructionSetName();
+
+        for (int Zone = 0; Zone < ZoneAmount; Zone++)
+        {
+            EXPECT_EQ(Actual.Room1Amount[Zone], Expected.Room1Amount[Zone]) << "Seed " << Seeds[i];
+            EXPECT_EQ(Actual.Room2Amount[Zone], Expected.Room2Amount[Zone]) << "Seed " << Seeds[i];
+            EXPECT_EQ(Actual.Room2CAmount[Zone], Expected.Room2CAmount[Zone]) << "Seed " << Seeds[i];
+            EXPECT_EQ(Actual.Room3Amount[Zone], Expected.Room3Amount[Zone]) << "Seed " << Seeds[i];
+            EXPECT_EQ(Actual.Room4Amount[Zone], Expected.Room4Amount[Zone]) << "Seed " << Seeds[i];
+        }
+    }
+}
+
+TEST(BatchGeneration, FinishesToSameMap)
+{
+    Generator Gen(false);
+    int Seed = Gen.GenerateSeed("MyMap");
+
+    LayoutStageResult Layout;
+    BatchGenerator Batch;
+    Batch.GenerateLayouts(&Seed, 1, &Layout);
+
+    Generator Expected(false);
+    Expected.GenerateMap("MyMap");
+    Gen.GenerateMapFromLayout(Layout);
+
+    for (int X = 0; X <= MapWidth; X++)
+    {
+        for (int Y = 0; Y <= MapHeight; Y++)
+        {
+            RoomArrayEntry& ExpectedEntry = Expected.GetDataAtCoordinate(X, Y);
+            RoomArrayEntry& RoomEntry = Gen.GetDataAtCoordinate(X, Y);
+
+            EXPECT_EQ(RoomEntry.RoomName, ExpectedEntry.RoomName);
+            EXPECT_EQ(RoomEntry.GridType, ExpectedEntry.GridType) << "Invalid grid type on " << X << ", " << Y;
+            EXPECT_EQ(RoomEntry.RoomType, ExpectedEntry.RoomType) << "Invalid room type on " << X << ", " << Y;
+            EXPECT_EQ(RoomEntry.RoomZone, ExpectedEntry.RoomZone) << "Invalid zone on " << X << ", " << Y;
+            EXPECT_EQ(RoomEntry.RoomRotation, ExpectedEntry.RoomRotation) << "Invalid rotation on " << X << ", " << Y;
+        }
+    }
+}
+
+TEST(BlitzRandom, MatchesUnbufferedSequence)
+{
+    BlitzRandom Random;
+    int Expected = BlitzRandSeedState(12345);
+    Random.Seed(12345);
+
+    for (int i = 0; i < BlitzRandom::BlockSize * 40; i++)
+    {
+        // Jump around mid block too, restoring a state must drop whatever was precomputed
+        if (i % 173 == 0)
+        {
+            Random.SetState(Expected);
+        }
+
+        Expected = BlitzRandNextState(Expected);
+        EXPECT_EQ(Random.Rand(1, 1000), int(BlitzRandToFloat(Expected) * 1000) + 1);
+        ASSERT_EQ(Random.GetState(), Expected) << "Draw " << i;
+    }
+}
+
+template<int... Percents>
+static void ExpectFloorPercentsMatch(std::integer_sequence<int, Percents...>)
+{
+    ([]()
+    {
+        int Mismatches = 0;
+        for (int Value = 0; Value < (1 << 24); Value++)
+        {
+            Mismatches += ExactMath::FloorPercent<Percents>(Value) != int(std::floor(Percents / 100.0 * double(float(Value))));
+        }
+        EXPECT_EQ(Mismatches, 0) << Percents << "%";
+    }(), ...);
+}
+
+TEST(ExactMath, MatchesFloatingPoint)
+{
+    // Every fraction PlacePredefinedRooms uses, over every amount a float holds exactly. 0.7 * 90 is 62.99.. as a double, so this isn't just Value * 7 / 10
+    ExpectFloorPercentsMatch(std::integer_sequence<int, 10, 15, 20, 25, 30, 40, 45, 50, 55, 60, 70, 80, 85, 90>{});
+
+    // Every value Rnd can return, against every range up to 1024 and the ones either side of each power of two after that
+    std::vector<int> Ranges;
+    for (int Range = 1; Range <= 1024; Range++)
+    {
+        Ranges.push_back(Range);
+    }
+    for (int Bit = 11; Bit < 24; Bit++)
+    {
+        Ranges.insert(Ranges.end(), { (1 << Bit) - 1, 1 << Bit, (1 << Bit) + 1 });
+    }
+    Ranges.push_back((1 << 24) - 1);
+
+    for (int Range : Ranges)
+    {
+        int Mismatches = 0;
+        for (int State = 0; State < 65536; State++)
+        {
+            Mismatches += ExactMath::ScaleRandState(State, Range) != int(BlitzRandToFloat(State) * Range);
+        }
+        EXPECT_EQ(Mismatches, 0) << "Range " << Range;
+    }
+
+    // The layout thresholds, over every coordinate a float holds exactly
+    int Mismatches = 0;
+    for (int Value = -(1 << 24); Value <= (1 << 24); Value++)
+    {
+        Mismatches += (Value * 5 > MapWidth * 3) != (Value > MapWidth * 0.6f);
+        Mismatches += (Value * 5 > MapWidth * 2) != (Value > MapWidth * 0.4f);
+        Mismatches += (Value * 3 < MapHeight * 2) != (Value < MapHeight * (2.0 / 3.0));
+    }
+    EXPECT_EQ(Mismatches, 0);
+    EXPECT_EQ(MapHeight * 2 / 3 - 1, int(MapHeight * (2.0 / 3.0) - 1));
+    EXPECT_EQ(MapHeight * 2 / 3 + 1, int(MapHeight * (2.0 / 3.0) + 1));
+    for (int i = 0; i < ZoneAmount; i++)
+    {
+        EXPECT_EQ((MapHeight / ZoneAmount) * (3 - i) - 2, int(((MapHeight / ZoneAmount) * ((2 - i) + 1.0)) - 2));
+    }
+
+    for (int Y = -(1 << 20); Y <= (1 << 20); Y++)
+    {
+        float Value = float(MapWidth - Y);
+        int Zone = std::min(int(std::floor(Value / MapWidth * ZoneAmount)), ZoneAmount - 1);
+        ASSERT_EQ(Generator::GetMapZone(Y), Zone) << "Y " << Y;
+    }
+}
+
+TEST(GenerationTask, MatchesBlockingGeneration)
+{
+    for (const char* SeedStr : { "MyMap", "DONTBLINK", "d9341", "JORGE", "dirtymetal" })
+    {
+        Generator Expected(false);
+        Expected.GenerateMap(SeedStr);
+
+        Generator Gen(false);
+        GenerationTask Task = Gen.GenerateMapAsync(Gen.GenerateSeed(SeedStr));
+
+        // A zero budget runs a single step per call
+        int Steps = 0;
+        while (!Task.Advance(std::chrono::microseconds(0)))
+        {
+            Steps++;
+        }
+
+        EXPECT_GT(Steps, 1);
+        EXPECT_FALSE(Task.IsCancelled());
+        EXPECT_EQ(Task.GetStage(), GenerationStage::Done);
+
+        for (int X = 0; X <= MapWidth; X++)
+        {
+            for (int Y = 0; Y <= MapHeight; Y++)
+            {
+                RoomArrayEntry& ExpectedEntry = Expected.GetDataAtCoordinate(X, Y);
+                RoomArrayEntry& RoomEntry = Gen.GetDataAtCoordinate(X, Y);
+
+                EXPECT_EQ(RoomEntry.RoomName, ExpectedEntry.RoomName) << SeedStr;
+                EXPECT_EQ(RoomEntry.GridType, ExpectedEntry.GridType) << SeedStr << " " << X << ", " << Y;
+                EXPECT_EQ(RoomEntry.RoomType, ExpectedEntry.RoomType) << SeedStr << " " << X << ", " << Y;
+                EXPECT_EQ(RoomEntry.RoomZone, ExpectedEntry.RoomZone) << SeedStr << " " << X << ", " << Y;
+                EXPECT_EQ(RoomEntry.RoomRotation, ExpectedEntry.RoomRotation) << SeedStr << " " << X << ", " << Y;
+            }
+        }
+    }
+}
+
+TEST(GenerationTask, Cancel)
+{
+    Generator Gen(false);
+    std::stop_source StopSource;
+    GenerationTask Task = Gen.GenerateMapAsync(1234, StopSource.get_token());
+
+    EXPECT_FALSE(Task.Advance(std::chrono::microseconds(0)));
+    EXPECT_EQ(Task.GetStage(), GenerationStage::Layout);
+
+    StopSource.request_stop();
+    EXPECT_TRUE(Task.Advance(std::chrono::microseconds(1000)));
+    EXPECT_TRUE(Task.IsCancelled());
+
+    // The generator is free to use again straight away
+    GenerationTask Next = Gen.GenerateMapAsync(1234);
+    Next.RunToCompletion();
+    EXPECT_TRUE(Next.IsFinished());
+    EXPECT_FALSE(Next.IsCancelled());
+}
+
+TEST(SeedStatistics, MatchesDirectGeneration)
+{
+    SeedStatisticsOptions Options;
+    Options.ThreadCount = 3;
+    Options.ChunkSize = 100;
+    SeedStatistics Stats = SeedStatisticsEngine(Options).Run(0, 999);
+
+    // Layout amounts alone come from the BatchGenerator instead, they still have to agree
+    Options.Metrics = MetricLayoutRoomAmounts;
+    SeedStatistics LayoutStats = SeedStatisticsEngine(Options).Run(0, 999);
+
+    SeedStatistics Expected;
+    Generator Gen(false);
+    for (int Seed = 0; Seed <= 999; Seed++)
+    {
+        Gen.GenerateMap(Seed);
+        for (int Zone = 0; Zone < ZoneAmount; Zone++)
+        {
+            Expected.RoomAmounts[RoomType::Room1][Zone].Add(Gen.GetRoomAmount(RoomType::Room1, Zone));
+            Expected.Room4ForceFailed[Zone] += Gen.GetReport().bRoom4ForceFailed[Zone];
+        }
+        Expected.SetRoomFailures.Add(Gen.GetReport().SetRoomFailures);
+        Expected.Occupancy[RoomType::Room0][MapWidth / 2][MapHeight - 2] += Gen.GetDataAtCoordinate(MapWidth / 2, MapHeight - 2).GridType > 0;
+    }
+
+    EXPECT_EQ(Stats.SeedCount, 1000u);
+    EXPECT_EQ(LayoutStats.SeedCount, 1000u);
+    EXPECT_EQ(Stats.SetRoomFailures.GetTotal(), 1000u);
+    EXPECT_EQ(Stats.SetRoomFailures.GetMean(), Expected.SetRoomFailures.GetMean());
+    EXPECT_EQ(Stats.Occupancy[RoomType::Room0][MapWidth / 2][MapHeight - 2], Expected.Occupancy[RoomType::Room0][MapWidth / 2][MapHeight - 2]);
+
+    for (int Zone = 0; Zone < ZoneAmount; Zone++)
+    {
+        EXPECT_EQ(Stats.Room4ForceFailed[Zone], Expected.Room4ForceFailed[Zone]);
+        for (int Value = 0; Value <= CountHistogram::MaxValue; Value++)
+        {
+            EXPECT_EQ(Stats.RoomAmounts[RoomType::Room1][Zone].GetCount(Value), Expected.RoomAmounts[RoomType::Room1][Zone].GetCount(Value));
+            EXPECT_EQ(Stats.LayoutRoomAmounts[RoomType::Room3][Zone].GetCount(Value), LayoutStats.LayoutRoomAmounts[RoomType::Room3][Zone].GetCount(Value));
+        }
+    }
+}
+
+TEST(MapRenderer, MatchesOutputMapLayout)
+{
+    Generator Gen(false);
+    Gen.GenerateMap(1234);
+
+    std::string Expected;
+    char Cell[16];
+    for (int X = 0; X <= MapWidth; X++)
+    {
+        for (int Y = 0; Y <= MapHeight; Y++)
+        {
+            std::snprintf(Cell, sizeof(Cell), " %3d", Gen.GetDataAtCoordinate(X, Y).GridType);
+            Expected += Cell;
+        }
+        Expected += '\n';
+    }
+
+    std::string Text;
+    MapRenderer().Render(Gen, Text);
+    EXPECT_EQ(Text, Expected);
+
+    MapRenderOptions Options;
+    Options.Fields = RenderGridType | RenderRoomType | RenderName;
+    Options.NameWidth = 6;
+    Text.clear();
+    MapRenderer(Options).Render(Gen, Text);
+    EXPECT_EQ(Text.size(), size_t((MapWidth + 1) * ((MapHeight + 1) * (4 + 4 + 7) + 1)));
+}
+
+TEST(MapRenderer, AtlasImages)
+{
+    Generator Gen(false);
+    MapAtlas Atlas(4, 2);
+    for (int Seed = 0; Seed < 6; Seed++)
+    {
+        Gen.GenerateMap(Seed);
+        Atlas.AddMap(Gen);
+    }
+
+    const int TileSize = (MapWidth + 1) * 2 + 1;
+    EXPECT_EQ(Atlas.GetMapCount(), 6);
+    EXPECT_EQ(Atlas.GetWidth(), 4 * TileSize + 1);
+    EXPECT_EQ(Atlas.GetHeight(), 2 * TileSize + 1);
+
+    const std::filesystem::path Directory = std::filesystem::temp_directory_path();
+    const std::string PpmPath = (Directory / "scproomgen_atlas.ppm").string();
+    const std::string PngPath = (Directory / "scproomgen_atlas.png").string();
+    ASSERT_TRUE(Atlas.WritePPM(PpmPath));
+    ASSERT_TRUE(Atlas.WritePNG(PngPath));
+
+    std::string Header = "P6\n" + std::to_string(Atlas.GetWidth()) + " " + std::to_string(Atlas.GetHeight()) + "\n255\n";
+    EXPECT_EQ(std::filesystem::file_size(PpmPath), Header.size() + size_t(Atlas.GetWidth()) * Atlas.GetHeight() * 3);
+
+    char Signature[8];
+    std::ifstream(PngPath, std::ios::binary).read(Signature, sizeof(Signature));
+    EXPECT_EQ(std::string(Signature + 1, 3), "PNG");
+
+    std::filesystem::remove(PpmPath);
+    std::filesystem::remove(PngPath);
+
+    // Nothing to write without a map
+    MapAtlas Empty(4, 2);
+    EXPECT_FALSE(Empty.WritePPM(PpmPath));
+    EXPECT_FALSE(Empty.WritePNG(PngPath));
+}
+
+TEST(Logger, FormatsOnDrain)
+{
+    std::string Output;
+    Logger::Get().SetSink([&](std::string_view Text) { Output += Text; });
+
+    std::vector<std::thread> Threads;
+    for (int Thread = 0; Thread < 4; Thread++)
+    {
+        Threads.emplace_back([Thread]()
+        {
+            std::string Name = "room" + std::to_string(Thread);
+            for (int i = 0; i < 100; i++)
+            {
+                SCPROOMGEN_LOG(LogLevel::Warning, "%s %d %.1f", Name, i, 0.5);
+            }
+        });
+    }
+    for (std::thread& Thread : Threads)
+    {
+        Thread.join();
+    }
+
+    Logger::Get().Flush();
+    Logger::Get().SetSink(nullptr);
+
+    // Every thread's messages come out whole and in order, even if threads are mixed together
+    for (int Thread = 0; Thread < 4; Thread++)
+    {
+        size_t Position = 0;
+        for (int i = 0; i < 100; i++)
+        {
+            Position = Output.find("[WARNING]room" + std::to_string(Thread) + " " + std::to_string(i) + " 0.5\n", Position);
+            ASSERT_NE(Position, std::string::npos);
+        }
+    }
+
+    // Strings longer than the record are cut instead of overflowing it
+    Output.clear();
+    Logger::Get().SetSink([&](std::string_view Text) { Output += Text; });
+    SCPROOMGEN_LOG(LogLevel::Error, "%s|%d", std::string(500, 'x'), 7);
+    Logger::Get().Flush();
+    Logger::Get().SetSink(nullptr);
+    EXPECT_EQ(Output, "[ERROR]" + std::string(LogRecord::PayloadSize - sizeof(int) - 1, 'x') + "|7\n");
+}
+
+TEST(GeneratorRules, IntroRoom)
+{
+    Generator Default(false);
+    Generator Intro(false, GeneratorRuleSet::Intro);
+    Default.GenerateMap(1234);
+    Intro.GenerateMap(1234);
+
+    EXPECT_NE(Default.GetDataAtCoordinate(1, MapHeight - 1).RoomName, "173");
+    EXPECT_EQ(Intro.GetDataAtCoordinate(1, MapHeight - 1).RoomName, "173");
+
+    // Rule sets only change what they say they change, and the task path builds the same variant
+    Generator AsyncIntro(false, GeneratorRuleSet::Intro);
+    AsyncIntro.GenerateMapAsync(1234).RunToCompletion();
+    for (int X = 0; X <= MapWidth; X++)
+    {
+        for (int Y = 0; Y <= MapHeight; Y++)
+        {
+            EXPECT_EQ(Default.GetDataAtCoordinate(X, Y).GridType, Intro.GetDataAtCoordinate(X, Y).GridType);
+            EXPECT_EQ(Intro.GetDataAtCoordinate(X, Y).RoomName, AsyncIntro.GetDataAtCoordinate(X, Y).RoomName);
+        }
+    }
+}
+
+TEST(PregenerationPool, HitsAndMisses)
+{
+    PregenerationPoolOptions Options;
+    Options.ThreadCount = 2;
+    Options.RandomCapacity = 3;
+    PregenerationPool Pool(Options);
+
+    Pool.Announce(1234);
+    Pool.Announce(5678);
+    Pool.Withdraw(5678);
+    Pool.WaitUntilIdle();
+
+    PregenerationStats Stats = Pool.GetStats();
+    EXPECT_EQ(Stats.RandomQueueDepth, 3);
+    EXPECT_EQ(Stats.AnnouncedReady, 1);
+    EXPECT_EQ(Stats.AnnouncedPending, 0);
+
+    // Pregenerated maps are the same maps a fresh generator makes
+    Generator Gen(false);
+    std::unique_ptr<GeneratedMap> Announced = Pool.Take(1234);
+    std::unique_ptr<GeneratedMap> Random = Pool.TakeRandom();
+    std::unique_ptr<GeneratedMap> Missed = Pool.Take(42);
+    for (const GeneratedMap* Map : { Announced.get(), Random.get(), Missed.get() })
+    {
+        Gen.GenerateMap(Map->Seed);
+        for (int X = 0; X <= MapWidth; X++)
+        {
+            for (int Y = 0; Y <= MapHeight; Y++)
+            {
+                EXPECT_EQ(Map->Rooms[X][Y].GridType, Gen.GetDataAtCoordinate(X, Y).GridType);
+                EXPECT_EQ(Map->Rooms[X][Y].RoomName, Gen.GetDataAtCoordinate(X, Y).RoomName);
+            }
+        }
+    }
+    EXPECT_EQ(Announced->Seed, 1234);
+    EXPECT_EQ(Missed->Seed, 42);
+
+    Stats = Pool.GetStats();
+    EXPECT_EQ(Stats.AnnouncedHits, 1u);
+    EXPECT_EQ(Stats.AnnouncedMisses, 1u);
+    EXPECT_EQ(Stats.RandomHits, 1u);
+    EXPECT_EQ(Stats.RandomMisses, 0u);
+}
+
+TEST(SeedIndex, MatchesBruteForce)
+{
+    // Crosses a block boundary so both sides of it get merged
+    const int FirstSeed = 65536 - 1500;
+    const int LastSeed = 65536 + 1500;
+    const std::string Path = (std::filesystem::temp_directory_path() / "scproomgen_seeds.idx").string();
+
+    SeedIndexBuildOptions Options;
+    Options.ThreadCount = 2;
+    ASSERT_TRUE(SeedIndexBuilder(Options).Build(FirstSeed, LastSeed, Path));
+
+    SeedIndex Index;
+    ASSERT_TRUE(Index.Open(Path));
+    EXPECT_EQ(Index.GetFirstSeed(), FirstSeed);
+    EXPECT_EQ(Index.GetLastSeed(), LastSeed);
+
+    const std::vector<std::vector<SeedFeature>> Queries = {
+        { SeedFeature::RoomCount(0, RoomType::Room1, 6) },
+        { SeedFeature::RoomCount(1, RoomType::Room3, 2), SeedFeature::ForcedPlacement(2, ForcedRoom4) },
+        { SeedFeature::RoomCount(0, RoomType::Room2, 10), SeedFeature::RoomCount(2, RoomType::Room1, 5), SeedFeature::Checkpoint(1, 9) },
+    };
+
+    std::vector<std::vector<int>> Expected(Queries.size());
+    Generator Gen(false);
+    std::vector<SeedFeature> Features;
+    for (int Seed = FirstSeed; Seed <= LastSeed; Seed++)
+    {
+        Gen.GenerateMap(Seed);
+        SeedIndexBuilder::GatherFeatures(Gen, Features);
+        for (size_t i = 0; i < Queries.size(); i++)
+        {
+            bool bMatches = std::all_of(Queries[i].begin(), Queries[i].end(), [&](const SeedFeature& Feature)
+            {
+                return std::find(Features.begin(), Features.end(), Feature) != Features.end();
+            });
+            if (bMatches)
+            {
+                Expected[i].push_back(Seed);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < Queries.size(); i++)
+    {
+        EXPECT_EQ(Index.Find(Queries[i]), Expected[i]);
+        EXPECT_EQ(Index.Count(Queries[i]), Expected[i].size());
+    }
+    EXPECT_EQ(Index.Count({}), uint64_t(LastSeed - FirstSeed + 1));
+    EXPECT_EQ(Index.Find(Queries[0], 3).size(), std::min<size_t>(3, Expected[0].size()));
+
+    std::filesystem::remove(Path);
+}
+
+TEST(MapArchive, RoundTrip)
+{
+    const std::string Path = (std::filesystem::temp_directory_path() / "scproomgen_maps.arc").string();
+
+    // Skipping every 7th seed makes the blocks non-contiguous, 100 per block puts rows past the first sample
+    std::vector<int> Seeds;
+    for (int Seed = 1000; Seed < 3000; Seed++)
+    {
+        if (Seed % 7 != 0)
+        {
+            Seeds.push_back(Seed);
+        }
+    }
+
+    Generator Gen(false);
+    std::vector<GeneratedMap> Maps(Seeds.size());
+    MapArchiveWriter Writer(100);
+    ASSERT_TRUE(Writer.Open(Path));
+    for (size_t i = 0; i < Seeds.size(); i++)
+    {
+        Gen.GenerateMap(Seeds[i]);
+        Gen.CopyMap(Maps[i]);
+        ASSERT_TRUE(Writer.Add(Maps[i]));
+    }
+    EXPECT_FALSE(Writer.Add(Maps.front()));
+    ASSERT_TRUE(Writer.Close());
+
+    // A plain dump of the cells is several KB per map
+    EXPECT_LT(std::filesystem::file_size(Path), Seeds.size() * 256);
+
+    MapArchive Archive;
+    ASSERT_TRUE(Archive.Open(Path));
+    EXPECT_EQ(Archive.GetMapCount(), Seeds.size());
+
+    GeneratedMap Read;
+    EXPECT_FALSE(Archive.Read(1001 - 1001 % 7, Read));
+    EXPECT_FALSE(Archive.Read(5000, Read));
+
+    for (size_t i = 0; i < Seeds.size(); i++)
+    {
+        ASSERT_TRUE(Archive.Read(Seeds[i], Read));
+        const GeneratedMap& Map = Maps[i];
+        EXPECT_EQ(Read.Seed, Map.Seed);
+        EXPECT_EQ(Read.Report.SetRoomFailures, Map.Report.SetRoomFailures);
+        for (int Zone = 0; Zone < ZoneAmount; Zone++)
+        {
+            EXPECT_EQ(Read.Report.Room1sForced[Zone], Map.Report.Room1sForced[Zone]);
+            EXPECT_EQ(Read.Report.bRoom4Forced[Zone], Map.Report.bRoom4Forced[Zone]);
+            EXPECT_EQ(Read.Report.bRoom2CForceFailed[Zone], Map.Report.bRoom2CForceFailed[Zone]);
+        }
+
+        for (int X = 0; X <= MapWidth; X++)
+        {
+            for (int Y = 0; Y <= MapHeight; Y++)
+            {
+                const RoomArrayEntry& Expected = Map.Rooms[X][Y];
+                const RoomArrayEntry& Actual = Read.Rooms[X][Y];
+                ASSERT_EQ(Actual.RoomName, Expected.RoomName) << "Seed " << Seeds[i] << " at " << X << ", " << Y;
+                ASSERT_EQ(Actual.PosX, Expected.PosX);
+                ASSERT_EQ(Actual.PosY, Expected.PosY);
+                ASSERT_EQ(Actual.GridType, Expected.GridType);
+                ASSERT_EQ(Actual.RoomType, Expected.RoomType);
+                ASSERT_EQ(Actual.RoomZone, Expected.RoomZone);
+                ASSERT_EQ(Actual.RoomRotation, Expected.RoomRotation);
+            }
+        }
+    }
+
+    std::filesystem::remove(Path);
+}
+
+static bool HasViolation(const std::vector<MapViolation>& Violations, MapInvariant Invariant)
+{
+    return std::any_of(Violations.begin(), Violations.end(), [&](const MapViolation& Violation) { return Violation.Invariant == Invariant; });
+}
+
+TEST(MapValidator, CatchesBrokenMaps)
+{
+    // Plenty of seeds break something (the forcing passes are as loose as CB's), so start from one that doesn't
+    Generator Gen(false);
+    GeneratedMap Map;
+    std::vector<MapViolation> Violations;
+    for (int Seed = 0; ; Seed++)
+    {
+        Gen.GenerateMap(Seed);
+        Gen.CopyMap(Map);
+        Violations.clear();
+        MapValidator::Validate(Map, InvariantAll, Violations);
+        if (Violations.empty())
+        {
+            break;
+        }
+    }
+
+    auto Break = [&](auto&& Change)
+    {
+        GeneratedMap Broken = Map;
+        Change(Broken);
+        std::vector<MapViolation> Found;
+        MapValidator::Validate(Broken, InvariantAll, Found);
+        return Found;
+    };
+
+    auto FindCell = [&](auto&& Matches, int& OutX, int& OutY)
+    {
+        for (OutX = 1; OutX < MapWidth; OutX++)
+        {
+            for (OutY = 1; OutY < MapHeight; OutY++)
+            {
+                if (Matches(OutX, OutY))
+                {
+                    return;
+                }
+            }
+        }
+        FAIL() << "No matching cell";
+    };
+
+    int X = 0, Y = 0;
+    FindCell([&](int X, int Y) { return Map.Rooms[X][Y].GridType == 1; }, X, Y);
+
+    std::vector<MapViolation> Found = Break([&](GeneratedMap& Broken) { Broken.Rooms[X][Y].RoomType = RoomType::Room4; });
+    ASSERT_EQ(Found.size(), 1u);
+    EXPECT_EQ(Found[0].Invariant, InvariantRoomShape);
+    EXPECT_EQ(Found[0].X, X);
+    EXPECT_EQ(Found[0].Y, Y);
+    EXPECT_EQ(Found[0].Seed, Map.Seed);
+
+    Found = Break([&](GeneratedMap& Broken) { Broken.Rooms[X][Y].GridType = 3; });
+    ASSERT_EQ(Found.size(), 1u);
+    EXPECT_EQ(Found[0].Invariant, InvariantNeighbourCount);
+
+    auto IsEmptyAround = [&](int X, int Y)
+    {
+        return !Map.Rooms[X][Y].GridType && !Map.Rooms[X - 1][Y].GridType && !Map.Rooms[X + 1][Y].GridType && !Map.Rooms[X][Y - 1].GridType &&
+            !Map.Rooms[X][Y + 1].GridType;
+    };
+    FindCell(IsEmptyAround, X, Y);
+    EXPECT_TRUE(HasViolation(Break([&](GeneratedMap& Broken) { Broken.Rooms[X][Y].GridType = 1; }), InvariantConnected));
+
+    FindCell([&](int X, int Y) { return Map.Rooms[X][Y].GridType == 255; }, X, Y);
+    EXPECT_TRUE(HasViolation(Break([&](GeneratedMap& Broken) { Broken.Rooms[X][Y].GridType = 2; }), InvariantZoneCheckpoints));
+
+    FindCell([&](int X, int Y) { return Map.Rooms[X][Y].RoomType == RoomType::Room4 && Map.Rooms[X][Y].GridType != 255; }, X, Y);
+    Found = Break([&](GeneratedMap& Broken) { Broken.Rooms[X][Y].RoomType = RoomType::Room3; });
+    EXPECT_TRUE(HasViolation(Found, InvariantRoomShape));
+    EXPECT_EQ(HasViolation(Found, InvariantRoom4PerZone), Map.Report.bRoom4ForceFailed[Generator::GetMapZone(Y)] == false);
+
+    EXPECT_TRUE(HasViolation(Break([&](GeneratedMap& Broken) { Broken.Report.OutOfBoundsWrites = 1; }), InvariantInBounds));
+}
+
+TEST(MapValidator, ReportsSeedAndStage)
+{
+    Generator Gen(false);
+    Gen.SetValidation(InvariantAll);
+
+    std::uint64_t Expected[MapInvariantCount]{};
+    for (int Seed = 0; Seed < 1000; Seed++)
+    {
+        Gen.GenerateMap(Seed);
+        std::vector<MapViolation> Violations = Gen.GetViolations();
+        for (const MapViolation& Violation : Violations)
+        {
+            EXPECT_EQ(Violation.Seed, Seed);
+            EXPECT_TRUE(MapValidator::GetInvariantsAfter(Violation.Stage) & Violation.Invariant) << MapValidator::GetInvariantName(Violation.Invariant);
+            Expected[std::countr_zero(unsigned(Violation.Invariant))]++;
+        }
+
+        // The task runs the same checks between its steps
+        if (Seed % 50 == 0)
+        {
+            Gen.GenerateMapAsync(Seed).RunToCompletion();
+            ASSERT_EQ(Gen.GetViolations().size(), Violations.size());
+            for (size_t i = 0; i < Violations.size(); i++)
+            {
+                EXPECT_EQ(Gen.GetViolations()[i].Invariant, Violations[i].Invariant);
+                EXPECT_EQ(Gen.GetViolations()[i].Stage, Violations[i].Stage);
+                EXPECT_EQ(Gen.GetViolations()[i].X, Violations[i].X);
+                EXPECT_EQ(Gen.GetViolations()[i].Y, Violations[i].Y);
+            }
+        }
+    }
+
+    SeedStatisticsOptions Options;
+    Options.ThreadCount = 2;
+    Options.ChunkSize = 100;
+    Options.Validation = InvariantAll;
+    SeedStatistics Stats = SeedStatisticsEngine(Options).Run(0, 999);
+
+    for (int i = 0; i < MapInvariantCount; i++)
+    {
+        EXPECT_EQ(Stats.InvariantViolations[i], Expected[i]) << MapValidator::GetInvariantName(MapInvariant(1u << i));
+    }
+    EXPECT_LE(Stats.ViolationSamples.size(), SeedStatistics::MaxViolationSamples);
+}
+
+TEST(StageCache, ReusesLayouts)
+{
+    const std::filesystem::path Directory = std::filesystem::temp_directory_path() / "scproomgen_stagecache";
+    std::filesystem::remove_all(Directory);
+
+    Generator Plain(false);
+    Generator Cached(false);
+    GeneratedMap Expected;
+    GeneratedMap Actual;
+    auto ExpectSameMaps = [&](StageCache& Cache)
+    {
+        for (int Seed = 0; Seed < 200; Seed++)
+        {
+            Plain.GenerateMap(Seed);
+            Plain.CopyMap(Expected);
+            Cache.GenerateMap(Cached, Seed);
+            Cached.CopyMap(Actual);
+            for (int X = 0; X <= MapWidth; X++)
+            {
+                for (int Y = 0; Y <= MapHeight; Y++)
+                {
+                    ASSERT_EQ(Actual.Rooms[X][Y].RoomName, Expected.Rooms[X][Y].RoomName) << "Seed " << Seed << " at " << X << ", " << Y;
+                    ASSERT_EQ(Actual.Rooms[X][Y].GridType, Expected.Rooms[X][Y].GridType);
+                    ASSERT_EQ(Actual.Rooms[X][Y].RoomType, Expected.Rooms[X][Y].RoomType);
+                    ASSERT_EQ(Actual.Rooms[X][Y].RoomRotation, Expected.Rooms[X][Y].RoomRotation);
+                }
+            }
+        }
+    };
+
+    {
+        StageCache Cache;
+        ASSERT_TRUE(Cache.Open(Directory.string()));
+        ExpectSameMaps(Cache);
+        EXPECT_EQ(Cache.GetStats().Misses, 200u);
+        EXPECT_EQ(Cache.GetStats().Stores, 200u);
+    }
+
+    {
+        StageCache Cache;
+        ASSERT_TRUE(Cache.Open(Directory.string()));
+        EXPECT_EQ(Cache.GetEntryCount(), 200u);
+        ExpectSameMaps(Cache);
+        EXPECT_EQ(Cache.GetStats().Hits, 200u);
+        EXPECT_EQ(Cache.GetStats().Stores, 0u);
+    }
+
+    // A changed layout hash can't see the old entries, and the old file becomes stale
+    {
+        StageCache Cache;
+        ASSERT_TRUE(Cache.Open(Directory.string(), Generator::GetLayoutStageHash(GeneratorRuleSet::Default) + 1));
+        LayoutStageResult Layout;
+        EXPECT_FALSE(Cache.Find(0, Layout));
+        EXPECT_EQ(Cache.RemoveStaleFiles(), 1);
+    }
+
+    std::filesystem::remove_all(Directory);
+}
+
+TEST(SeedSweep, ShardsResumeAndMerge)
+{
+    SweepShard Shard;
+    EXPECT_TRUE(SweepShard::Parse("3/16", Shard));
+    EXPECT_EQ(Shard.Index, 3);
+    EXPECT_EQ(Shard.Count, 16);
+    EXPECT_FALSE(SweepShard::Parse("16/16", Shard));
+    EXPECT_FALSE(SweepShard::Parse("1/2x", Shard));
+    EXPECT_FALSE(SweepShard::Parse("1", Shard));
+
+    const std::filesystem::path Directory = std::filesystem::temp_directory_path() / "scproomgen_sweep";
+    std::filesystem::remove_all(Directory);
+
+    SeedSweepOptions Options;
+    Options.Directory = Directory.string();
+    Options.FirstSeed = 0;
+    Options.LastSeed = 2999;
+    Options.CheckpointSeeds = 250;
+    Options.Statistics.ThreadCount = 2;
+
+    const SeedStatistics Expected = SeedStatisticsEngine(Options.Statistics).Run(Options.FirstSeed, Options.LastSeed);
+
+    constexpr int ShardCount = 4;
+    for (int Index = 0; Index < ShardCount; Index++)
+    {
+        Options.Shard = { Index, ShardCount };
+        std::int64_t ShardFirst = 0, ShardLast = 0;
+        Options.Shard.GetRange(Options.FirstSeed, Options.LastSeed, ShardFirst, ShardLast);
+
+        // Shard 1 stops after its first checkpoint as if it crashed, and has to pick up from there
+        if (Index == 1)
+        {
+            SeedSweepOptions Stopped = Options;
+            Stopped.OnCheckpoint = [](const SweepCheckpoint&) { return false; };
+            EXPECT_FALSE(SeedSweep(Stopped).Run());
+
+            SweepCheckpoint Merged;
+            std::string Error;
+            EXPECT_FALSE(SeedSweep::Merge(Options.Directory, ShardCount, Merged, Error));
+        }
+
+        std::vector<std::int64_t> Checkpoints;
+        SeedSweepOptions Resumed = Options;
+        Resumed.OnCheckpoint = [&](const SweepCheckpoint& Checkpoint)
+        {
+            Checkpoints.push_back(Checkpoint.NextSeed);
+            return true;
+        };
+        ASSERT_TRUE(SeedSweep(Resumed).Run());
+        ASSERT_FALSE(Checkpoints.empty());
+        EXPECT_EQ(Checkpoints.front(), ShardFirst + (Index == 1 ? 500 : 250));
+        EXPECT_EQ(Checkpoints.back(), ShardLast + 1);
+    }
+
+    SweepCheckpoint Merged;
+    std::string Error;
+    ASSERT_TRUE(SeedSweep::Merge(Options.Directory, ShardCount, Merged, Error)) << Error;
+    EXPECT_TRUE(Merged.IsComplete());
+
+    std::string ExpectedBytes, MergedBytes;
+    Expected.Write(ExpectedBytes);
+    Merged.Statistics.Write(MergedBytes);
+    EXPECT_EQ(Merged.Statistics.SeedCount, 3000u);
+    EXPECT_TRUE(ExpectedBytes == MergedBytes);
+
+    // A different sweep in the same directory can't take over the shard outputs
+    Options.LastSeed = 3999;
+    Options.Shard = { 0, ShardCount };
+    EXPECT_FALSE(SeedSweep(Options).Run());
+
+    std::filesystem::remove_all(Directory);
+}
+
+TEST(GenerationProfiler, RecordsStagesAndBuckets)
+{
+    GenerationProfiler Profiler(100);
+    Generator Gen(false);
+    Gen.SetProfiler(&Profiler);
+    for (int Seed = 0; Seed < 300; Seed++)
+    {
+        Gen.GenerateMap(Seed);
+    }
+
+    // Stopping early and carrying on is still one map per seed
+    Gen.GenerateMapUntil(300, GenerationStage::ForceRoom1s);
+    Gen.ContinueMapUntil(GenerationStage::Done);
+
+    for (int Stage = 0; Stage < int(GenerationStage::Done); Stage++)
+    {
+        const ProfileEntry& Entry = Profiler.GetStage(GenerationStage(Stage));
+        EXPECT_EQ(Entry.Count, 301u);
+        EXPECT_GT(Entry.Totals.Nanoseconds, 0u);
+    }
+
+    ASSERT_EQ(Profiler.GetBuckets().size(), 4u);
+    EXPECT_EQ(Profiler.GetBuckets().at(0).Count, 100u);
+    EXPECT_EQ(Profiler.GetBuckets().at(300).Count, 1u);
+
+    // Wherever perf_event_open works, the counters have to add up to something sensible
+    if (Profiler.GetAvailable() & (1u << PerfInstructions))
+    {
+        EXPECT_GT(Profiler.GetStage(GenerationStage::Layout).Totals.Counters[PerfInstructions], 0u);
+    }
+    if ((Profiler.GetAvailable() & 3u) == 3u)
+    {
+        EXPECT_GT(Profiler.GetStage(GenerationStage::AssignRooms).GetIPC(), 0.0);
+    }
+
+    GenerationProfiler Total(100);
+    Total.Merge(Profiler);
+    Total.Merge(Profiler);
+    EXPECT_EQ(Total.GetStage(GenerationStage::Layout).Count, 602u);
+    EXPECT_NE(Total.FormatReport().find("ForceRoom4sAndRoom2Cs"), std::string::npos);
+
+    // Profiling doesn't change the maps
+    GeneratedMap Profiled, Plain;
+    Gen.GenerateMap(42);
+    Gen.CopyMap(Profiled);
+    Generator PlainGen(false);
+    PlainGen.GenerateMap(42);
+    PlainGen.CopyMap(Plain);
+    for (int X = 0; X <= MapWidth; X++)
+    {
+        for (int Y = 0; Y <= MapHeight; Y++)
+        {
+            EXPECT_EQ(Profiled.Rooms[X][Y].RoomName, Plain.Rooms[X][Y].RoomName);
+        }
+    }
+}
+
+TEST(SimilarityIndex, FindsNearLayouts)
+{
+    const int FirstSeed = 5000;
+    const int LastSeed = 9999;
+    const std::string Path = (std::filesystem::temp_directory_path() / "scproomgen_similar.idx").string();
+
+    SimilarityIndexBuildOptions Options;
+    Options.ThreadCount = 2;
+    ASSERT_TRUE(SimilarityIndexBuilder(Options).Build(FirstSeed, LastSeed, Path));
+
+    SimilarityIndex Index;
+    ASSERT_TRUE(Index.Open(Path));
+    EXPECT_EQ(Index.GetFirstSeed(), FirstSeed);
+    EXPECT_EQ(Index.GetLastSeed(), LastSeed);
+
+    // The partial generation the index uses sees the same layout as a full one
+    Generator Gen(false);
+    GeneratedMap Map;
+    Gen.GenerateMap(7321);
+    Gen.CopyMap(Map);
+    const LayoutSignature Reference = LayoutSignature::FromMap(Map);
+    LayoutSignature Stored;
+    ASSERT_TRUE(Index.GetSignature(7321, Stored));
+    EXPECT_EQ(Stored.Words, Reference.Words);
+    EXPECT_EQ(Reference.GetRoomCount(), LayoutSignature::GetHammingDistance(Reference, LayoutSignature()));
+    EXPECT_EQ(LayoutSignature::GetJaccardDistance(Reference, Stored), 0.0);
+
+    Gen.GenerateMap(7322);
+    const LayoutSignature Other = LayoutSignature::FromGenerator(Gen);
+    int Differing = 0;
+    for (int i = 0; i < LayoutSignature::WordCount; i++)
+    {
+        Differing += std::popcount(Reference.Words[i] ^ Other.Words[i]);
+    }
+    EXPECT_EQ(LayoutSignature::GetHammingDistance(Reference, Other), Differing);
+
+    for (LayoutMetric Metric : { LayoutMetric::Jaccard, LayoutMetric::Hamming })
+    {
+        const std::vector<SimilarMap> Nearest = Index.FindNearest(Reference, 5, Metric);
+        const std::vector<SimilarMap> Exact = Index.FindNearestExact(Reference, 5, Metric);
+        ASSERT_FALSE(Nearest.empty());
+        ASSERT_EQ(Exact.size(), 5u);
+        EXPECT_EQ(Nearest[0].Seed, 7321);
+        EXPECT_EQ(Nearest[0].Distance, 0.0);
+        EXPECT_EQ(Exact[0].Seed, 7321);
+        for (size_t i = 1; i < Exact.size(); i++)
+        {
+            EXPECT_LE(Exact[i - 1].Distance, Exact[i].Distance);
+        }
+    }
+
+    // Banding only compares a small part of the index
+    EXPECT_LT(Index.CountCandidates(Reference), size_t(LastSeed - FirstSeed + 1) / 4);
+    EXPECT_FALSE(Index.GetSignature(LastSeed + 1, Stored));
+
+    std::filesystem::remove(Path);
+}
+
+TEST(RoomIndex, FindsEveryNamedRoom)
+{
+    for (int NameId = 0; NameId < GetRoomNameCount(); NameId++)
+    {
+        EXPECT_EQ(GetRoomNameId(GetRoomName(NameId)), NameId);
+    }
+    EXPECT_EQ(GetRoomNameId("notaroom"), NoRoomNameId);
+
+    // Intro rules put 173 over whatever AssignRooms left at (1, MapHeight - 1)
+    for (GeneratorRuleSet RuleSet : { GeneratorRuleSet::Default, GeneratorRuleSet::Intro })
+    {
+        Generator Gen(false, RuleSet);
+        Generator Partial(false, RuleSet);
+        for (int Seed = 0; Seed < 300; Seed++)
+        {
+            Gen.GenerateMap(Seed);
+            const RoomIndex& Rooms = Gen.GetRoomIndex();
+
+            int Named = 0;
+            for (int Y = MapHeight; Y >= 0; Y--)
+            {
+                for (int X = 0; X <= MapWidth; X++)
+                {
+                    const std::string& Name = Gen.GetDataAtCoordinate(X, Y).RoomName;
+                    if (Name.empty())
+                    {
+                        continue;
+                    }
+
+                    Named++;
+                    const int NameId = GetRoomNameId(Name);
+                    ASSERT_NE(NameId, NoRoomNameId) << Name;
+                    bool bFound = false;
+                    for (int Occurrence = 0; Rooms.Find(NameId, Occurrence) != NoCoordinate; Occurrence++)
+                    {
+                        bFound |= Rooms.Find(NameId, Occurrence) == PackCoordinate(X, Y);
+                    }
+                    EXPECT_TRUE(bFound) << "Seed " << Seed << " " << Name;
+                }
+            }
+            EXPECT_EQ(Rooms.GetCount(), Named);
+
+            // Locating from a partial map has to land where the full map puts the room
+            for (const char* Name : { "checkpoint1", "checkpoint2", "173", "gatea" })
+            {
+                Partial.GenerateMapUntil(Seed, GenerationStage::ForceRoom1s);
+                EXPECT_EQ(Partial.LocateRoom(GetRoomNameId(Name)), Rooms.Find(GetRoomNameId(Name))) << "Seed " << Seed << " " << Name;
+            }
+        }
+    }
+}
+
+TEST(RoomLocator, MatchesScalarGeneration)
+{
+    std::vector<int> Seeds;
+    for (int i = 0; i < 3000; i++)
+    {
+        Seeds.push_back(i * 7919 - 1000);
+    }
+
+    for (GeneratorRuleSet RuleSet : { GeneratorRuleSet::Default, GeneratorRuleSet::Intro })
+    {
+        RoomLocatorOptions Options;
+        Options.ThreadCount = 2;
+        Options.RuleSet = RuleSet;
+        RoomLocator Locator(Options);
+
+        for (const char* Name : { "checkpoint1", "checkpoint2", "173", "gatea", "pocketdimension" })
+        {
+            const int NameId = GetRoomNameId(Name);
+            std::vector<PackedCoordinate> Coordinates(Seeds.size());
+            Locator.Locate(NameId, Seeds.data(), Seeds.size(), Coordinates.data());
+
+            Generator Gen(false, RuleSet);
+            for (size_t i = 0; i < Seeds.size(); i += 7)
+            {
+                Gen.GenerateMap(Seeds[i]);
+                ASSERT_EQ(Coordinates[i], Gen.GetRoomIndex().Find(NameId)) << "Seed " << Seeds[i] << " " << Name;
+            }
+        }
+    }
+
+    PackedCoordinate Unknown = 0;
+    RoomLocator().Locate(NoRoomNameId, Seeds.data(), 1, &Unknown);
+    EXPECT_EQ(Unknown, NoCoordinate);
+}
+
+TEST(Metrics, HistogramBuckets)
+{
+    for (std::uint64_t Value = 0; Value < (1u << 20); Value += 1 + Value / 1000)
+    {
+        const int Bucket = LatencyHistogram::GetBucket(Value);
+        ASSERT_LE(LatencyHistogram::GetBucketLowest(Bucket), Value);
+        ASSERT_GE(LatencyHistogram::GetBucketHighest(Bucket), Value);
+        ASSERT_LE(LatencyHistogram::GetBucketHighest(Bucket) - LatencyHistogram::GetBucketLowest(Bucket), Value / 32);
+    }
+    EXPECT_EQ(LatencyHistogram::GetBucket(~0ull), LatencyHistogram::BucketCount - 1);
+    EXPECT_EQ(LatencyHistogram::GetBucket((1ull << LatencyHistogram::MaxValueBits) - 1), LatencyHistogram::BucketCount - 1);
+
+    LatencyHistogram Histogram;
+    for (std::uint64_t Value = 1; Value <= 10000; Value++)
+    {
+        Histogram.Add(Value * 1000);
+    }
+    EXPECT_EQ(Histogram.GetCount(), 10000u);
+    EXPECT_EQ(Histogram.GetMax(), 10000000u);
+    EXPECT_NEAR(double(Histogram.GetPercentile(0.5)), 5000000.0, 5000000.0 / 32);
+    EXPECT_NEAR(double(Histogram.GetPercentile(0.99)), 9900000.0, 9900000.0 / 32);
+    EXPECT_EQ(Histogram.GetPercentile(1.0), 10000000u);
+}
+
+TEST(Metrics, RecordsGeneration)
+{
+    const MetricsSnapshot Before = Metrics::Get().Snapshot();
+
+    // Two threads, so the snapshot has to add up shards
+    std::atomic<std::uint64_t> Forced = 0;
+    std::atomic<std::uint64_t> SetRoomFailures = 0;
+    auto Generate = [&](int FirstSeed)
+    {
+        Generator Gen(false);
+        for (int Seed = FirstSeed; Seed < FirstSeed + 200; Seed++)
+        {
+            Gen.GenerateMap(Seed);
+            for (int i = 0; i < ZoneAmount; i++)
+            {
+                Forced += Gen.GetReport().Room1sForced[i] + Gen.GetReport().bRoom4Forced[i] + Gen.GetReport().bRoom2CForced[i];
+            }
+            SetRoomFailures += Gen.GetReport().SetRoomFailures;
+        }
+    };
+    std::thread Other(Generate, 1000);
+    Generate(5000);
+    Other.join();
+
+    const MetricsSnapshot After = Metrics::Get().Snapshot();
+    if (!bMetricsEnabled)
+    {
+        EXPECT_EQ(After.Counters[CounterMapsGenerated], 0u);
+        return;
+    }
+
+    EXPECT_EQ(After.Counters[CounterMapsGenerated] - Before.Counters[CounterMapsGenerated], 400u);
+    EXPECT_EQ(After.Counters[CounterForcedPlacements] - Before.Counters[CounterForcedPlacements], Forced.load());
+    EXPECT_EQ(After.Counters[CounterSetRoomFailures] - Before.Counters[CounterSetRoomFailures], SetRoomFailures.load());
+    for (int Latency = 0; Latency < MetricLatencyCount; Latency++)
+    {
+        EXPECT_EQ(After.Latencies[Latency].GetCount() - Before.Latencies[Latency].GetCount(), 400u) << Latency;
+    }
+    EXPECT_GE(After.Latencies[MapLatency].GetPercentile(0.999), After.Latencies[MapLatency].GetPercentile(0.5));
+    EXPECT_GT(After.Latencies[MapLatency].GetPercentile(0.5), 0u);
+
+    const std::string Prometheus = After.FormatPrometheus();
+    EXPECT_NE(Prometheus.find("# TYPE scproomgen_maps_generated_total counter"), std::string::npos);
+    EXPECT_NE(Prometheus.find("scproomgen_stage_duration_seconds{stage=\"Layout\",quantile=\"0.99\"}"), std::string::npos);
+    EXPECT_NE(Prometheus.find("scproomgen_map_duration_seconds_count "), std::string::npos);
+
+    const std::string Json = After.FormatJson();
+    EXPECT_EQ(Json.front(), '{');
+    EXPECT_EQ(Json.back(), '}');
+    EXPECT_NE(Json.find("\"Map\":{\"count\":"), std::string::npos);
+}
+
+TEST(BakedMaps, MatchRuntimeGeneration)
+{
+    static_assert(Generator::GenerateSeed("MyMap") == 1411);
+
+    Generator Gen;
+    for (const char* SeedStr : { "MyMap", "DONTBLINK", "d9341", "JORGE", "dirtymetal" })
+    {
+        const BakedMap* Baked = FindBakedMap(Generator::GenerateSeed(SeedStr));
+        ASSERT_NE(Baked, nullptr) << SeedStr;
+
+        GeneratedMap Expected;
+        Gen.GenerateMap(SeedStr);
+        Gen.CopyMap(Expected);
+
+        GeneratedMap Actual;
+        Baked->CopyTo(Actual);
+        EXPECT_EQ(Actual.Seed, Expected.Seed);
+        EXPECT_EQ(Actual.Report.SetRoomFailures, Expected.Report.SetRoomFailures) << SeedStr;
+        for (int X = 0; X <= MapWidth; X++)
+        {
+            for (int Y = 0; Y <= MapHeight; Y++)
+            {
+                const RoomArrayEntry& Entry = Actual.Rooms[X][Y];
+                const RoomArrayEntry& ExpectedEntry = Expected.Rooms[X][Y];
+                ASSERT_EQ(Entry.RoomName, ExpectedEntry.RoomName) << SeedStr << " " << X << ", " << Y;
+                ASSERT_EQ(Entry.GridType, ExpectedEntry.GridType) << SeedStr << " " << X << ", " << Y;
+                ASSERT_EQ(Entry.RoomType, ExpectedEntry.RoomType) << SeedStr << " " << X << ", " << Y;
+                ASSERT_EQ(Entry.RoomZone, ExpectedEntry.RoomZone) << SeedStr << " " << X << ", " << Y;
+                ASSERT_EQ(Entry.RoomRotation, ExpectedEntry.RoomRotation) << SeedStr << " " << X << ", " << Y;
+            }
+        }
+    }
+
+    EXPECT_EQ(FindBakedMap(Generator::GenerateSeed("MyMap"), GeneratorRuleSet::Intro), nullptr);
+
+    // Run time evaluation goes through the same passes, with BlitzRandom's blocks instead of single steps
+    Generator IntroGen(false, GeneratorRuleSet::Intro);
+    IntroGen.GenerateMap(4321);
+    const BakedMap Intro = BakeMap(4321, GeneratorRuleSet::Intro);
+    EXPECT_EQ(GetRoomName(Intro.Rooms[1][MapHeight - 1].NameId), IntroGen.GetDataAtCoordinate(1, MapHeight - 1).RoomName);
+    EXPECT_EQ(Intro.GetHash(), BakeMap(4321, GeneratorRuleSet::Intro).GetHash());
+}
+
+TEST(DivergenceBisector, FindsFirstDivergence)
+{
+    Generator Gen;
+    GenerationTrace Trace;
+    DivergenceBisector::Record(Gen, 1234, Trace);
+    ASSERT_GT(Trace.Steps.size(), 40u);
+    EXPECT_EQ(Trace.Steps.front().Stage, GenerationStage::Layout);
+    EXPECT_EQ(Trace.Steps.back().Stage, GenerationStage::AssignRooms);
+    EXPECT_EQ(Trace.Steps.back().GridHash, GetTraceGridHash(Gen.GetMap()));
+    EXPECT_EQ(DivergenceBisector::Compare(Trace, Trace).Kind, Divergence::None);
+
+    // A later step going wrong doesn't hide an earlier one
+    GenerationTrace Reference = Trace;
+    Reference.Steps[20].GridHash ^= 1;
+    Reference.Steps[10].Draws++;
+    const Divergence Found = DivergenceBisector::Compare(Trace, Reference);
+    EXPECT_EQ(Found.Kind, Divergence::Draws);
+    EXPECT_EQ(Found.Step, 10);
+    EXPECT_EQ(Found.Stage, Trace.Steps[10].Stage);
+
+    const std::string Path = (std::filesystem::temp_directory_path() / "scproomgen_traces.txt").string();
+    ASSERT_TRUE(DivergenceBisector::SaveTraces(Path, { Trace, Reference }));
+    std::vector<GenerationTrace> Loaded;
+    ASSERT_TRUE(DivergenceBisector::LoadTraces(Path, Loaded));
+    std::filesystem::remove(Path);
+    ASSERT_EQ(Loaded.size(), 2u);
+    EXPECT_EQ(DivergenceBisector::Compare(Trace, Loaded[0]).Kind, Divergence::None);
+    EXPECT_EQ(DivergenceBisector::Compare(Trace, Loaded[1]).Step, 10);
+
+    // A room renamed in the dump is blamed on the AssignRooms row that named it
+    RoomGrid Dump = Gen.GetMap();
+    EXPECT_EQ(DivergenceBisector::CompareWithDump(Trace, Gen.GetMap(), Dump).Kind, Divergence::None);
+    const PackedCoordinate Checkpoint = Gen.GetRoomIndex().Find(GetRoomNameId("checkpoint1"));
+    Dump[GetPackedX(Checkpoint)][GetPackedY(Checkpoint)].RoomName = "room2closets";
+    const Divergence Renamed = DivergenceBisector::CompareWithDump(Trace, Gen.GetMap(), Dump);
+    EXPECT_EQ(Renamed.Kind, Divergence::Cell);
+    EXPECT_EQ(Renamed.Field, TraceRoomName);
+    EXPECT_EQ(Renamed.Stage, GenerationStage::AssignRooms);
+    EXPECT_EQ(Renamed.Iteration, MapHeight - 1 - GetPackedY(Checkpoint));
+    EXPECT_EQ(Renamed.Ours, "checkpoint1");
+
+    std::vector<GenerationTrace> References(300);
+    for (int i = 0; i < int(References.size()); i++)
+    {
+        DivergenceBisector::Record(Gen, i * 104729, References[i]);
+    }
+    References[123].Steps[5].GridHash ^= 1;
+
+    DivergenceBisectorOptions Options;
+    Options.ThreadCount = 4;
+    std::vector<Divergence> Divergences;
+    DivergenceBisector(Options).CheckTraces(References, Divergences);
+    ASSERT_EQ(Divergences.size(), References.size());
+    for (int i = 0; i < int(Divergences.size()); i++)
+    {
+        EXPECT_EQ(Divergences[i].Kind, i == 123 ? Divergence::GridHash : Divergence::None) << Divergences[i].Describe();
+    }
+
+    MapDump MyMap;
+    ASSERT_TRUE(MyMap.Load(RESOURCES_ROOT_PATH "/mapdump_MyMap.json"));
+    MyMap.Seed = Generator::GenerateSeed("MyMap");
+    DivergenceBisector(Options).CheckDumps({ MyMap }, Divergences);
+    ASSERT_EQ(Divergences.size(), 1u);
+    EXPECT_EQ(Divergences[0].Seed, MyMap.Seed);
+}
+
+TEST(MapPublisher, ReadersSeeWholeMaps)
+{
+    // What each seed's finished map hashes to, so a reader can tell a torn map from a whole one
+    constexpr int SeedCount = 64;
+    Generator Gen;
+    std::vector<std::uint64_t> Hashes(SeedCount);
+    for (int i = 0; i < SeedCount; i++)
+    {
+        Gen.GenerateMap(i * 7919);
+        Hashes[i] = GetTraceGridHash(Gen.GetMap());
+    }
+
+    MapPublisher Publisher;
+    EXPECT_FALSE(Publisher.Acquire());
+
+    std::atomic<bool> bDone = false;
+    std::atomic<int> Reads = 0;
+    std::atomic<int> TornReads = 0;
+    std::vector<std::thread> Readers;
+    for (int t = 0; t < 4; t++)
+    {
+        Readers.emplace_back([&]()
+        {
+            while (!bDone.load())
+            {
+                const MapSnapshot Snapshot = Publisher.Acquire();
+                if (!Snapshot)
+                {
+                    continue;
+                }
+
+                const int Index = Snapshot->Seed / 7919;
+                if (Index < 0 || Index >= SeedCount || GetTraceGridHash(Snapshot->Rooms) != Hashes[Index])
+                {
+                    TornReads++;
+                }
+                Reads++;
+            }
+        });
+    }
+
+    Gen.SetPublisher(&Publisher);
+    for (int Round = 0; Round < 20; Round++)
+    {
+        for (int i = 0; i < SeedCount; i++)
+        {
+            Gen.GenerateMap(i * 7919);
+        }
+    }
+    Gen.SetPublisher(nullptr);
+
+    // Keep publishing until the readers have had a real go at it
+    while (Reads.load() < 1000)
+    {
+        Publisher.Publish(Gen);
+    }
+    bDone = true;
+    for (std::thread& Reader : Readers)
+    {
+        Reader.join();
+    }
+
+    EXPECT_EQ(TornReads.load(), 0);
+    EXPECT_GE(Publisher.GetPublishCount(), 20u * SeedCount);
+
+    // A held snapshot keeps its map through later publishes, and its map is recycled once it's let go
+    MapSnapshot Held = Publisher.Acquire();
+    ASSERT_TRUE(Held);
+    const int HeldSeed = Held->Seed;
+    Gen.GenerateMap(1);
+    Publisher.Publish(Gen);
+    Publisher.Publish(Gen);
+    EXPECT_EQ(Held->Seed, HeldSeed);
+    EXPECT_EQ(Publisher.Acquire()->Seed, 1);
+    EXPECT_GE(Publisher.GetRetiredCount(), 1);
+    Held.Release();
+    Publisher.Publish(Gen);
+    EXPECT_EQ(Publisher.GetRetiredCount(), 0);
+}
+
+TEST(Generator, CellEditsMatchReclassify)
+{
+    Generator Gen;
+    Gen.GenerateMap(8675309);
+    Gen.Reclassify();
+
+    GeneratedMap Before;
+    Gen.CopyMap(Before);
+
+    // Reclassifying a reclassified map changes nothing
+    GeneratedMap After;
+    Gen.Reclassify();
+    Gen.CopyMap(After);
+    for (int X = 0; X <= MapWidth; X++)
+    {
+        for (int Y = 0; Y <= MapHeight; Y++)
+        {
+            EXPECT_EQ(After.Rooms[X][Y].RoomType, Before.Rooms[X][Y].RoomType);
+            EXPECT_EQ(After.Rooms[X][Y].RoomRotation, Before.Rooms[X][Y].RoomRotation);
+        }
+    }
+
+    EXPECT_FALSE(Gen.SetCell(0, 5, true));
+    EXPECT_FALSE(Gen.SetCell(5, MapHeight, true));
+
+    // A removed room leaves the index
+    const PackedCoordinate Checkpoint = Gen.GetRoomIndex().Find(GetRoomNameId("checkpoint1"));
+    ASSERT_NE(Checkpoint, NoCoordinate);
+    EXPECT_TRUE(Gen.SetCell(GetPackedX(Checkpoint), GetPackedY(Checkpoint), false));
+    for (int Occurrence = 0; Gen.GetRoomIndex().Find(GetRoomNameId("checkpoint1"), Occurrence) != NoCoordinate; Occurrence++)
+    {
+        EXPECT_NE(Gen.GetRoomIndex().Find(GetRoomNameId("checkpoint1"), Occurrence), Checkpoint);
+    }
+
+    std::mt19937 Random(42);
+    std::uniform_int_distribution<int> Cell(1, MapWidth - 1);
+    for (int i = 0; i < 200; i++)
+    {
+        std::vector<CellEdit> Edits;
+        const int Count = i % 4 == 0 ? 6 : 1;
+        for (int j = 0; j < Count; j++)
+        {
+            Edits.push_back({ Cell(Random), Cell(Random), Random() % 2 == 0 });
+        }
+        EXPECT_TRUE(Gen.SetCells(Edits));
+
+        int Amounts[RoomType::Room4 + 1][ZoneAmount]{};
+        for (int Type = RoomType::Room1; Type <= RoomType::Room4; Type++)
+        {
+            for (int Zone = 0; Zone < ZoneAmount; Zone++)
+            {
+                Amounts[Type][Zone] = Gen.GetRoomAmount(RoomType(Type), Zone);
+            }
+        }
+
+        Gen.CopyMap(Before);
+        Gen.Reclassify();
+        Gen.CopyMap(After);
+        for (int X = 0; X <= MapWidth; X++)
+        {
+            for (int Y = 0; Y <= MapHeight; Y++)
+            {
+                ASSERT_EQ(After.Rooms[X][Y].GridType, Before.Rooms[X][Y].GridType) << X << ", " << Y;
+                ASSERT_EQ(After.Rooms[X][Y].RoomType, Before.Rooms[X][Y].RoomType) << X << ", " << Y;
+                ASSERT_EQ(After.Rooms[X][Y].RoomRotation, Before.Rooms[X][Y].RoomRotation) << X << ", " << Y;
+                ASSERT_EQ(After.Rooms[X][Y].RoomName, Before.Rooms[X][Y].RoomName) << X << ", " << Y;
+            }
+        }
+        for (int Type = RoomType::Room1; Type <= RoomType::Room4; Type++)
+        {
+            for (int Zone = 0; Zone < ZoneAmount; Zone++)
+            {
+                ASSERT_EQ(Gen.GetRoomAmount(RoomType(Type), Zone), Amounts[Type][Zone]);
+            }
+        }
+    }
+
+    // Cutting a straight hallway leaves a dead end on each side
+    std::vector<CellEdit> Clear;
+    for (int X = 3; X <= 9; X++)
+    {
+        for (int Y = 4; Y <= 6; Y++)
+        {
+            Clear.push_back({ X, Y, false });
+        }
+    }
+    Gen.SetCells(Clear);
+    Gen.SetCells({ { 4, 5, true }, { 5, 5, true }, { 6, 5, true }, { 7, 5, true }, { 8, 5, true } });
+    ASSERT_EQ(Gen.GetDataAtCoordinate(6, 5).RoomType, RoomType::Room2);
+    Gen.SetCell(6, 5, false);
+    EXPECT_EQ(Gen.GetDataAtCoordinate(6, 5).GridType, 0);
+    EXPECT_EQ(Gen.GetDataAtCoordinate(5, 5).RoomType, RoomType::Room1);
+    EXPECT_EQ(Gen.GetDataAtCoordinate(5, 5).RoomRotation, 90.f);
+    EXPECT_EQ(Gen.GetDataAtCoordinate(7, 5).RoomType, RoomType::Room1);
+    EXPECT_EQ(Gen.GetDataAtCoordinate(7, 5).RoomRotation, 270.f);
+}
+
+TEST(LoadTest, ReportsEveryRequest)
+{
+    LoadTestOptions Options;
+    Options.Sessions = 3;
+    Options.Seconds = 0.3;
+    Options.IntervalSeconds = 0.1;
+    Options.SeedCount = 50;
+    Options.RepeatRate = 0.5;
+    Options.Target = LoadTargetService;
+    Options.ServiceThreads = 2;
+
+    LoadTest Test(Options);
+    int Seen = 0;
+    Test.OnInterval = [&](const LoadTestInterval&) { Seen++; };
+    const LoadTestReport Report = Test.Run();
+
+    ASSERT_GT(Report.Completed, 0u);
+    EXPECT_EQ(Seen, int(Report.Intervals.size()));
+    EXPECT_GE(Report.Intervals.size(), 3u);
+    std::uint64_t Completed = 0;
+    for (const LoadTestInterval& Interval : Report.Intervals)
+    {
+        Completed += Interval.Completed;
+        EXPECT_LE(Interval.P50, Interval.P99);
+        EXPECT_LE(Interval.P99, Interval.Max);
+    }
+    EXPECT_EQ(Completed, Report.Completed);
+    EXPECT_GT(Report.Repeats, 0u);
+    EXPECT_LT(Report.Repeats, Report.Completed);
+
+    // The most popular seed is picked about as often as the Zipf weights say, 1 / H(50) of the time
+    std::mt19937 Random(7);
+    std::map<int, int> Picks;
+    for (int i = 0; i < 10000; i++)
+    {
+        Picks[Test.PickSeed(Random)]++;
+    }
+    EXPECT_LE(Picks.size(), 50u);
+    int Hits = 0;
+    for (const auto& [Seed, Count] : Picks)
+    {
+        Hits = std::max(Hits, Count);
+    }
+    EXPECT_GT(Hits, 2000);
+    EXPECT_LT(Hits, 2450);
+}